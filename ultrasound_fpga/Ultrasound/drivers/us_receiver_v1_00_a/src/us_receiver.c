@@ -40,6 +40,13 @@ void sendUSSampleRequest(u8 sensor, u16 count, u16 period) {
 	sendUSCommand(US_COMM_SAMPLE, data);
 }
 
+/**
+ * Send an abort command, stops sampling early
+ * Samples already in flight are still returned, followed by a single US_RESP_NONE
+ */
+void sendUSAbort(void) {
+	sendUSCommand(US_COMM_ABORT, 0);
+}
 
 /**
  * Send command and data over FSL bus
@@ -61,6 +68,25 @@ void readUSData(u8* status, u8* type, u32* data) {
 	*data = (input >> 4);
 }
 
+/**
+ * Read result from FSL bus without waiting
+ * Returns XST_NO_DATA if nothing is waiting
+ */
+int readUSDataNB(u8* status, u8* type, u32* data) {
+	u32 input;
+	int invalid;
+	ngetfsl(input, US_RECEIVER_FSL_SLOT_ID);
+	fsl_isinvalid(invalid);
+	if (invalid)
+		return XST_NO_DATA;
+
+	*status = input & 0x1;
+	*type = (input >> 1) & 0x7;
+	*data = (input >> 4);
+
+	return XST_SUCCESS;
+}
+
 /**
  * Test FSL bus
  */
@@ -16,6 +16,7 @@
 #define US_COMM_TEMP   0x1
 #define US_COMM_SAMPLE 0x2
 #define US_COMM_INIT   0x3
+#define US_COMM_ABORT  0x4
 #define US_COMM_RESET  0xF
 
 // Response types
@@ -34,9 +35,11 @@ void sendUSReset(void);
 void sendUSInit(void);
 void sendUSTempRequest(void);
 void sendUSSampleRequest(u8 sensor, u16 count, u16 period);
+void sendUSAbort(void);
 
 void sendUSCommand(u8 command, u32 data);
 void readUSData(u8* status, u8* type, u32* data);
+int readUSDataNB(u8* status, u8* type, u32* data);
 
 int testUSFSL(void);
 
@@ -137,24 +137,26 @@ input                                     FSL_M_Full;
 //----------------------------------------
 
 	// Define the states of state machine
-	localparam Idle            = 12'b000000000001;
-	localparam Read_Input      = 12'b000000000010;
-	localparam Process_Command = 12'b000000000100;
-	localparam Write_Output    = 12'b000000001000;
-	localparam Send_Init       = 12'b000000010000;
-	localparam Confirm_Init    = 12'b000000100000;
-	localparam Request_Temp    = 12'b000001000000;
-	localparam Receive_Temp    = 12'b000010000000;
-	localparam Start_Sampling  = 12'b000100000000;
-	localparam Wait_To_Sample  = 12'b001000000000;
-	localparam Request_Sample  = 12'b010000000000;
-	localparam Receive_Sample  = 12'b100000000000;
+	localparam Idle            = 13'b0000000000001;
+	localparam Read_Input      = 13'b0000000000010;
+	localparam Process_Command = 13'b0000000000100;
+	localparam Write_Output    = 13'b0000000001000;
+	localparam Send_Init       = 13'b0000000010000;
+	localparam Confirm_Init    = 13'b0000000100000;
+	localparam Request_Temp    = 13'b0000001000000;
+	localparam Receive_Temp    = 13'b0000010000000;
+	localparam Start_Sampling  = 13'b0000100000000;
+	localparam Wait_To_Sample  = 13'b0001000000000;
+	localparam Request_Sample  = 13'b0010000000000;
+	localparam Receive_Sample  = 13'b0100000000000;
+	localparam Abort_Sampling  = 13'b1000000000000;
 	
 	// Commands
 	localparam Comm_Echo   = 4'h0;
 	localparam Comm_Temp   = 4'h1;
 	localparam Comm_Sample = 4'h2;
 	localparam Comm_Init   = 4'h3;
+	localparam Comm_Abort  = 4'h4;
 	localparam Comm_Reset  = 4'hF;
 	
 	// Responses
@@ -168,7 +170,7 @@ input                                     FSL_M_Full;
 	localparam Status_OK    = 1'b0;
 	localparam Status_Error = 1'b1;
 
-	reg  [11:0] state;
+	reg  [12:0] state;
 
 	reg  [ 3:0] command;
 	reg  [27:0] data_in;
@@ -200,7 +202,7 @@ input                                     FSL_M_Full;
 	
 	
 	assign FSL_M_Data  = {data_out, type, status};
-	assign FSL_S_Read  = (state == Read_Input) ? FSL_S_Exists : 0;
+	assign FSL_S_Read  = (state == Read_Input || state == Abort_Sampling) ? FSL_S_Exists : 0;
 	assign FSL_M_Write = (state == Write_Output) ? ~FSL_M_Full : 0;
 	
 	assign ADC_init = (state == Send_Init) ? ADC_init_rdy : 0;
@@ -272,6 +274,14 @@ input                                     FSL_M_Full;
 						// Initialise ADC
 						state <= Send_Init;
 					end
+					Comm_Abort:
+					begin
+						// Not sampling, nothing to abort but always acknowledge
+						status   <= Status_OK;
+						type     <= Resp_None;
+						data_out <= 0;
+						state    <= Write_Output;
+					end
 					Comm_Reset:
 					begin
 						// Reset
@@ -352,7 +362,9 @@ input                                     FSL_M_Full;
 				end
 			
 			Wait_To_Sample:
-				if (sample_timer == 0)
+				if (FSL_S_Exists == 1 && FSL_S_Data[3:0] == Comm_Abort)
+					state <= Abort_Sampling;
+				else if (sample_timer == 0)
 				begin
 					sample_timer <= sample_period - 1;
 					state        <= Request_Sample;
@@ -384,6 +396,18 @@ input                                     FSL_M_Full;
 					end
 				end
 			
+			Abort_Sampling:
+				begin
+					// Abort command is consumed this cycle, stop sampling and acknowledge
+					sample_count <= 0;
+					sample_timer <= 0;
+					sampling     <= 0;
+					status       <= Status_OK;
+					type         <= Resp_None;
+					data_out     <= 0;
+					state        <= Write_Output;
+				end
+			
 			default:
 				state <= Idle;
 			
@@ -0,0 +1,66 @@
+#include "frame.h"
+
+unsigned short frame_crc16(const unsigned char *data, int length, unsigned short crc) {
+	int i;
+
+	// Shifts and XORs only, works a byte at a time without a lookup table
+	for(i = 0; i < length; i++) {
+		crc = (crc >> 8) | (crc << 8);
+		crc ^= data[i];
+		crc ^= (crc & 0xFF) >> 4;
+		crc ^= crc << 12;
+		crc ^= (crc & 0xFF) << 5;
+	}
+
+	return crc;
+}
+
+int frame_cobs_encode(const unsigned char *data, int length, unsigned char *out) {
+	int codeIndex = 0; // Where current block's length code goes
+	int outIndex = 1;
+	unsigned char code = 1; // Current block length plus one
+	int i;
+
+	// Each zero is replaced by distance to next one, runs of 254 non-zero bytes get their own code
+	for(i = 0; i < length; i++) {
+		if(data[i] == 0) {
+			out[codeIndex] = code;
+			codeIndex = outIndex++;
+			code = 1;
+		} else {
+			out[outIndex++] = data[i];
+			code++;
+			if(code == 0xFF) {
+				out[codeIndex] = code;
+				codeIndex = outIndex++;
+				code = 1;
+			}
+		}
+	}
+	out[codeIndex] = code;
+
+	return outIndex;
+}
+
+int frame_cobs_decode(const unsigned char *data, int length, unsigned char *out) {
+	int inIndex = 0;
+	int outIndex = 0;
+	unsigned char code;
+	int i;
+
+	// Output never overtakes input so decoding in place is safe
+	while(inIndex < length) {
+		code = data[inIndex++];
+		if(code == 0 || inIndex + code - 1 > length) return -1;
+
+		for(i = 1; i < code; i++) {
+			if(data[inIndex] == 0) return -1;
+			out[outIndex++] = data[inIndex++];
+		}
+
+		// Every block but a full length one or the last stands for a zero
+		if(code != 0xFF && inIndex < length) out[outIndex++] = 0;
+	}
+
+	return outIndex;
+}
@@ -0,0 +1,17 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+// Byte stuffing and checksums for framed serial links
+// Kept free of platform headers so the same code can be built on a host PC to talk to the board
+
+#define FRAME_DELIMITER 0x00 // Marks start and end of every frame, never appears inside one
+#define FRAME_CRC_INIT 0xFFFF // CRC-16/CCITT starting value
+
+#define FRAME_ENCODED_MAX(length) ((length) + ((length) / 254) + 1) // Worst case size of encoded data, excluding delimiters
+
+unsigned short frame_crc16(const unsigned char *data, int length, unsigned short crc); // CRC-16/CCITT (polynomial 0x1021), pass FRAME_CRC_INIT or previous result to continue
+
+int frame_cobs_encode(const unsigned char *data, int length, unsigned char *out); // Consistent overhead byte stuffing, removes every zero byte, returns encoded length
+int frame_cobs_decode(const unsigned char *data, int length, unsigned char *out); // Undo stuffing, out may be same buffer as data, returns decoded length (-1 if malformed)
+
+#endif /* FRAME_H_ */
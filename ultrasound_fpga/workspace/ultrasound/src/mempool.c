@@ -0,0 +1,29 @@
+#include "mempool.h"
+
+// Bounds of LMB BRAM data, set by linker script
+extern char __lmb_bss_start[];
+extern char __lmb_bss_end[];
+
+static char mempoolMemory[MEMPOOL_SIZE] LMB_BSS __attribute__((aligned(MEMPOOL_ALIGN))); // Memory handed out
+static int mempoolUsed LMB_BSS; // Bytes handed out so far
+
+void mempool_init() {
+	// Startup code only clears .bss, so do the same for LMB BRAM
+	char *p;
+	for(p = __lmb_bss_start; p < __lmb_bss_end; p++) *p = 0;
+}
+
+void *mempool_alloc(int size) {
+	// Round up so next allocation stays aligned
+	size = (size + MEMPOOL_ALIGN - 1) & ~(MEMPOOL_ALIGN - 1);
+	if(size <= 0 || mempoolUsed + size > MEMPOOL_SIZE) return 0;
+
+	void *block = &mempoolMemory[mempoolUsed];
+	mempoolUsed += size;
+
+	return block;
+}
+
+int mempool_free_bytes() {
+	return MEMPOOL_SIZE - mempoolUsed;
+}
@@ -0,0 +1,17 @@
+#ifndef MEMPOOL_H_
+#define MEMPOOL_H_
+
+#include "xil_types.h"
+
+// Place variable in local memory (LMB BRAM) rather than write-through cached DDR - contents are cleared by mempool_init rather than startup code
+#define LMB_BSS __attribute__((section(".lmb_bss")))
+
+#define MEMPOOL_SIZE 2048 // Bytes available to mempool_alloc, held in LMB BRAM
+#define MEMPOOL_ALIGN 4 // Alignment of every allocation (bytes)
+
+void mempool_init(); // Call first thing, before anything in LMB_BSS is used
+
+void *mempool_alloc(int size); // Never freed, NULL once pool is used up
+int mempool_free_bytes();
+
+#endif /* MEMPOOL_H_ */
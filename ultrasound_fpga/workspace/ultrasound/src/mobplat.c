@@ -1,6 +1,6 @@
 #include "mobplat.h"
 
-uart_buff UartBuffRobot;
+uart_buff UartBuffRobot LMB_BSS;
 
 void mpSetDebug(unsigned char state) {
 	// Send debug enable command
@@ -42,3 +42,36 @@ void mpBeep() {
 	// Send beep command
 	while(uart_putchar(&UartBuffRobot, PLATFORM_CMD_BEEP) == -1);
 }
+
+void mpEmergencyStop() {
+	// Queued commands were decided before the emergency and could drive straight back into it
+	char data[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_FORWARD, 0, 0};
+	int tries;
+
+	// Only fails if rest of command being sent leaves no room, or its length is unknown, interrupt handler sends it meanwhile
+	for(tries = 0; tries < MP_ESTOP_TRIES; tries++) {
+		if(uart_putfront(&UartBuffRobot, data, 4, 1) != -1) return;
+	}
+
+	// Failed attempts still dropped everything behind a command of known length, so stop sent at back of queue comes straight after it - behind one of unknown length it waits its turn
+	if(uart_reserve(&UartBuffRobot, 4, UART_PRIORITY_CRITICAL) != -1) uart_write(&UartBuffRobot, data, 4);
+}
+
+int mpCommandLength(char cmd) {
+	// Command byte plus data
+	switch(cmd) {
+		case PLATFORM_CMD_SET_DEBUG:
+		case PLATFORM_CMD_SET_MODE:
+			return 2;
+		case PLATFORM_CMD_SET_MOTOR_SPD:
+			return 4;
+		case PLATFORM_CMD_SET_POS:
+			return 7;
+		case PLATFORM_CMD_GET_POS:
+		case PLATFORM_CMD_BEEP:
+			return 1;
+		default:
+			// Passed through from host, could carry any number of argument bytes
+			return -1;
+	}
+}
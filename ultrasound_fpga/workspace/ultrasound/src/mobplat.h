@@ -2,6 +2,7 @@
 #define MOBPLAT_H_
 
 #include "uart.h"
+#include "mempool.h"
 
 // Mobile platform commands
 enum PLATFORM_CMD {
@@ -22,6 +23,8 @@ enum PLATFORM_DIR {
 	PLATFORM_DIR_REVERSE = 0x03 // Both wheels reverse
 };
 
+#define MP_ESTOP_TRIES 100 // Attempts to put emergency stop in front of queued commands before waiting for room behind command being sent
+
 extern uart_buff UartBuffRobot; // UART connection between FPGA and 3PI
 
 // Helpers to issue commands to mobile platform
@@ -31,5 +34,8 @@ void mpSetMotorSpeed(unsigned char dirMaxSpeed, unsigned char left, unsigned cha
 void mpSetPos(short X, short Y, short Theta);
 void mpGetPos();
 void mpBeep();
+void mpEmergencyStop(); // Stop motors ahead of anything already queued, queued commands are dropped
+
+int mpCommandLength(char cmd); // Bytes in command (-1 if unknown), used to find command boundaries in UART buffer
 
 #endif /* MOBPLAT_H_ */
@@ -0,0 +1,75 @@
+#include "telemetry.h"
+
+#include <string.h>
+
+static uart_buff *telemUart = NULL;
+static telem_channel telemChannels[TELEM_CHANNEL_MAX];
+
+// Frame being built and its encoded form, only ever used from main loop
+static u8 telemFrame[TELEM_HEADER_LEN + TELEM_PAYLOAD_MAX + 2];
+static u8 telemEncoded[TELEM_FRAME_MAX];
+
+int init_telemetry(uart_buff *uart_buf) {
+	int i;
+
+	// No rate limits until asked
+	for(i = 0; i < TELEM_CHANNEL_MAX; i++) {
+		telemChannels[i].interval = 0;
+		telemChannels[i].nextTime = 0;
+		telemChannels[i].sequence = 0;
+	}
+
+	telemUart = uart_buf;
+
+	// Yey!
+	return XST_SUCCESS;
+}
+
+void telem_set_interval(u8 channel, u16 interval) {
+	if(channel >= TELEM_CHANNEL_MAX) return;
+
+	telemChannels[channel].interval = interval;
+}
+
+u8 telem_ready(u8 channel, u32 now) {
+	if(channel >= TELEM_CHANNEL_MAX) return 0;
+
+	// Signed difference copes with tick counter wrapping
+	return (s32) (now - telemChannels[channel].nextTime) >= 0;
+}
+
+int telem_send(u8 channel, const u8 *data, int length, int priority, u32 now) {
+	telem_channel *ch = &telemChannels[channel];
+	u16 crc;
+
+	if(telemUart == NULL || length > TELEM_PAYLOAD_MAX || !telem_ready(channel, now)) return -1;
+
+	// Header, payload then CRC over both
+	telemFrame[0] = channel;
+	telemFrame[1] = ch->sequence;
+	telemFrame[2] = now & 0xFF;
+	telemFrame[3] = (now >> 8) & 0xFF;
+	telemFrame[4] = (now >> 16) & 0xFF;
+	telemFrame[5] = (now >> 24) & 0xFF;
+	memcpy(&telemFrame[TELEM_HEADER_LEN], data, length);
+	length += TELEM_HEADER_LEN;
+	crc = frame_crc16(telemFrame, length, FRAME_CRC_INIT);
+	telemFrame[length++] = crc & 0xFF;
+	telemFrame[length++] = crc >> 8;
+
+	// Delimit both ends so host can find start of frame after noise or a dropped byte
+	length = frame_cobs_encode(telemFrame, length, &telemEncoded[1]);
+	telemEncoded[0] = FRAME_DELIMITER;
+	telemEncoded[length + 1] = FRAME_DELIMITER;
+	length += 2;
+
+	// Whole frame or nothing, sequence number only moves on frames actually sent
+	if(uart_reserve(telemUart, length, priority) == -1) return -1;
+	uart_write(telemUart, (char*) telemEncoded, length);
+
+	ch->sequence++;
+	ch->nextTime = now + ch->interval;
+
+	// Yey!
+	return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "xil_types.h"
+#include "uart.h"
+#include "frame.h"
+
+// Outbound data multiplexed onto one UART as COBS frames, each one whole and checked so nothing else can be mistaken for it
+// Frame - channel, channel sequence number, timestamp (ms, u32), payload, CRC16 - all little endian
+
+#define TELEM_CHANNEL_MAX 8 // Channels 0 to TELEM_CHANNEL_MAX - 1
+#define TELEM_HEADER_LEN 6 // bytes - channel, sequence number, timestamp
+#define TELEM_PAYLOAD_MAX 160 // bytes - largest payload in a single frame
+#define TELEM_FRAME_MAX (FRAME_ENCODED_MAX(TELEM_HEADER_LEN + TELEM_PAYLOAD_MAX + 2) + 2) // bytes - largest frame on the wire, including delimiters
+
+// Per channel state
+typedef struct telem_channel {
+	u16 interval; // Shortest time between frames (ms), 0 for no limit
+	u32 nextTime; // Earliest time next frame may go (ms)
+	u8 sequence; // Sequence number of next frame, lets host spot dropped frames
+} telem_channel;
+
+int init_telemetry(uart_buff *uart_buf); // UART all channels share
+
+void telem_set_interval(u8 channel, u16 interval); // Rate limit channel (ms between frames)
+u8 telem_ready(u8 channel, u32 now); // Channel's rate limit allows another frame, lets callers skip building one
+
+int telem_send(u8 channel, const u8 *data, int length, int priority, u32 now); // Send frame whole or not at all, -1 if rate limited or dropped
+
+#endif /* TELEMETRY_H_ */
@@ -1,20 +1,33 @@
 #include "uart.h"
 
-#include <stdlib.h>
+#include <string.h>
+
+#include "mempool.h"
+
+int init_uart_buffers(int deviceID, uart_buff *uart_buf, int sizeTX, int sizeRX) {
+	// Masking only works for powers of 2
+	if(sizeTX <= 0 || (sizeTX & (sizeTX - 1)) != 0) return XST_FAILURE;
+	if(sizeRX <= 0 || (sizeRX & (sizeRX - 1)) != 0) return XST_FAILURE;
 
-int init_uart_buffers(int deviceID, uart_buff *uart_buf) {
 	// Init UART
 	if(XUartLite_Initialize((XUartLite*) &(uart_buf->uart), deviceID) != XST_SUCCESS) return XST_FAILURE;
 
 	// Setup UART buffers
-	uart_buf->bufferRX = malloc(BUFFER_SIZE_RX);
+	uart_buf->bufferRX = mempool_alloc(sizeRX);
 	if(uart_buf->bufferRX == NULL) return XST_FAILURE;
-	uart_buf->sizeRX = BUFFER_SIZE_RX;
-	uart_buf->countRX = 0;
-	uart_buf->bufferTX = malloc(BUFFER_SIZE_TX);
+	uart_buf->sizeRX = sizeRX;
+	uart_buf->headRX = 0;
+	uart_buf->tailRX = 0;
+	uart_buf->overflowRX = 0;
+	uart_buf->bufferTX = mempool_alloc(sizeTX);
 	if(uart_buf->bufferTX == NULL) return XST_FAILURE;
-	uart_buf->sizeTX = BUFFER_SIZE_TX;
-	uart_buf->countTX = 0;
+	uart_buf->sizeTX = sizeTX;
+	uart_buf->headTX = 0;
+	uart_buf->tailTX = 0;
+	uart_buf->overflowTX = 0;
+	uart_buf->frameLengthTX = NULL;
+	uart_buf->frameRemainTX = 0;
+	uart_buf->droppedTX = 0;
 
 	// Enable UART interrupts
 	XUartLite_EnableInterrupt((XUartLite*) &(uart_buf->uart));
@@ -23,60 +36,88 @@ int init_uart_buffers(int deviceID, uart_buff *uart_buf) {
 	return XST_SUCCESS;
 }
 
+static void uart_send(uart_buff *buf) {
+	// Snapshot head once, anything main loop adds meanwhile is picked up next time
+	unsigned int head = buf->headTX;
+	unsigned int tail = buf->tailTX;
+	unsigned int mask = buf->sizeTX - 1;
+	UART_BARRIER();
+
+	// Send while TX buffer has data and TX FIFO not full
+	while(tail != head && !(XUartLite_GetStatusReg(buf->uart.RegBaseAddress) & XUL_SR_TX_FIFO_FULL)) {
+		// Keep track of frame boundaries so urgent data can be put in front without splitting a frame
+		if(buf->frameLengthTX != NULL) {
+			if(buf->frameRemainTX == 0) buf->frameRemainTX = buf->frameLengthTX(buf->bufferTX[tail & mask]);
+			if(buf->frameRemainTX > 0) buf->frameRemainTX--;
+		}
+
+		XUartLite_WriteReg(buf->uart.RegBaseAddress, XUL_TX_FIFO_OFFSET, buf->bufferTX[tail & mask]);
+		tail++;
+	}
+
+	// Frame of unknown length was queued whole, so it has certainly ended once buffer is empty
+	if(buf->frameRemainTX < 0 && tail == head) buf->frameRemainTX = 0;
+
+	// Free space only once bytes are out of buffer
+	UART_BARRIER();
+	buf->tailTX = tail;
+}
+
+static void uart_kick(uart_buff *buf) {
+	// TX FIFO empty interrupt only fires as FIFO drains, so an idle UART has to be started by hand
+	if(XUartLite_GetStatusReg(buf->uart.RegBaseAddress) & XUL_SR_TX_FIFO_EMPTY) {
+		// Interrupt handler is the only consumer, keep it out while standing in for it
+		XUartLite_DisableInterrupt((XUartLite*) &(buf->uart));
+		uart_send(buf);
+		XUartLite_EnableInterrupt((XUartLite*) &(buf->uart));
+	}
+}
+
 void InterruptHandler_UART(void *CallbackRef) {
 	// Grab UART buffer
 	uart_buff *buf = (uart_buff*) CallbackRef;
+	unsigned int head = buf->headRX;
+	unsigned int mask = buf->sizeRX - 1;
 
 	// Read UART status
 	int IsrStatus = XUartLite_GetStatusReg(buf->uart.RegBaseAddress);
 
 	// RX FIFO not empty?
 	while(IsrStatus & XUL_SR_RX_FIFO_VALID_DATA) {
-		// Check RX buffer has space
-		if(buf->countRX < buf->sizeRX) {
-			// Read byte
-			char c = XUartLite_RecvByte(buf->uart.RegBaseAddress);
-
-			// Add to buffer, advance pointer and increment count
-			buf->bufferRX[buf->indexRXWrite] = c;
-			buf->indexRXWrite++;
-			if(buf->indexRXWrite == buf->sizeRX) buf->indexRXWrite = 0;
-			buf->countRX++;
+		// Read byte
+		char c = XUartLite_RecvByte(buf->uart.RegBaseAddress);
+
+		// Add to buffer if it has space, otherwise drop byte rather than leave it blocking the FIFO
+		if(head - buf->tailRX < (unsigned int) buf->sizeRX) {
+			buf->bufferRX[head & mask] = c;
+			head++;
 		} else {
-			// Set overflow flag if RX FIFO full
-			if(IsrStatus & XUL_SR_RX_FIFO_FULL) buf->overflowRX = 1;
+			buf->overflowRX = 1;
 		}
 
 		// Update status register
 		IsrStatus = XUartLite_GetStatusReg(buf->uart.RegBaseAddress);
 	}
 
+	// Publish bytes only once they are in buffer
+	UART_BARRIER();
+	buf->headRX = head;
+
 	// TX FIFO empty?
-	if(IsrStatus & XUL_SR_TX_FIFO_EMPTY) {
-		// Send while TX buffer has data and TX FIFO not full
-		while((!(IsrStatus & XUL_SR_TX_FIFO_FULL)) && (buf->countTX > 0)) {
-			// Send byte, advance pointer and decrement count
-			XUartLite_WriteReg(buf->uart.RegBaseAddress, XUL_TX_FIFO_OFFSET, buf->bufferTX[buf->indexTXRead]);
-			buf->indexTXRead++;
-			if(buf->indexTXRead == buf->sizeTX) buf->indexTXRead = 0;
-			buf->countTX--;
-
-			// Update status register
-			IsrStatus = XUartLite_GetStatusReg(buf->uart.RegBaseAddress);
-		}
-	}
+	if(IsrStatus & XUL_SR_TX_FIFO_EMPTY) uart_send(buf);
 }
 
 int uart_getchar(uart_buff *buf) {
 	unsigned char c;
+	unsigned int tail = buf->tailRX;
 
 	// Check count
-	if(buf->countRX > 0) {
-		// Retrieve character, advance pointer and decrement count
-		c = buf->bufferRX[buf->indexRXRead];
-		buf->indexRXRead++;
-		if(buf->indexRXRead == buf->sizeRX) buf->indexRXRead = 0;
-		buf->countRX--;
+	if(buf->headRX != tail) {
+		// Retrieve character then free its space
+		UART_BARRIER();
+		c = buf->bufferRX[tail & (buf->sizeRX - 1)];
+		UART_BARRIER();
+		buf->tailRX = tail + 1;
 	} else {
 		// Oh noes
 		return -1;
@@ -87,12 +128,14 @@ int uart_getchar(uart_buff *buf) {
 }
 
 int uart_putchar(uart_buff *buf, char c) {
+	unsigned int head = buf->headTX;
+
 	// Check count
-	if(buf->countTX < buf->sizeTX) {
-		buf->bufferTX[buf->indexTXWrite] = c;
-		buf->indexTXWrite++;
-		if(buf->indexTXWrite == buf->sizeTX) buf->indexTXWrite = 0;
-		buf->countTX++;
+	if(head - buf->tailTX < (unsigned int) buf->sizeTX) {
+		// Store character then publish it
+		buf->bufferTX[head & (buf->sizeTX - 1)] = c;
+		UART_BARRIER();
+		buf->headTX = head + 1;
 	} else {
 		// Set overflow flag
 		buf->overflowTX = 1;
@@ -102,9 +145,134 @@ int uart_putchar(uart_buff *buf, char c) {
 	}
 
 	// Send first byte if TX FIFO empty - interrupt handler will do the rest :-)
-	if(XUartLite_GetStatusReg(buf->uart.RegBaseAddress) & XUL_SR_TX_FIFO_EMPTY) {
-		// Bit naughty, call interrupt handler to send first byte
-		InterruptHandler_UART((void*) buf);
+	uart_kick(buf);
+
+	// Yey!
+	return 1;
+}
+
+int uart_write(uart_buff *buf, const char *data, int count) {
+	unsigned int head = buf->headTX;
+	unsigned int index = head & (buf->sizeTX - 1);
+	int space = buf->sizeTX - (head - buf->tailTX);
+	int span;
+
+	// Write as much as fits, in at most two copies either side of wrap
+	if(count > space) count = space;
+	if(count <= 0) return 0;
+	span = buf->sizeTX - index;
+	if(span > count) span = count;
+	memcpy(&buf->bufferTX[index], data, span);
+	memcpy(buf->bufferTX, data + span, count - span);
+
+	// Publish once copied
+	UART_BARRIER();
+	buf->headTX = head + count;
+
+	uart_kick(buf);
+
+	return count;
+}
+
+int uart_read(uart_buff *buf, char *data, int count) {
+	unsigned int tail = buf->tailRX;
+	unsigned int index = tail & (buf->sizeRX - 1);
+	int available = buf->headRX - tail;
+	int span;
+
+	// Read as much as is waiting, in at most two copies either side of wrap
+	if(count > available) count = available;
+	if(count <= 0) return 0;
+	UART_BARRIER();
+	span = buf->sizeRX - index;
+	if(span > count) span = count;
+	memcpy(data, &buf->bufferRX[index], span);
+	memcpy(data + span, buf->bufferRX, count - span);
+
+	// Free space once copied
+	UART_BARRIER();
+	buf->tailRX = tail + count;
+
+	return count;
+}
+
+int uart_putfront(uart_buff *buf, const char *data, int count, char discard) {
+	int i;
+	int keep;
+	unsigned int mask = buf->sizeTX - 1;
+	unsigned int tail;
+
+	// Moving tail makes main loop a second consumer, keep interrupt handler away while buffer is rearranged
+	XUartLite_DisableInterrupt((XUartLite*) &(buf->uart));
+
+	// End of a frame of unknown length can't be found, so nothing can go in until it has all gone
+	if(buf->frameRemainTX < 0) {
+		XUartLite_EnableInterrupt((XUartLite*) &(buf->uart));
+
+		// Oh noes
+		return -1;
+	}
+
+	// Rest of frame already being sent must go first or receiver would see it garbled
+	keep = buf->headTX - buf->tailTX;
+	if(buf->frameRemainTX < keep) keep = buf->frameRemainTX;
+	if(buf->frameLengthTX == NULL) keep = 0;
+
+	// Drop everything queued behind that frame if asked
+	if(discard) buf->headTX = buf->tailTX + keep;
+
+	// Check space
+	if((buf->headTX - buf->tailTX) + count > (unsigned int) buf->sizeTX) {
+		buf->overflowTX = 1;
+		XUartLite_EnableInterrupt((XUartLite*) &(buf->uart));
+
+		// Oh noes
+		return -1;
+	}
+
+	// Move tail back, shuffle rest of current frame down to it then slot data in behind
+	tail = buf->tailTX - count;
+	for(i = 0; i < keep; i++) buf->bufferTX[(tail + i) & mask] = buf->bufferTX[(tail + count + i) & mask];
+	for(i = 0; i < count; i++) buf->bufferTX[(tail + keep + i) & mask] = data[i];
+	buf->tailTX = tail;
+
+	XUartLite_EnableInterrupt((XUartLite*) &(buf->uart));
+
+	// Send first byte if TX FIFO empty
+	uart_kick(buf);
+
+	// Yey!
+	return 1;
+}
+
+int uart_reserve(uart_buff *buf, int count, int priority) {
+	int needed = count;
+
+	// Low priority messages leave room for more important ones
+	if(priority == UART_PRIORITY_LOW) needed += buf->sizeTX >> UART_RESERVE_SHIFT;
+
+	// Message could never fit
+	if(count > buf->sizeTX) {
+		buf->droppedTX++;
+
+		// Oh noes
+		return -1;
+	}
+
+	// Only critical data is worth waiting for, interrupt handler frees space meanwhile
+	if(priority == UART_PRIORITY_CRITICAL) {
+		while(get_tx_space(buf) < count);
+
+		// Yey!
+		return 1;
+	}
+
+	// Main loop is the only producer so space found now is still there when message is written
+	if(get_tx_space(buf) < needed) {
+		buf->droppedTX++;
+
+		// Oh noes
+		return -1;
 	}
 
 	// Yey!
@@ -113,22 +281,28 @@ int uart_putchar(uart_buff *buf, char c) {
 
 int get_tx_count(uart_buff *buf) {
 	// Return TX buffer byte count
-	return buf->countTX;
+	return buf->headTX - buf->tailTX;
+}
+
+int get_tx_space(uart_buff *buf) {
+	// Return TX buffer free space
+	return buf->sizeTX - (buf->headTX - buf->tailTX);
 }
 
 int get_rx_count(uart_buff *buf) {
 	// Return RX buffer byte count
-	return buf->countRX;
+	return buf->headRX - buf->tailRX;
 }
 
 int uart_print(uart_buff *buf, char* str) {
-	// Send characters until null terminator reached
-	while (*str != '\0') {
-		// Print character, retying on buffer full
-		while(uart_putchar(buf, *str) == -1);
-
-		// Increment pointer
-		str++;
+	int length = strlen(str);
+	int written;
+
+	// Send characters in bulk until all gone, retrying on buffer full
+	while(length > 0) {
+		written = uart_write(buf, str, length);
+		str += written;
+		length -= written;
 	}
 
 	// Yey!
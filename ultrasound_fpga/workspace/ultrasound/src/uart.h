@@ -4,35 +4,59 @@
 #include "xuartlite.h"
 #include "xuartlite_l.h"
 
-#define BUFFER_SIZE_TX 128
+#define BUFFER_SIZE_TX 128 // Default buffer sizes, any size must be a power of 2
 #define BUFFER_SIZE_RX 128
 
+// Stop compiler moving memory accesses across this point - MicroBlaze itself doesn't reorder
+#define UART_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// Message priorities - what happens to a message when TX buffer is too full to take it whole
+enum UART_PRIORITY {
+	UART_PRIORITY_LOW, // Dropped, and must leave some of buffer free for normal messages
+	UART_PRIORITY_NORMAL, // Dropped
+	UART_PRIORITY_CRITICAL // Waits for space - only for data that must arrive, such as robot commands
+};
+
+#define UART_RESERVE_SHIFT 2 // Low priority messages leave 1/4 of TX buffer free
+
+// Buffers are single producer single consumer rings, each index only ever written by one side so no locking is needed
+// TX - main loop writes headTX, interrupt handler writes tailTX
+// RX - interrupt handler writes headRX, main loop writes tailRX
+// Indexes run freely and are masked on use, head - tail is number of bytes held
 typedef struct uart_buff {
 	XUartLite uart;
 
 	char *bufferTX;
 	int sizeTX;
-	int indexTXRead;
-	int indexTXWrite;
-	int countTX;
+	volatile unsigned int headTX;
+	volatile unsigned int tailTX;
 	char overflowTX;
+	int (*frameLengthTX)(char c); // Length of frame starting with byte (negative if unknown), NULL when data isn't framed
+	int frameRemainTX; // Bytes of frame being sent still in buffer, negative while sending a frame of unknown length
+	unsigned int droppedTX; // Messages dropped because TX buffer was full
 
 	char *bufferRX;
 	int sizeRX;
-	int indexRXRead;
-	int indexRXWrite;
-	int countRX;
+	volatile unsigned int headRX;
+	volatile unsigned int tailRX;
 	char overflowRX;
 } uart_buff;
 
-int init_uart_buffers(int deviceID, uart_buff *uart_buf);
+int init_uart_buffers(int deviceID, uart_buff *uart_buf, int sizeTX, int sizeRX);
 
 void InterruptHandler_UART(void *CallbackRef);
 
 int uart_getchar(uart_buff *buf);
 int uart_putchar(uart_buff *buf, char c);
+int uart_putfront(uart_buff *buf, const char *data, int count, char discard);
+
+int uart_write(uart_buff *buf, const char *data, int count); // Returns bytes actually written
+int uart_read(uart_buff *buf, char *data, int count); // Returns bytes actually read
+
+int uart_reserve(uart_buff *buf, int count, int priority); // Check message of count bytes can be written without waiting, -1 if it must be dropped
 
 int get_tx_count(uart_buff *buf);
+int get_tx_space(uart_buff *buf);
 int get_rx_count(uart_buff *buf);
 
 int uart_print(uart_buff *buf, char* str);
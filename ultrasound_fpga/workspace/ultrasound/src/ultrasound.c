@@ -4,19 +4,32 @@
 
 // Variables - devices
 XIntc InterruptController; // Interrupt controller shared between all devices
-uart_buff UartBuffDebug; // UART connection between PC and FPGA
-uart_buff UartBuffBT; // UART connection over Bluetooth
+uart_buff UartBuffDebug LMB_BSS; // UART connection between PC and FPGA
+uart_buff UartBuffBT LMB_BSS; // UART connection over Bluetooth
 gpio_state gpioLEDS; // GPIO for 4 on-board LEDS
 gpio_state gpioUSDebug; // GPIO for ultrasound ADC end of conversion interrupt & debug IO
 XTmrCtr TimerSys; // Timer for delays
 
 // Variables - general
-volatile u32 sysTickCounter = 0;
+volatile u32 sysTickCounter LMB_BSS;
 
 // Variables - debug
 enum DEBUG_CMD debugCommand = DEBUG_CMD_NONE; // Pending debug command
 char debugEnabled = 0x00; // Debug mode status
-char debugRobotCmdSizeReceived = 0; // Debug mode, robot command length received
+int debugCmdLength = -1; // Argument bytes of bare variable length command, -1 until received
+int debugCmdDiscard = 0; // Argument bytes of rejected command still to be dropped
+char debugPassthrough = 0x00; // Robot passthrough requested, entered once current command is finished
+u8 debugFrame[DEBUG_FRAME_MAX]; // Framed packet of commands being received, decoded in place
+int debugFrameLength = 0; // Encoded bytes received so far
+char debugFrameOverflow = 0x00; // Frame too long for buffer, rest of it is discarded
+char debugFrameComplete = 0x00; // Closing delimiter received, waiting to be run
+u8 debugLastSeq; // Sequence number of last frame run
+char debugSeqValid = 0x00; // A frame has been run since startup
+enum DEBUG_ACK debugLastStatus; // Acknowledgement for last frame run, repeated if it arrives again
+u8 debugLastDone;
+char debugLine[DEBUG_MSG_MAX]; // Debug message being built, sent as a log frame once its line ends
+int debugLineLength = 0;
+int debugLinePriority = UART_PRIORITY_NORMAL;
 
 // Variables - mobile platform
 enum PLATFORM_RESP mpResponse = PLATFORM_RESP_NONE;
@@ -26,16 +39,69 @@ unsigned char mpDebugIndex = 0; // Platform debug mess buffer pointer
 struct POSITION mpCurrentPos; // Current platform position
 enum DRIVE_STATE drivingState = DRIVE_STOP;
 enum DRIVE_STATE nextDrivingState;
+char estopPending = 0x00; // Emergency stop sent, driving command must be reissued
+struct LATENCY estopLatency; // Echo to emergency stop
+struct LATENCY driveLatency; // Echo to normal driving path turning away from front obstacle
+struct LATENCY scanCycles; // CPU cycles spent acquiring each scan
+struct LATENCY uartCycles; // CPU cycles spent in each UART interrupt
+u32 usCaptureTime[US_SENSOR_COUNT]; // Time each sensor's latest capture finished (uS)
 
 // Variables - ultrasound array
 char usarrayEnabled = 0x01; // Ultrasound array scanning status
 enum US_OUTPUT usarrayOutputMode = US_OUTPUT_NONE; // Ultrasound array output to debug UART mode
+u8 usarrayWaveformShift = 0; // Bits dropped from output waveform samples away from echo, 0 for lossless
 u8 sensors[10]; // Array of sensors to sample
 u8 numSensors = 0; // Number of sensors to sample (size of sensor array)
+char usarrayScheduled = 0x01; // Sensors picked by scheduler each scan rather than from fixed list
+
+// Ultrasound array scan rate multipliers for each driving state, indexed by sensor position
+const u8 usarrayWeights[DRIVE_STATE_COUNT][US_SENSOR_COUNT] = {
+//	 RM RR ReR ReL LR LM LF FL FR RF
+	{1, 1, 1,  1,  1, 1, 1, 1, 1, 1}, // DRIVE_STOP
+	{1, 0, 0,  0,  0, 1, 2, 3, 3, 2}, // DRIVE_FORWARD
+	{2, 0, 0,  0,  0, 1, 2, 3, 3, 2}, // DRIVE_LEFT - right side decides when turn is over
+	{1, 0, 0,  0,  0, 2, 2, 3, 3, 2}, // DRIVE_RIGHT - left side decides when turn is over
+	{1, 0, 0,  0,  1, 2, 3, 3, 2, 2}, // DRIVE_SPIN_LEFT - left side sweeps into obstacles first
+	{2, 1, 0,  0,  0, 1, 2, 2, 3, 3}, // DRIVE_SPIN_RIGHT - right side sweeps into obstacles first
+	{0, 1, 3,  3,  2, 0, 1, 2, 2, 1}, // DRIVE_REVERSE_LEFT
+	{0, 2, 3,  3,  1, 0, 1, 2, 2, 1} // DRIVE_REVERSE_RIGHT
+};
+
+// Debug command argument lengths and handlers, indexed by command
+const struct DEBUG_CMD_ENTRY debugCommands[DEBUG_CMD_COUNT] = {
+	[DEBUG_CMD_SET_DEBUG] = {1, debugCmdSetDebug},
+	[DEBUG_CMD_SET_US_MODE] = {1, debugCmdSetUSMode},
+	[DEBUG_CMD_SET_US_SENSOR] = {1, debugCmdSetUSSensor},
+	[DEBUG_CMD_SET_US_TRIGGERS] = {10, debugCmdSetUSTriggers},
+	[DEBUG_CMD_SET_US_OUTPUT] = {1, debugCmdSetUSOutput},
+	[DEBUG_CMD_ROBOT_COMMAND] = {DEBUG_CMD_VARIABLE, debugCmdRobotCommand},
+	[DEBUG_CMD_PING] = {0, debugCmdPing},
+	[DEBUG_CMD_ROBOT_PASSTHROUGH] = {0, debugCmdRobotPassthrough},
+	[DEBUG_CMD_SET_US_RANGING] = {1, debugCmdSetUSRanging},
+	[DEBUG_CMD_SET_US_OFFSET] = {3, debugCmdSetUSOffset},
+	[DEBUG_CMD_SET_US_STREAM] = {2, debugCmdSetUSStream},
+	[DEBUG_CMD_SET_US_PROFILE] = {7, debugCmdSetUSProfile},
+	[DEBUG_CMD_SET_US_CROSSTALK] = {4, debugCmdSetUSCrosstalk},
+	[DEBUG_CMD_SET_US_PAIR] = {2, debugCmdSetUSPair},
+	[DEBUG_CMD_SET_US_STACK] = {1, debugCmdSetUSStack},
+	[DEBUG_CMD_SET_US_STACK_LIMITS] = {2, debugCmdSetUSStackLimits},
+	[DEBUG_CMD_SET_US_BASELINE] = {1, debugCmdSetUSBaseline},
+	[DEBUG_CMD_SET_US_CURVE] = {1, debugCmdSetUSCurve},
+	[DEBUG_CMD_UPLOAD_US_CURVE] = {3 + TRIGGER_CURVE_CHUNK, debugCmdUploadUSCurve},
+	[DEBUG_CMD_GET_US_HEALTH] = {1, debugCmdGetUSHealth},
+	[DEBUG_CMD_GET_LATENCY] = {1, debugCmdGetLatency},
+	[DEBUG_CMD_GET_PROFILE] = {1, debugCmdGetProfile},
+	[DEBUG_CMD_GET_DROPPED] = {1, debugCmdGetDropped},
+	[DEBUG_CMD_SET_TELEM_RATE] = {3, debugCmdSetTelemRate},
+	[DEBUG_CMD_SET_US_WAVEFORM_ROI] = {1, debugCmdSetUSWaveformROI}
+};
 
 // --------------------------------------------------------------------------------
 
 int main() {
+	// Clear local memory before anything uses it
+	mempool_init();
+
 	// Get ready to rumble
 	init_platform();
 
@@ -43,9 +109,15 @@ int main() {
 	print("#Ultrasound...");
 
 	// Init UARTS
-	if(init_uart_buffers(XPAR_USB_UART_DEVICE_ID, &UartBuffDebug) != XST_SUCCESS) return XST_FAILURE;
-	if(init_uart_buffers(XPAR_AXI_UARTLITE_BLUETOOTH_DEVICE_ID, &UartBuffBT) != XST_SUCCESS) return XST_FAILURE;
-	if(init_uart_buffers(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, &UartBuffRobot) != XST_SUCCESS) return XST_FAILURE;
+	if(init_uart_buffers(XPAR_USB_UART_DEVICE_ID, &UartBuffDebug, UART_DEBUG_TX_SIZE, UART_DEBUG_RX_SIZE) != XST_SUCCESS) return XST_FAILURE;
+	if(init_uart_buffers(XPAR_AXI_UARTLITE_BLUETOOTH_DEVICE_ID, &UartBuffBT, UART_BT_TX_SIZE, UART_BT_RX_SIZE) != XST_SUCCESS) return XST_FAILURE;
+	if(init_uart_buffers(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, &UartBuffRobot, UART_3PI_TX_SIZE, UART_3PI_RX_SIZE) != XST_SUCCESS) return XST_FAILURE;
+	UartBuffRobot.frameLengthTX = mpCommandLength;
+
+	// Init telemetry, everything sent to PC goes out as frames on debug UART
+	if(init_telemetry(&UartBuffDebug) != XST_SUCCESS) return XST_FAILURE;
+	telem_set_interval(TELEM_CH_RANGE, TELEM_RANGE_INTERVAL);
+	telem_set_interval(TELEM_CH_POSE, TELEM_POSE_INTERVAL);
 
 	// Init GPIO
 	if(init_gpio(XPAR_LEDS_4BITS_DEVICE_ID, 0x00, 0x00, &gpioLEDS) != XST_SUCCESS) return XST_FAILURE;
@@ -59,23 +131,17 @@ int main() {
 	// Init ultrasound array
 	if(init_usarray() != XST_SUCCESS) return XST_FAILURE;
 
+	// Check front sensors for imminent collisions as soon as their captures arrive
+	usarray_set_capture_handler(CheckCollision);
+
 	// Init interrupt controller
 	if(init_interrupt_ctrl(&InterruptController) != XST_SUCCESS) return XST_SUCCESS;
 
 	// Setup interrupts for UARTS and system timer
 	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_AXI_TIMER_0_INTERRUPT_INTR, XTmrCtr_InterruptHandler, (void *) &TimerSys) != XST_SUCCESS) return XST_SUCCESS;
-	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_USB_UART_INTERRUPT_INTR, InterruptHandler_UART, (void *) &UartBuffDebug) != XST_SUCCESS) return XST_SUCCESS;
-	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_3PI_INTERRUPT_INTR, InterruptHandler_UART, (void *) &UartBuffRobot) != XST_SUCCESS) return XST_SUCCESS;
-	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_BLUETOOTH_INTERRUPT_INTR, InterruptHandler_UART, (void *) &UartBuffBT) != XST_SUCCESS) return XST_SUCCESS;
-
-	// Set active ultrasound sensors
-	numSensors = 6;
-	sensors[0] = SENSOR_FRONT_RIGHT;
-	sensors[1] = SENSOR_LEFT_MID;
-	sensors[2] = SENSOR_RIGHT_FRONT;
-	sensors[3] = SENSOR_LEFT_FRONT;
-	sensors[4] = SENSOR_RIGHT_MID;
-	sensors[5] = SENSOR_FRONT_LEFT;
+	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_USB_UART_INTERRUPT_INTR, UART_ISR, (void *) &UartBuffDebug) != XST_SUCCESS) return XST_SUCCESS;
+	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_3PI_INTERRUPT_INTR, UART_ISR, (void *) &UartBuffRobot) != XST_SUCCESS) return XST_SUCCESS;
+	if(interrupt_ctrl_setup(&InterruptController, XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_BLUETOOTH_INTERRUPT_INTR, UART_ISR, (void *) &UartBuffBT) != XST_SUCCESS) return XST_SUCCESS;
 
 	// Test us_receiver FSL bus
 	//TestFSL();
@@ -83,9 +149,6 @@ int main() {
 	// Initialise 3PI robot
 	Init3PI();
 
-	// Get temperature from ADC
-	usarray_measure_temp();
-
 	// Send test message over Bluetooth UART
 	uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
 	uart_print(&UartBuffBT, "Hello, Bluetooth!\n\n");
@@ -114,257 +177,717 @@ int main() {
 // --------------------------------------------------------------------------------
 
 void ProcessSerialDebug() {
+	// Drop arguments of rejected command as they arrive so none are taken for commands
+	while(debugCmdDiscard > 0 && uart_getchar(&UartBuffDebug) != -1) debugCmdDiscard--;
+	if(debugCmdDiscard > 0) return;
+
 	// Attempt to read byte from debug UART if there is no command pending
 	if(debugCommand == DEBUG_CMD_NONE) debugCommand = uart_getchar(&UartBuffDebug);
 
-	// Attempt to process command
-	switch(debugCommand) {
-		case DEBUG_CMD_NONE: {
-			// Do nothing
-			return;
-		}
-		case DEBUG_CMD_SET_DEBUG: {
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < 1) return;
+	// Nothing to do
+	if(debugCommand == DEBUG_CMD_NONE) return;
 
-			// Read byte
-			char data = uart_getchar(&UartBuffDebug);
+	// Framed packet of commands, or single bare command
+	if(debugCommand == DEBUG_CMD_FRAME) {
+		ProcessDebugFrame();
+	} else if(debugCommand >= DEBUG_CMD_COUNT || debugCommands[debugCommand].handler == NULL) {
+		// Output debug info
+		debugPrint("ERROR CMD NOT RECOGNISED!", 1);
 
-			// Check whether debug mode is being enabled or disabled
-			if(data) {
-				// Set debug
-				debugEnabled = 0x01;
+		// Reset command
+		debugCommand = DEBUG_CMD_NONE;
+	} else {
+		const struct DEBUG_CMD_ENTRY *entry = &debugCommands[debugCommand];
 
+		// Variable length commands send their length first
+		if(entry->length == DEBUG_CMD_VARIABLE && debugCmdLength < 0) {
+			// Wait for data length
+			if(get_rx_count(&UartBuffDebug) < 1) return;
+
+			// Read length
+			debugCmdLength = (u8) uart_getchar(&UartBuffDebug);
+
+			// Arguments that don't fit in RX buffer would never all be there to read
+			if(debugCmdLength > UART_DEBUG_RX_SIZE) {
 				// Output debug info
-				debugPrint("DEBUG ENABLED", 1);
-			} else {
-				// Output debug info
-				debugPrint("DEBUG DISABLED", 1);
+				debugPrint("ERROR CMD TOO LONG!", 1);
 
-				// Clear debug
-				debugEnabled = 0x00;
+				// Reset command, its arguments are dropped as they arrive
+				debugCmdDiscard = debugCmdLength;
+				debugCommand = DEBUG_CMD_NONE;
+				debugCmdLength = -1;
+				return;
 			}
-
-			break;
+		} else if(entry->length != DEBUG_CMD_VARIABLE) {
+			debugCmdLength = entry->length;
 		}
-		case DEBUG_CMD_SET_US_MODE: {
 
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < 1) return;
+		// Wait for data
+		if(get_rx_count(&UartBuffDebug) < debugCmdLength) return;
 
-			// Read byte
-			char data = uart_getchar(&UartBuffDebug);
+		// Read arguments and execute command
+		u8 data[DEBUG_CMD_ARGS_MAX];
+		uart_read(&UartBuffDebug, (char*) data, debugCmdLength);
+		entry->handler(data, debugCmdLength);
 
-			// Set ultrasound array mode
-			switch(data) {
-				case 0x00: {
-					// Disable array
-					usarrayEnabled = 0x00;
+		// Reset command
+		debugCommand = DEBUG_CMD_NONE;
+		debugCmdLength = -1;
+	}
 
-					// Output debug info
-					debugPrint("US MODE - DISABLED", 1);
+	// No going back once we've done this, only entered once command has been acknowledged
+	if(debugPassthrough) Passthrough3PI();
+}
 
-					break;
-				}
-				case 0x01: {
-					// Enable single sensor mode
-					numSensors = 1;
-					sensors[0] = usarray_get_sensor();
+void ProcessDebugFrame() {
+	int c;
+
+	// Collect frame up to closing delimiter, running on into next pass if it hasn't all arrived
+	while(!debugFrameComplete && (c = uart_getchar(&UartBuffDebug)) != -1) {
+		if(c == FRAME_DELIMITER) {
+			// Back to back delimiters are just padding
+			if(debugFrameLength > 0 || debugFrameOverflow) debugFrameComplete = 0x01;
+		} else if(debugFrameLength < DEBUG_FRAME_MAX) {
+			debugFrame[debugFrameLength++] = c;
+		} else {
+			// Keep reading to end of frame so next one starts in the right place
+			debugFrameOverflow = 0x01;
+		}
+	}
+
+	// Wait for rest of frame
+	if(!debugFrameComplete) return;
+
+	// Work out what to do with frame, then acknowledge it
+	if(debugFrameOverflow) {
+		debugAck(0, DEBUG_ACK_TOO_LONG, 0);
+	} else {
+		int length = frame_cobs_decode(debugFrame, debugFrameLength, debugFrame);
+
+		// Sequence number, at least one command and CRC
+		if(length < 1 + 1 + 2 || frame_crc16(debugFrame, length - 2, FRAME_CRC_INIT) != (debugFrame[length - 2] | (debugFrame[length - 1] << 8))) {
+			debugAck((length > 0) ? debugFrame[0] : 0, DEBUG_ACK_BAD_CRC, 0);
+		} else if(debugFrame[0] == debugLastSeq && debugSeqValid) {
+			// Host missed acknowledgement and sent frame again, repeat acknowledgement rather than run commands twice
+			debugAck(debugLastSeq, debugLastStatus, debugLastDone);
+		} else {
+			// Commands sit between sequence number and CRC
+			debugLastSeq = debugFrame[0];
+			debugSeqValid = 0x01;
+			debugLastDone = debugRunFrame(&debugFrame[1], length - 3, &debugLastStatus);
+			debugAck(debugLastSeq, debugLastStatus, debugLastDone);
+		}
+	}
 
-					// Enable array
-					usarrayEnabled = 0x01;
+	// Ready for next command
+	debugFrameLength = 0;
+	debugFrameOverflow = 0x00;
+	debugFrameComplete = 0x00;
+	debugCommand = DEBUG_CMD_NONE;
+}
 
-					// Output debug info
-					debugPrint("US MODE - SINGLE", 1);
+u8 debugRunFrame(const u8 *frame, int length, enum DEBUG_ACK *status) {
+	int pass;
+	int i;
+	u8 count;
+
+	// Check every command is whole before running any, a bad frame changes nothing
+	for(pass = 0; pass < 2; pass++) {
+		i = 0;
+		count = 0;
+		while(i < length) {
+			u8 cmd = frame[i++];
+			if(cmd >= DEBUG_CMD_COUNT || debugCommands[cmd].handler == NULL) {
+				*status = DEBUG_ACK_BAD_CMD;
+				return 0;
+			}
 
-					break;
-				}
-				case 0x02: {
-					// Enable complete array mode
-					numSensors = 10;
-					sensors[0] = 0;
-					sensors[1] = 1;
-					sensors[2] = 2;
-					sensors[3] = 3;
-					sensors[4] = 4;
-					sensors[5] = 5;
-					sensors[6] = 6;
-					sensors[7] = 7;
-					sensors[8] = 8;
-					sensors[9] = 9;
-
-					// Enable array
-					usarrayEnabled = 0x01;
-
-					// Output debug info
-					debugPrint("US MODE - COMPLETE", 1);
-
-					break;
-				}
-				default: {
-					// Output debug info
-					debugPrint("US MODE - NOT RECOGNISED!", 1);
+			// Variable length commands carry their length first
+			int args = debugCommands[cmd].length;
+			if(args == DEBUG_CMD_VARIABLE) {
+				if(i >= length) {
+					*status = DEBUG_ACK_BAD_CMD;
+					return 0;
 				}
+				args = frame[i++];
+			}
+			if(i + args > length) {
+				*status = DEBUG_ACK_BAD_CMD;
+				return 0;
 			}
 
-			break;
+			if(pass == 1) debugCommands[cmd].handler(&frame[i], args);
+			i += args;
+			count++;
 		}
-		case DEBUG_CMD_SET_US_SENSOR: {
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < 1) return;
+	}
 
-			// Read byte
-			char data = uart_getchar(&UartBuffDebug);
+	*status = DEBUG_ACK_OK;
+	return count;
+}
 
-			// Check data
-			if(data >= 0 && data < US_SENSOR_COUNT) {
-				// Select sensor
-				usarray_set_sensor(data);
-				if (numSensors == 1)
-					sensors[0] = data;
+void debugAck(u8 seq, enum DEBUG_ACK status, u8 count) {
+	u8 ack[3];
 
-				// Output debug info
-				if(debugEnabled) {
-					debugPrint("US SENSOR SELECT - ", 0);
-					while(uart_putchar(&UartBuffDebug, '0' + data) == -1);
-					while(uart_putchar(&UartBuffDebug, '\n') == -1);
-				}
-			} else {
-				// Output debug info
-				debugPrint("US SENSOR SELECT - NOT RECOGNISED!", 1);
-			}
+	// Sequence number, status and commands run
+	ack[0] = seq;
+	ack[1] = status;
+	ack[2] = count;
+
+	// Lost acknowledgements are recovered by host sending frame again
+	telem_send(TELEM_CH_ACK, ack, sizeof(ack), UART_PRIORITY_NORMAL, sysTickCounter);
+}
+
+// --------------------------------------------------------------------------------
+
+void debugCmdSetDebug(const u8 *data, u8 length) {
+	// Check whether debug mode is being enabled or disabled
+	if(data[0]) {
+		// Set debug
+		debugEnabled = 0x01;
+
+		// Output debug info
+		debugPrint("DEBUG ENABLED", 1);
+	} else {
+		// Output debug info
+		debugPrint("DEBUG DISABLED", 1);
+
+		// Clear debug
+		debugEnabled = 0x00;
+	}
+}
+
+void debugCmdSetUSMode(const u8 *data, u8 length) {
+	// Set ultrasound array mode
+	switch(data[0]) {
+		case 0x00: {
+			// Disable array
+			usarrayEnabled = 0x00;
+			usarrayScheduled = 0x00;
+
+			// Output debug info
+			debugPrint("US MODE - DISABLED", 1);
 
 			break;
 		}
-		case DEBUG_CMD_SET_US_TRIGGERS: {
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < 10) return;
+		case 0x01: {
+			// Enable single sensor mode
+			numSensors = 1;
+			sensors[0] = usarray_get_sensor();
 
-			// Get data, being a bit naughty
-			unsigned short data[5];
-			int i;
-			unsigned char* dataPtr = (unsigned char*) &data;
-			for(i = 0; i < 10; i++) *dataPtr++ = uart_getchar(&UartBuffDebug);
+			// Enable array
+			usarrayEnabled = 0x01;
+			usarrayScheduled = 0x00;
 
-			// Execute command
-			usarray_set_triggers(data[0], data[1], data[2], data[3], data[4]);
+			// Output debug info
+			debugPrint("US MODE - SINGLE", 1);
+
+			break;
+		}
+		case 0x02: {
+			// Enable complete array mode
+			numSensors = 10;
+			sensors[0] = 0;
+			sensors[1] = 1;
+			sensors[2] = 2;
+			sensors[3] = 3;
+			sensors[4] = 4;
+			sensors[5] = 5;
+			sensors[6] = 6;
+			sensors[7] = 7;
+			sensors[8] = 8;
+			sensors[9] = 9;
+
+			// Enable array
+			usarrayEnabled = 0x01;
+			usarrayScheduled = 0x00;
 
 			// Output debug info
-			if(debugEnabled) {
-				debugPrint("US TRIGGER SET - CHANGEOVER: ", 0);
-				uart_print_int(&UartBuffDebug, data[0], 0);
-				uart_print(&UartBuffDebug, ", NL: ");
-				uart_print_int(&UartBuffDebug, data[1], 0);
-				uart_print(&UartBuffDebug, ", NU: ");
-				uart_print_int(&UartBuffDebug, data[2], 0);
-				uart_print(&UartBuffDebug, ", FL: ");
-				uart_print_int(&UartBuffDebug, data[3], 0);
-				uart_print(&UartBuffDebug, ", FU: ");
-				uart_print_int(&UartBuffDebug, data[4], 0);
-				while(uart_putchar(&UartBuffDebug, '\n') == -1);
-			}
+			debugPrint("US MODE - COMPLETE", 1);
 
 			break;
 		}
-		case DEBUG_CMD_SET_US_OUTPUT: {
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < 1) return;
+		case 0x03: {
+			// Enable scheduled mode, sensors are picked each scan
+			numSensors = 0;
 
-			// Read byte
-			char data = uart_getchar(&UartBuffDebug);
+			// Enable array
+			usarrayEnabled = 0x01;
+			usarrayScheduled = 0x01;
+
+			// Output debug info
+			debugPrint("US MODE - SCHEDULED", 1);
+
+			break;
+		}
+		default: {
+			// Output debug info
+			debugPrint("US MODE - NOT RECOGNISED!", 1);
+		}
+	}
+}
 
-			// Set ultrasound output mode
-			switch(data) {
-				case 0x00: {
-					// Disable output
-					usarrayOutputMode = US_OUTPUT_NONE;
+void debugCmdSetUSSensor(const u8 *data, u8 length) {
+	// Check data
+	if(data[0] < US_SENSOR_COUNT) {
+		// Select sensor
+		usarray_set_sensor(data[0]);
+		if (numSensors == 1)
+			sensors[0] = data[0];
+
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US SENSOR SELECT - ", 0);
+			debugPrintChar('0' + data[0]);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US SENSOR SELECT - NOT RECOGNISED!", 1);
+	}
+}
 
-					// Output debug info
-					debugPrint("US OUTPUT - DISABLED", 1);
+void debugCmdSetUSTriggers(const u8 *data, u8 length) {
+	// Get levels, in native byte order
+	unsigned short levels[5];
+	memcpy(levels, data, sizeof(levels));
 
-					break;
-				}
-				case 0x01: {
-					// Enable waveform output
-					usarrayOutputMode = US_OUTPUT_WAVEFORM;
+	// Execute command
+	usarray_set_triggers(levels[0], levels[1], levels[2], levels[3], levels[4]);
 
-					// Output debug info
-					debugPrint("US OUTPUT - WAVEFORM", 1);
+	// Output debug info
+	if(debugEnabled) {
+		debugPrint("US TRIGGER SET - CHANGEOVER: ", 0);
+		debugPrintInt(levels[0], 0);
+		debugPrintString(", NL: ");
+		debugPrintInt(levels[1], 0);
+		debugPrintString(", NU: ");
+		debugPrintInt(levels[2], 0);
+		debugPrintString(", FL: ");
+		debugPrintInt(levels[3], 0);
+		debugPrintString(", FU: ");
+		debugPrintInt(levels[4], 0);
+		debugPrintChar('\n');
+	}
+}
 
-					break;
-				}
-				case 0x02: {
-					// Enable range output
-					usarrayOutputMode = US_OUTPUT_RANGE;
+void debugCmdSetUSOutput(const u8 *data, u8 length) {
+	// Set ultrasound output mode
+	switch(data[0]) {
+		case 0x00: {
+			// Disable output
+			usarrayOutputMode = US_OUTPUT_NONE;
 
-					// Output debug info
-					debugPrint("US OUTPUT - RANGE", 1);
+			// Output debug info
+			debugPrint("US OUTPUT - DISABLED", 1);
 
-					break;
-				}
-				default: {
-					// Output debug info
-					debugPrint("US OUTPUT - NOT RECOGNISED!", 1);
-				}
-			}
+			break;
+		}
+		case 0x01: {
+			// Enable waveform output
+			usarrayOutputMode = US_OUTPUT_WAVEFORM;
+
+			// Output debug info
+			debugPrint("US OUTPUT - WAVEFORM", 1);
 
 			break;
 		}
-		case DEBUG_CMD_ROBOT_COMMAND: {
-			// Messy command unfortunately, the number of bytes to transfer to the robot must be sent
-			if(debugRobotCmdSizeReceived == 0) {
-				// Wait for data length
-				if(get_rx_count(&UartBuffDebug) < 1) return;
+		case 0x02: {
+			// Enable range output
+			usarrayOutputMode = US_OUTPUT_RANGE;
 
-				// Read length
-				debugRobotCmdSizeReceived = uart_getchar(&UartBuffDebug);
-			}
+			// Output debug info
+			debugPrint("US OUTPUT - RANGE", 1);
+
+			break;
+		}
+		default: {
+			// Output debug info
+			debugPrint("US OUTPUT - NOT RECOGNISED!", 1);
+		}
+	}
+}
 
-			// Wait for data
-			if(get_rx_count(&UartBuffDebug) < debugRobotCmdSizeReceived) return;
+void debugCmdRobotCommand(const u8 *data, u8 length) {
+	// Transfer command directly to robot, whole or not at all
+	if(uart_reserve(&UartBuffRobot, length, UART_PRIORITY_CRITICAL) == -1) {
+		// Output debug info
+		debugPrint("ROBOT CMD TOO LONG!", 1);
+		return;
+	}
+	uart_write(&UartBuffRobot, (const char*) data, length);
 
-			// Transfer command directly to robot
-			while(debugRobotCmdSizeReceived > 0) {
-				// Get data
-				char data = uart_getchar(&UartBuffDebug);
+	// Output debug info
+	debugPrint("ROBOT CMD ISSUED", 1);
+}
 
-				// Put data
-				while(uart_putchar(&UartBuffRobot, data) == -1);
+void debugCmdPing(const u8 *data, u8 length) {
+	// Output debug info
+	debugPrint("PING!", 1);
+}
 
-				// Decrement data count
-				debugRobotCmdSizeReceived--;
-			}
+void debugCmdRobotPassthrough(const u8 *data, u8 length) {
+	// Output debug info
+	debugPrint("ENTERING 3PI PASSTHROUGH MODE...", 1);
+
+	// Entered once rest of frame has been dealt with
+	debugPassthrough = 0x01;
+}
+
+void debugCmdSetUSRanging(const u8 *data, u8 length) {
+	// Set ultrasound ranging algorithm
+	switch(data[0]) {
+		case US_RANGING_THRESHOLD: {
+			usarray_set_ranging(US_RANGING_THRESHOLD);
 
 			// Output debug info
-			debugPrint("ROBOT CMD ISSUED", 1);
+			debugPrint("US RANGING - THRESHOLD", 1);
 
 			break;
 		}
-		case DEBUG_CMD_PING: {
+		case US_RANGING_MATCHED: {
+			usarray_set_ranging(US_RANGING_MATCHED);
+
 			// Output debug info
-			debugPrint("PING!", 1);
+			debugPrint("US RANGING - MATCHED FILTER", 1);
 
 			break;
 		}
-		case DEBUG_CMD_ROBOT_PASSTHROUGH: {
+		case US_RANGING_ENVELOPE: {
+			usarray_set_ranging(US_RANGING_ENVELOPE);
+
 			// Output debug info
-			debugPrint("ENTERING 3PI PASSTHROUGH MODE...", 1);
+			debugPrint("US RANGING - ENVELOPE", 1);
 
-			// No going back once we've done this
-			Passthrough3PI();
+			break;
+		}
+		case US_RANGING_CFAR: {
+			usarray_set_ranging(US_RANGING_CFAR);
+
+			// Output debug info
+			debugPrint("US RANGING - CFAR", 1);
 
 			break;
 		}
 		default: {
 			// Output debug info
-			debugPrint("ERROR CMD NOT RECOGNISED!", 1);
+			debugPrint("US RANGING - NOT RECOGNISED!", 1);
 		}
 	}
+}
 
-	// Reset command
-	debugCommand = DEBUG_CMD_NONE;
+void debugCmdSetUSOffset(const u8 *data, u8 length) {
+	// Get sensor and offset, in native byte order
+	u8 sensor = data[0];
+	signed short offset;
+	memcpy(&offset, &data[1], sizeof(offset));
+
+	// Check data
+	if(sensor < US_SENSOR_COUNT) {
+		// Execute command
+		usarray_set_offset(sensor, offset);
+
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US OFFSET SET - SENSOR: ", 0);
+			debugPrintInt(sensor, 0);
+			debugPrintString(", OFFSET: ");
+			debugPrintInt(offset, 1);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US OFFSET SET - NOT RECOGNISED!", 1);
+	}
+}
+
+void debugCmdSetUSStream(const u8 *data, u8 length) {
+	// Get range, in native byte order
+	unsigned short range;
+	memcpy(&range, data, sizeof(range));
+
+	// Execute command
+	usarray_set_stream_range(range);
+
+	// Output debug info
+	if(debugEnabled) {
+		debugPrint("US STREAM RANGE SET - ", 0);
+		debugPrintInt(range, 0);
+		debugPrintChar('\n');
+	}
+}
+
+void debugCmdSetUSProfile(const u8 *data, u8 length) {
+	// Get sensor, then sample count, sample period and burst length in native byte order
+	u8 sensor = data[0];
+	unsigned short profile[3];
+	memcpy(profile, &data[1], sizeof(profile));
+
+	// Execute command
+	int result = usarray_set_profile(sensor, profile[0], profile[1], profile[2]);
+
+	// Output debug info
+	if(debugEnabled) {
+		debugPrint((result != XST_SUCCESS) ? "US PROFILE REJECTED - " : usarray_scan_busy() ? "US PROFILE PENDING - " : "US PROFILE SET - ", 0);
+		debugPrintInt(sensor, 0);
+		debugPrintChar(' ');
+		debugPrintInt(profile[0], 0);
+		debugPrintChar(' ');
+		debugPrintInt(profile[1], 0);
+		debugPrintChar(' ');
+		debugPrintInt(profile[2], 0);
+		debugPrintChar('\n');
+	}
+}
+
+void debugCmdSetUSCrosstalk(const u8 *data, u8 length) {
+	// Get pinging and listening sensors, then time in native byte order
+	u8 from = data[0];
+	u8 to = data[1];
+	unsigned short time;
+	memcpy(&time, &data[2], sizeof(time));
+
+	// Execute command
+	usarray_set_crosstalk(from, to, time);
+
+	// Output debug info
+	if(debugEnabled) {
+		debugPrint("US CROSSTALK SET - ", 0);
+		debugPrintInt(from, 0);
+		debugPrintChar(' ');
+		debugPrintInt(to, 0);
+		debugPrintChar(' ');
+		debugPrintInt(usarray_get_crosstalk(from, to), 0);
+		debugPrintChar('\n');
+	}
+}
+
+void debugCmdSetUSPair(const u8 *data, u8 length) {
+	// Get transmitting and receiving sensors
+	u8 tx = data[0];
+	u8 rx = data[1];
+
+	// Execute command
+	if(usarray_set_pair(tx, rx) == XST_SUCCESS) {
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US PAIR SET - ", 0);
+			debugPrintInt(tx, 0);
+			debugPrintChar(' ');
+			debugPrintInt(usarray_get_pair(tx), 1);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US PAIR - NOT RECOGNISED!", 1);
+	}
+}
+
+void debugCmdSetUSStack(const u8 *data, u8 length) {
+	// Execute command
+	usarray_set_stacking(data[0] != 0x00);
+
+	// Output debug info
+	debugPrint((data[0] != 0x00) ? "US STACKING - ENABLED" : "US STACKING - DISABLED", 1);
 }
 
+void debugCmdSetUSStackLimits(const u8 *data, u8 length) {
+	// Execute command
+	if(usarray_set_stack_limits(data[0], data[1]) == XST_SUCCESS) {
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US STACK LIMITS - ", 0);
+			debugPrintInt(1 << data[0], 0);
+			debugPrint(" TO ", 0);
+			debugPrintInt(1 << data[1], 0);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US STACK LIMITS - NOT RECOGNISED!", 1);
+	}
+}
+
+void debugCmdSetUSBaseline(const u8 *data, u8 length) {
+	// Set baseline mode
+	switch(data[0]) {
+		case 0x00: {
+			// Disable subtraction
+			usarray_set_baseline(0);
+
+			// Output debug info
+			debugPrint("US BASELINE - DISABLED", 1);
+
+			break;
+		}
+		case 0x01: {
+			// Enable subtraction
+			usarray_set_baseline(1);
+
+			// Output debug info
+			debugPrint("US BASELINE - ENABLED", 1);
+
+			break;
+		}
+		case 0x02: {
+			// Relearn baseline from next captures and enable subtraction
+			usarray_learn_baseline();
+			usarray_set_baseline(1);
+
+			// Output debug info
+			debugPrint("US BASELINE - RELEARNING", 1);
+
+			break;
+		}
+		default: {
+			// Output debug info
+			debugPrint("US BASELINE - NOT RECOGNISED!", 1);
+		}
+	}
+}
+
+void debugCmdSetUSCurve(const u8 *data, u8 length) {
+	// Execute command
+	usarray_set_curve(data[0]);
+
+	// Output debug info
+	if(debugEnabled) {
+		debugPrint("US CURVE SET - ABSORPTION: ", 0);
+		debugPrintInt(data[0], 0);
+		debugPrintChar('\n');
+	}
+}
+
+void debugCmdUploadUSCurve(const u8 *data, u8 length) {
+	// Get sensor, then start sample in native byte order, then levels
+	u8 sensor = data[0];
+	unsigned short start;
+	memcpy(&start, &data[1], sizeof(start));
+
+	// Execute command
+	if(usarray_upload_curve(sensor, start, &data[3], TRIGGER_CURVE_CHUNK) == XST_SUCCESS) {
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US CURVE UPLOADED - ", 0);
+			debugPrintInt(sensor, 0);
+			debugPrintChar(' ');
+			debugPrintInt(start, 0);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US CURVE UPLOAD - NOT RECOGNISED!", 1);
+	}
+}
+
+void debugCmdGetUSHealth(const u8 *data, u8 length) {
+	// Output counters for each sensor - status, captures, stuck, dead, saturated
+	if(debugEnabled) {
+		const us_health_table *health = usarray_health_table();
+		int i;
+		for(i = 0; i < US_SENSOR_COUNT; i++) {
+			debugPrint("US HEALTH - ", 0);
+			debugPrintInt(i, 0);
+			debugPrintString(": ");
+			debugPrintInt(health->status[i], 0);
+			debugPrintChar(' ');
+			debugPrintInt(health->captures[i], 0);
+			debugPrintChar(' ');
+			debugPrintInt(health->stuck[i], 0);
+			debugPrintChar(' ');
+			debugPrintInt(health->dead[i], 0);
+			debugPrintChar(' ');
+			debugPrintInt(health->saturated[i], 0);
+			debugPrintChar('\n');
+		}
+	}
+
+	// Clear counters if asked
+	if(data[0] == 0x01) usarray_reset_health();
+}
+
+void debugCmdGetLatency(const u8 *data, u8 length) {
+	// Output latest, worst, average and count for each path
+	debugPrintLatency("ESTOP LATENCY: ", &estopLatency);
+	debugPrintLatency("DRIVE LATENCY: ", &driveLatency);
+
+	// Clear measurements if asked
+	if(data[0] == 0x01) {
+		latencyReset(&estopLatency);
+		latencyReset(&driveLatency);
+	}
+}
+
+void debugCmdGetProfile(const u8 *data, u8 length) {
+	// Output latest, worst, average and count of cycles taken
+	debugPrintLatency("SCAN CYCLES: ", &scanCycles);
+	debugPrintLatency("UART ISR CYCLES: ", &uartCycles);
+
+	// Clear measurements if asked
+	if(data[0] == 0x01) {
+		latencyReset(&scanCycles);
+		latencyReset(&uartCycles);
+	}
+}
+
+void debugCmdGetDropped(const u8 *data, u8 length) {
+	// Output messages dropped by each telemetry UART
+	debugPrint("DROPPED - DEBUG: ", 0);
+	debugPrintInt(UartBuffDebug.droppedTX, 0);
+	debugPrintString(", BT: ");
+	debugPrintInt(UartBuffBT.droppedTX, 0);
+	debugPrintChar('\n');
+
+	// Clear counters if asked
+	if(data[0] == 0x01) {
+		UartBuffDebug.droppedTX = 0;
+		UartBuffBT.droppedTX = 0;
+	}
+}
+
+void debugCmdSetTelemRate(const u8 *data, u8 length) {
+	// Get channel, then interval in native byte order
+	u8 channel = data[0];
+	unsigned short interval;
+	memcpy(&interval, &data[1], sizeof(interval));
+
+	// Execute command
+	if(channel < TELEM_CHANNEL_MAX) {
+		telem_set_interval(channel, interval);
+
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("TELEMETRY RATE SET - ", 0);
+			debugPrintInt(channel, 0);
+			debugPrintChar(' ');
+			debugPrintInt(interval, 0);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("TELEMETRY RATE - NOT RECOGNISED!", 1);
+	}
+}
+
+void debugCmdSetUSWaveformROI(const u8 *data, u8 length) {
+	// Execute command
+	if(data[0] <= WAVEFORM_SHIFT_MAX) {
+		usarrayWaveformShift = data[0];
+
+		// Output debug info
+		if(debugEnabled) {
+			debugPrint("US WAVEFORM ROI SHIFT - ", 0);
+			debugPrintInt(usarrayWaveformShift, 0);
+			debugPrintChar('\n');
+		}
+	} else {
+		// Output debug info
+		debugPrint("US WAVEFORM ROI - NOT RECOGNISED!", 1);
+	}
+}
+
+// --------------------------------------------------------------------------------
+
 void ProcessSerial3PI() {
 	// Attempt to read byte from robot UART if there is no response pending
 	if(mpResponse == PLATFORM_RESP_NONE) mpResponse = uart_getchar(&UartBuffRobot);
@@ -387,9 +910,9 @@ void ProcessSerial3PI() {
 
 			// Print message
 			if(debugEnabled) {
-				debugPrint("3PI: ", 0);
-				uart_print(&UartBuffDebug, (char*) &mpDebugBuf);
-				while(uart_putchar(&UartBuffDebug, '\n') == -1);
+				debugPrintPriority("3PI: ", 0, UART_PRIORITY_LOW);
+				debugPrintString((char*) &mpDebugBuf);
+				debugPrintChar('\n');
 			}
 
 			// Attempt to read another byte from UART
@@ -420,12 +943,12 @@ void ProcessSerial3PI() {
 		}
 		case PLATFORM_RESP_OK: {
 			// Command succeeded - Output debug info
-			debugPrint("3PI CMD OK", 1);
+			debugPrintPriority("3PI CMD OK", 1, UART_PRIORITY_LOW);
 			break;
 		}
 		case PLATFORM_RESP_ERR: {
 			// Command failed - Output debug info
-			debugPrint("3PI CMD ERROR", 1);
+			debugPrintPriority("3PI CMD ERROR", 1, UART_PRIORITY_LOW);
 			break;
 		}
 		case PLATFORM_RESP_POS: {
@@ -443,15 +966,25 @@ void ProcessSerial3PI() {
 			mpCurrentPos.Y = (short) data[1];
 			mpCurrentPos.Theta = (short) data[2];
 
+			// Pose goes to host as it arrives, updates coming faster than its rate limit are skipped
+			u8 pose[6];
+			pose[0] = mpCurrentPos.X & 0xFF;
+			pose[1] = (mpCurrentPos.X >> 8) & 0xFF;
+			pose[2] = mpCurrentPos.Y & 0xFF;
+			pose[3] = (mpCurrentPos.Y >> 8) & 0xFF;
+			pose[4] = mpCurrentPos.Theta & 0xFF;
+			pose[5] = (mpCurrentPos.Theta >> 8) & 0xFF;
+			telem_send(TELEM_CH_POSE, pose, sizeof(pose), UART_PRIORITY_LOW, sysTickCounter);
+
 			// Output debug info
 			if(debugEnabled) {
-				debugPrint("3PI POS UPDATE: ", 0);
-				uart_print_int(&UartBuffDebug, mpCurrentPos.X, 1);
-				while(uart_putchar(&UartBuffDebug, ',') == -1);
-				uart_print_int(&UartBuffDebug, mpCurrentPos.Y, 1);
-				while(uart_putchar(&UartBuffDebug, ',') == -1);
-				uart_print_int(&UartBuffDebug, mpCurrentPos.Theta, 0);
-				while(uart_putchar(&UartBuffDebug, '\n') == -1);
+				debugPrintPriority("3PI POS UPDATE: ", 0, UART_PRIORITY_LOW);
+				debugPrintInt(mpCurrentPos.X, 1);
+				debugPrintChar(',');
+				debugPrintInt(mpCurrentPos.Y, 1);
+				debugPrintChar(',');
+				debugPrintInt(mpCurrentPos.Theta, 0);
+				debugPrintChar('\n');
 			}
 			break;
 		}
@@ -464,9 +997,9 @@ void ProcessSerial3PI() {
 
 			// Output debug info
 			if(debugEnabled) {
-				debugPrint("3PI BTN PRESS: ", 0);
-				while(uart_putchar(&UartBuffDebug, '0' + data) == -1);
-				while(uart_putchar(&UartBuffDebug, '\n') == -1);
+				debugPrintPriority("3PI BTN PRESS: ", 0, UART_PRIORITY_LOW);
+				debugPrintChar('0' + data);
+				debugPrintChar('\n');
 			}
 			break;
 		}
@@ -477,62 +1010,203 @@ void ProcessSerial3PI() {
 }
 
 void ProcessUSArray() {
-	// Start next scan if array is enabled
-	if(usarrayEnabled && numSensors > 0) {
-		// Start first ranging operation
-		usarray_scan(sensors, numSensors);
+	static unsigned int temperatureTime = 0;
+	static int weightState = -1; // Driving state scan weights were last set for
+	static u8 scanSensors[US_SENSOR_COUNT]; // Sensors in scan running now, sensor list may change before it completes
+	static u8 scanCount = 0;
+	static u32 scanCyclesTotal = 0; // Cycles spent polling scan so far
+
+	// Refresh temperature every so often so ranges follow the room warming up, only between scans as it shares the FSL bus
+	if(sysTickCounter >= temperatureTime && !usarray_scan_busy()) {
+		usarray_measure_temp();
+		temperatureTime += TEMPERATURE_INTERVAL;
+	}
+
+	// Baseline may only follow changes while moving, anything seen while stopped could be a real obstacle
+	usarray_set_baseline_tracking(drivingState != DRIVE_STOP);
+
+	// Start next scan once last one is finished if array is enabled
+	if(usarrayEnabled && !usarray_scan_busy()) {
+		// Let scheduler pick sensors, favouring those facing direction of travel
+		if(usarrayScheduled) {
+			if(weightState != drivingState) {
+				int i;
+				for(i = 0; i < US_SENSOR_COUNT; i++) usarray_set_weight(i, usarrayWeights[drivingState][i]);
+				weightState = drivingState;
+			}
+			numSensors = usarray_schedule(sysTickCounter, sensors, SCHED_BATCH);
+		}
+
+		if(numSensors > 0 && usarray_scan_start(sensors, numSensors) == XST_SUCCESS) {
+			int i;
+			for(i = 0; i < numSensors; i++) scanSensors[i] = sensors[i];
+			scanCount = numSensors;
+		}
+	}
+
+	// Move scan along without waiting for samples, everything else only happens once it completes
+	u32 start = sysCycles();
+	u8 complete = usarray_scan_poll();
+	scanCyclesTotal += sysCycles() - start;
+	if(complete) {
+		latencyRecord(&scanCycles, scanCyclesTotal);
+		scanCyclesTotal = 0;
 
 		// Update range array
-		usarray_update_ranges(sensors, numSensors);
-
-		// Output data if requested
-		if(usarrayOutputMode != US_OUTPUT_NONE) {
-
-			// Output start message
-			uart_print_char(&UartBuffDebug, 0xFF);
-			uart_print_char(&UartBuffDebug, 0xFF);
-
-			// Output data
-			int i, j;
-			u8 sensorNum;
-			switch(usarrayOutputMode) {
-				case US_OUTPUT_NONE: {
-					// Do nothing
-					break;
-				}
-				case US_OUTPUT_WAVEFORM: {
-					// Output data for each required sensor
-					for(i = 0; i < numSensors; i++) {
-						for(j = 0; j < US_RX_COUNT; j++) {
-							sensorNum = sensors[i];
-							// Print waveform data
-							char first = ((usWaveformData[sensorNum][j] & 0xF00) >> 4) | (sensorNum & 0x0F);
-							char second = usWaveformData[sensorNum][j] & 0xFF;
-							uart_print_char(&UartBuffDebug, first);
-							uart_print_char(&UartBuffDebug, second);
-						}
-					}
-					break;
-				}
-				case US_OUTPUT_RANGE: {
-					// Output data for each required sensor
-					for(i = 0; i < numSensors; i++) {
-						sensorNum = sensors[i];
-						// Print range data
-						char first = ((usRangeReadings[sensorNum] & 0xF00) >> 4) | (i & 0x0F);
-						char second = usRangeReadings[sensorNum] & 0xFF;
-						uart_print_char(&UartBuffDebug, first);
-						uart_print_char(&UartBuffDebug, second);
-					}
-					break;
+		usarray_update_ranges(scanSensors, scanCount);
+
+		// Smooth ranges and work out closing speeds
+		usarray_track(scanSensors, scanCount, sysTickCounter);
+
+		// Hand completed scan over to readers, output works from this copy so never holds up next scan
+		usarray_publish(scanSensors, scanCount);
+	}
+
+	// Send as much of latest scan as debug UART has room for
+	OutputUSArray();
+}
+
+void OutputUSArray() {
+	static const us_scan_result *result = NULL; // Scan whose waveforms are being sent, held until finished
+	static u32 lastSequence = 0; // Last scan sent
+	static int sensorIndex; // Position in scan's sensor list
+	static int sample; // Position in waveform
+	static u8 data[WAVEFORM_HEADER_LEN + WAVEFORM_CODED_MAX]; // Chunk coded but not yet sent
+	static int length = 0; // Size of unsent chunk, 0 when there isn't one
+	static int count; // Samples in unsent chunk
+	const us_scan_result *latest = usarray_latest_result();
+
+	// Give up on waveforms being sent if output has been changed, before anything else so the result isn't held forever
+	if(result != NULL && usarrayOutputMode != US_OUTPUT_WAVEFORM) {
+		usarray_release_result(result);
+		result = NULL;
+	}
+
+	// Ranges are small enough to send from each new scan straight away
+	if(usarrayOutputMode == US_OUTPUT_RANGE) {
+		if(latest != NULL && latest->sequence != lastSequence) {
+			lastSequence = latest->sequence;
+			OutputRanges(latest);
+		}
+		return;
+	}
+
+	// Start on newest scan once previous one has gone, scans published meanwhile are skipped
+	if(result == NULL) {
+		if(usarrayOutputMode != US_OUTPUT_WAVEFORM || latest == NULL || latest->sequence == lastSequence) return;
+		result = usarray_hold_result();
+		lastSequence = result->sequence;
+		sensorIndex = 0;
+		sample = 0;
+		length = 0;
+	}
+
+	// Send waveforms a chunk per frame while they fit, a chunk that doesn't is kept and tried again next time
+	while(sensorIndex < result->count) {
+		u8 sensorNum = result->sensors[sensorIndex];
+		int total = result->rxCount[sensorNum];
+
+		if(length == 0) {
+			// Exact samples around echo, coarse elsewhere - everything exact if shift is 0
+			int shift = usarrayWaveformShift;
+			int roiStart = 0;
+			int roiEnd = total;
+			if(shift > 0) {
+				roiStart = roiEnd = 0;
+				if(result->echoIndex[sensorNum] >= 0) {
+					roiStart = result->echoIndex[sensorNum] - WAVEFORM_ROI_BEFORE;
+					roiEnd = result->echoIndex[sensorNum] + WAVEFORM_ROI_AFTER;
+					if(roiStart < 0) roiStart = 0;
+					if(roiEnd > total) roiEnd = total;
 				}
 			}
 
-			// Output end message
-			uart_print_char(&UartBuffDebug, 0x7F);
-			uart_print_char(&UartBuffDebug, 0xFF);
+			// Code as many samples as fit, each chunk starts codec afresh so a lost frame only loses its own samples
+			wavecodec_state codec;
+			wavecodec_start(&codec, &data[WAVEFORM_HEADER_LEN], WAVEFORM_CODED_MAX, sample, roiStart, roiEnd, shift);
+			count = 0;
+			while(sample + count < total && wavecodec_encode(&codec, result->waveform[sensorNum][sample + count]) == 0) count++;
+			length = WAVEFORM_HEADER_LEN + wavecodec_finish(&codec);
+
+			// Scan, sensor, samples in capture, first sample and samples in chunk, region of interest, shift
+			data[0] = result->sequence & 0xFF;
+			data[1] = (result->sequence >> 8) & 0xFF;
+			data[2] = sensorNum;
+			data[3] = total & 0xFF;
+			data[4] = total >> 8;
+			data[5] = sample & 0xFF;
+			data[6] = sample >> 8;
+			data[7] = count & 0xFF;
+			data[8] = count >> 8;
+			data[9] = roiStart & 0xFF;
+			data[10] = roiStart >> 8;
+			data[11] = roiEnd & 0xFF;
+			data[12] = roiEnd >> 8;
+			data[13] = shift;
+		}
+		if(telem_send(TELEM_CH_WAVEFORM, data, length, UART_PRIORITY_NORMAL, sysTickCounter) == -1) return;
+		length = 0;
+
+		sample += count;
+		if(sample >= total) {
+			sample = 0;
+			sensorIndex++;
+		}
+	}
+
+	// Whole scan gone
+	usarray_release_result(result);
+	result = NULL;
+}
+
+void OutputRanges(const us_scan_result *result) {
+	static s16 current[US_SENSOR_COUNT]; // Latest reading from every sensor, whichever scan it came from
+	static s16 sent[US_SENSOR_COUNT]; // Reading host was last sent
+	static u16 known = 0; // Sensors with a reading, bit per sensor
+	static u16 told = 0; // Sensors host has been sent a reading for
+	static u8 sinceKey = RANGE_KEY_FRAMES; // Frames since last one carrying every sensor
+	int i;
+
+	// Scheduled scans only cover some sensors, keep everyone's latest
+	for(i = 0; i < result->count; i++) {
+		current[result->sensors[i]] = result->range[result->sensors[i]];
+		known |= 1 << result->sensors[i];
+	}
+
+	// Changes held back by rate limit are still different from what was sent, so go in next frame
+	if(!telem_ready(TELEM_CH_RANGE, sysTickCounter)) return;
+
+	// Only sensors whose reading has moved, except every so often when all go so host recovers from a lost frame
+	u8 key = sinceKey >= RANGE_KEY_FRAMES;
+	u8 data[6 + US_SENSOR_COUNT * 2];
+	u16 mask = 0;
+	int length = 6;
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		if(!(known & (1 << i))) continue;
+		int change = current[i] - sent[i];
+		if(key || !(told & (1 << i)) || change > RANGE_DEADBAND || change < -RANGE_DEADBAND) {
+			mask |= 1 << i;
+			data[length++] = current[i] & 0xFF;
+			data[length++] = (current[i] >> 8) & 0xFF;
 		}
 	}
+	if(mask == 0) return;
+
+	// Scan, sensors included (bit per sensor), then their ranges in sensor order
+	data[0] = result->sequence & 0xFF;
+	data[1] = (result->sequence >> 8) & 0xFF;
+	data[2] = (result->sequence >> 16) & 0xFF;
+	data[3] = (result->sequence >> 24) & 0xFF;
+	data[4] = mask & 0xFF;
+	data[5] = mask >> 8;
+	if(telem_send(TELEM_CH_RANGE, data, length, UART_PRIORITY_NORMAL, sysTickCounter) == -1) return;
+
+	// Host now has these
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		if(mask & (1 << i)) sent[i] = current[i];
+	}
+	told |= mask;
+	sinceKey = key ? 0 : sinceKey + 1;
 }
 
 void Passthrough3PI() {
@@ -584,6 +1258,8 @@ void TestFSL() {
 #define START_DELAY     10000
 
 #define FRONT_DIST      70
+#define FRONT_TTC       500
+#define ESTOP_TTC       250
 #define REVERSE_DIST    40
 #define SIDE_DIST       40
 #define NEAR_CLEAR_DIST 80
@@ -595,6 +1271,33 @@ void TestFSL() {
 #define SPEED_TURN_SLOW 20
 #define SPEED_REVERSE   20
 
+u8 FrontObstacle() {
+	// Obstacle ahead is either close or being closed on quickly
+	return usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
+			|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST)
+			|| usarray_ttc(SENSOR_FRONT_RIGHT) < FRONT_TTC
+			|| usarray_ttc(SENSOR_FRONT_LEFT) < FRONT_TTC;
+}
+
+void CheckCollision(u8 sensor) {
+	usCaptureTime[sensor] = sysTimeMicros();
+
+	// Only worth the early look at front sensors while driving into whatever they see
+	if (sensor != SENSOR_FRONT_RIGHT && sensor != SENSOR_FRONT_LEFT) return;
+	if (drivingState != DRIVE_FORWARD && drivingState != DRIVE_LEFT && drivingState != DRIVE_RIGHT) return;
+	if (estopPending) return;
+
+	// Range and track this capture now, rest of scan picks up where this leaves off
+	usarray_update_ranges(&sensor, 1);
+	usarray_track(&sensor, 1, sysTickCounter);
+
+	if (usarray_ttc(sensor) < ESTOP_TTC) {
+		mpEmergencyStop();
+		estopPending = 0x01;
+		latencyRecord(&estopLatency, sysTimeMicros() - usCaptureTime[sensor] + usarray_echo_age(sensor));
+	}
+}
+
 void Init3PI() {
 	// Set manual mode
 	mpSetMode(0x00);
@@ -611,13 +1314,11 @@ void Drive3PI() {
 			}
 			break;
 		case DRIVE_FORWARD:
-			if ((usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST))
+			if (FrontObstacle()
 					&& !usarray_detect_obstacle(SENSOR_RIGHT_MID, FAR_CLEAR_DIST)) {
 				nextDrivingState = DRIVE_SPIN_RIGHT;
 			}
-			else if (usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST)) {
+			else if (FrontObstacle()) {
 				nextDrivingState = DRIVE_SPIN_LEFT;
 			}
 			else if (usarray_detect_obstacle(SENSOR_LEFT_MID, SIDE_DIST)
@@ -630,13 +1331,11 @@ void Drive3PI() {
 			}
 			break;
 		case DRIVE_LEFT:
-			if ((usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST))
+			if (FrontObstacle()
 					&& !usarray_detect_obstacle(SENSOR_RIGHT_MID, FAR_CLEAR_DIST)) {
 				nextDrivingState = DRIVE_SPIN_RIGHT;
 			}
-			else if (usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST)) {
+			else if (FrontObstacle()) {
 				nextDrivingState = DRIVE_SPIN_LEFT;
 			}
 			else if (!usarray_detect_obstacle(SENSOR_RIGHT_MID, SIDE_DIST)) {
@@ -644,13 +1343,11 @@ void Drive3PI() {
 			}
 			break;
 		case DRIVE_RIGHT:
-			if ((usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST))
+			if (FrontObstacle()
 					&& !usarray_detect_obstacle(SENSOR_RIGHT_MID, FAR_CLEAR_DIST)) {
 				nextDrivingState = DRIVE_SPIN_RIGHT;
 			}
-			else if (usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
-					|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST)) {
+			else if (FrontObstacle()) {
 				nextDrivingState = DRIVE_SPIN_LEFT;
 			}
 			else if (!usarray_detect_obstacle(SENSOR_LEFT_MID, SIDE_DIST)) {
@@ -701,60 +1398,57 @@ void Drive3PI() {
 	}
 
 
-	if (nextDrivingState != drivingState) {
+	// Time normal path takes to turn away from a front obstacle, for comparison with emergency stop
+	if ((drivingState == DRIVE_FORWARD || drivingState == DRIVE_LEFT || drivingState == DRIVE_RIGHT)
+			&& (nextDrivingState == DRIVE_SPIN_LEFT || nextDrivingState == DRIVE_SPIN_RIGHT)) {
+		u8 sensor = (usCaptureTime[SENSOR_FRONT_RIGHT] - usCaptureTime[SENSOR_FRONT_LEFT] < 0x80000000) ? SENSOR_FRONT_RIGHT : SENSOR_FRONT_LEFT;
+		latencyRecord(&driveLatency, sysTimeMicros() - usCaptureTime[sensor] + usarray_echo_age(sensor));
+	}
+
+	// Motors were stopped behind state machine's back, so current state's command needs resending
+	if (nextDrivingState != drivingState || estopPending) {
+		estopPending = 0x00;
 		switch (nextDrivingState) {
 			case DRIVE_STOP:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: STOP\n\n");
-				uart_print(&UartBuffBT, "\n      \n    ###\n   ##@##  \n    ###\n      \n");
+				statusPrint("State: STOP\n\n", "\n      \n    ###\n   ##@##  \n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_FORWARD, SPEED_STOP, SPEED_STOP);
 				break;
 			case DRIVE_FORWARD:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: FORWARD\n\n");
-				uart_print(&UartBuffBT, "\n     |\n    ###\n   ##@##  \n    ###\n      \n");
+				statusPrint("State: FORWARD\n\n", "\n     |\n    ###\n   ##@##  \n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_FORWARD, SPEED_GO, SPEED_GO);
 				break;
 			case DRIVE_LEFT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: LEFT\n\n");
-				uart_print(&UartBuffBT, "\n     |\n    ###\n < ##@##  \n    ###\n      \n");
+				statusPrint("State: LEFT\n\n", "\n     |\n    ###\n < ##@##  \n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_FORWARD, SPEED_TURN_SLOW, SPEED_TURN_FAST);
 				break;
 			case DRIVE_RIGHT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: RIGHT\n\n");
-				uart_print(&UartBuffBT, "\n     |\n    ###\n   ##@## >\n    ###\n      \n");
+				statusPrint("State: RIGHT\n\n", "\n     |\n    ###\n   ##@## >\n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_FORWARD, SPEED_TURN_FAST, SPEED_TURN_SLOW);
 				break;
 			case DRIVE_SPIN_LEFT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: SPIN LEFT\n\n");
-				uart_print(&UartBuffBT, "\n      \n    ###\n < ##@##  \n    ###\n      \n");
+				statusPrint("State: SPIN LEFT\n\n", "\n      \n    ###\n < ##@##  \n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_LEFT, SPEED_TURN_FAST, SPEED_TURN_FAST);
 				break;
 			case DRIVE_SPIN_RIGHT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: SPIN RIGHT\n\n");
-				uart_print(&UartBuffBT, "\n      \n    ###\n   ##@## >\n    ###\n      \n");
+				statusPrint("State: SPIN RIGHT\n\n", "\n      \n    ###\n   ##@## >\n    ###\n      \n");
 				mpSetMotorSpeed(PLATFORM_DIR_RIGHT, SPEED_TURN_FAST, SPEED_TURN_FAST);
 				break;
 			case DRIVE_REVERSE_LEFT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: REVERSE LEFT\n\n");
-				uart_print(&UartBuffBT, "\n      \n    ###\n < ##@##  \n    ###\n     |\n");
+				statusPrint("State: REVERSE LEFT\n\n", "\n      \n    ###\n < ##@##  \n    ###\n     |\n");
 				mpSetMotorSpeed(PLATFORM_DIR_REVERSE, SPEED_REVERSE, SPEED_REVERSE);
 				break;
 			case DRIVE_REVERSE_RIGHT:
-				uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
-				uart_print(&UartBuffBT, "State: REVERSE RIGHT\n\n");
-				uart_print(&UartBuffBT, "\n      \n    ###\n   ##@## >\n    ###\n     |\n");
+				statusPrint("State: REVERSE RIGHT\n\n", "\n      \n    ###\n   ##@## >\n    ###\n     |\n");
 				mpSetMotorSpeed(PLATFORM_DIR_REVERSE, SPEED_REVERSE, SPEED_REVERSE);
 				break;
 			default:
 				break;
 		}
 
+		// Tell host every time state is entered, includes resending after an emergency stop
+		u8 state = nextDrivingState;
+		telem_send(TELEM_CH_STATE, &state, 1, UART_PRIORITY_NORMAL, sysTickCounter);
+
 		drivingState = nextDrivingState;
 	}
 }
@@ -778,6 +1472,56 @@ void heartBeat() {
 
 // --------------------------------------------------------------------------------
 
+u32 sysTimeMicros() {
+	u32 ticks;
+	u32 value;
+
+	// Read counter within current ms, retrying if tick counter moved underneath
+	do {
+		ticks = sysTickCounter;
+		value = XTmrCtr_GetValue(&TimerSys, 0) - (((unsigned int) 0xFFFFFFFF) - (XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ / 1000));
+	} while(ticks != sysTickCounter);
+
+	return (ticks * 1000) + (value / (XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ / 1000000));
+}
+
+u32 sysCycles() {
+	u32 ticks;
+	u32 value;
+
+	// Same as sysTimeMicros without scaling, timer runs at CPU clock
+	do {
+		ticks = sysTickCounter;
+		value = XTmrCtr_GetValue(&TimerSys, 0) - (((unsigned int) 0xFFFFFFFF) - (XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ / 1000));
+	} while(ticks != sysTickCounter);
+
+	return (ticks * SYS_TICK_CYCLES) + value;
+}
+
+void latencyReset(struct LATENCY *latency) {
+	latency->last = 0;
+	latency->max = 0;
+	latency->total = 0;
+	latency->count = 0;
+}
+
+void latencyRecord(struct LATENCY *latency, u32 value) {
+	latency->last = value;
+	if(value > latency->max) latency->max = value;
+	latency->total += value;
+	latency->count++;
+}
+
+#ifdef PROFILE_UART_ISR
+void InterruptHandler_UART_Timed(void *CallbackRef) {
+	// Tick counter can't move while in here as timer interrupt waits its turn, yet timer still reloads at rollover and end would read below start
+	// Handler is far shorter than a tick, so taking elapsed cycles modulo tick period covers both cases
+	u32 start = sysCycles();
+	InterruptHandler_UART(CallbackRef);
+	latencyRecord(&uartCycles, (sysCycles() - start + SYS_TICK_CYCLES) % SYS_TICK_CYCLES);
+}
+#endif
+
 void InterruptHandler_Timer_Sys(void *CallbackRef) {
 	// Increment system tick counter
 	sysTickCounter++;
@@ -785,11 +1529,79 @@ void InterruptHandler_Timer_Sys(void *CallbackRef) {
 
 // --------------------------------------------------------------------------------
 
+void debugPrintLatency(char* str, struct LATENCY *latency) {
+	// Print latest, worst, average and count if debugging enabled
+	if(debugEnabled) {
+		debugPrint(str, 0);
+		debugPrintInt(latency->last, 0);
+		debugPrintChar(' ');
+		debugPrintInt(latency->max, 0);
+		debugPrintChar(' ');
+		debugPrintInt((latency->count > 0) ? latency->total / latency->count : 0, 0);
+		debugPrintChar(' ');
+		debugPrintInt(latency->count, 0);
+		debugPrintChar('\n');
+	}
+}
+
 void debugPrint(char* str, char newLine) {
-	// Print information to UART if debugging enabled
+	debugPrintPriority(str, newLine, UART_PRIORITY_NORMAL);
+}
+
+void debugPrintPriority(char* str, char newLine, int priority) {
+	// Start new debug message if debugging enabled
 	if(debugEnabled) {
-		uart_print(&UartBuffDebug, "#DBG: ");
-		uart_print(&UartBuffDebug, str);
-		if(newLine) while(uart_putchar(&UartBuffDebug, '\n') == -1);
+		debugLineLength = 0;
+		debugLinePriority = priority;
+		debugPrintString(str);
+		if(newLine) debugPrintChar('\n');
+	}
+}
+
+void debugPrintString(char* str) {
+	// Carry on debug message
+	while(*str != '\0') debugPrintChar(*str++);
+}
+
+void debugPrintInt(int val, unsigned char isSigned) {
+	char str[12]; // Allocate enough memory for max integer length and null terminator
+	char *ptr = &str[11]; // Setup pointer at end of string
+	unsigned int value = val;
+
+	// Handle sign
+	if(val < 0 && isSigned) value = -val;
+
+	// Generate digits backwards, zero still gets one
+	*ptr = '\0';
+	do {
+		*--ptr = '0' + (value % 10);
+		value /= 10;
+	} while(value > 0);
+	if(val < 0 && isSigned) *--ptr = '-';
+
+	// Carry on debug message
+	debugPrintString(ptr);
+}
+
+void debugPrintChar(char c) {
+	if(!debugEnabled) return;
+
+	// Line is finished, send it whole as a log frame or drop it whole if UART is too busy
+	if(c == '\n') {
+		telem_send(TELEM_CH_LOG, (u8*) debugLine, debugLineLength, debugLinePriority, sysTickCounter);
+		debugLineLength = 0;
+		return;
 	}
+
+	// Carry on debug message, cutting off anything too long
+	if(debugLineLength < DEBUG_MSG_MAX) debugLine[debugLineLength++] = c;
+}
+
+void statusPrint(char* state, char* picture) {
+	// Redraw Bluetooth status screen only if it fits, next state change redraws it anyway
+	if(uart_reserve(&UartBuffBT, STATUS_CLEAR_LEN + strlen(state) + strlen(picture), UART_PRIORITY_LOW) == -1) return;
+
+	uart_print(&UartBuffBT, "\x1b[2J\x1b[H");
+	uart_print(&UartBuffBT, state);
+	uart_print(&UartBuffBT, picture);
 }
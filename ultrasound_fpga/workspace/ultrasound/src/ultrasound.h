@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "platform.h"
 #include "xparameters.h"
 
@@ -13,6 +14,10 @@
 #include "usarray.h"
 #include "us_receiver.h"
 #include "mobplat.h"
+#include "mempool.h"
+#include "frame.h"
+#include "telemetry.h"
+#include "wavecodec.h"
 
 // --------------------------------------------------------------------------------
 
@@ -21,14 +26,47 @@
 // PC debugging commands
 enum DEBUG_CMD {
 	DEBUG_CMD_NONE = -1, // No command
+	DEBUG_CMD_FRAME = FRAME_DELIMITER, // Start of framed packet of commands - sequence number, commands, CRC16, COBS encoded
 	DEBUG_CMD_SET_DEBUG = 0x01, // Enable / disable debugging output
-	DEBUG_CMD_SET_US_MODE = 0x02, // Set ultrasound array scan mode (single / complete)
+	DEBUG_CMD_SET_US_MODE = 0x02, // Set ultrasound array scan mode (disabled / single / complete / scheduled)
 	DEBUG_CMD_SET_US_SENSOR = 0x03, // Set ultrasound array sensor index
 	DEBUG_CMD_SET_US_TRIGGERS = 0x04, // Set ultrasound array trigger levels
 	DEBUG_CMD_SET_US_OUTPUT = 0x05, // Enable / disable ultrasound array data output
 	DEBUG_CMD_ROBOT_COMMAND = 0x06, // Issue command to mobile platform
 	DEBUG_CMD_PING = 0x07, // Issue ping command
-	DEBUG_CMD_ROBOT_PASSTHROUGH = 0x08 // Enter robot passthrough mode, must reset to exit
+	DEBUG_CMD_ROBOT_PASSTHROUGH = 0x08, // Enter robot passthrough mode, must reset to exit
+	DEBUG_CMD_SET_US_RANGING = 0x09, // Set ultrasound array ranging algorithm (threshold / matched filter / envelope / CFAR)
+	DEBUG_CMD_SET_US_OFFSET = 0x0A, // Set ultrasound array range calibration for a single sensor
+	DEBUG_CMD_SET_US_STREAM = 0x0B, // Set ultrasound array streaming range, captures stop early once an echo is found within it (0 to disable)
+	DEBUG_CMD_SET_US_PROFILE = 0x0C, // Set ultrasound array acquisition profile (sample count / sample period / burst length) for a single sensor
+	DEBUG_CMD_SET_US_CROSSTALK = 0x0D, // Set time one ultrasound array sensor can hear another's ping
+	DEBUG_CMD_SET_US_PAIR = 0x0E, // Set ultrasound array sensor to listen to alternate pings of another (0xFF to disable)
+	DEBUG_CMD_SET_US_STACK = 0x0F, // Enable / disable ultrasound array multi-ping stacking
+	DEBUG_CMD_SET_US_BASELINE = 0x10, // Disable / enable / relearn ultrasound array ringdown baseline
+	DEBUG_CMD_SET_US_CURVE = 0x11, // Set ultrasound array threshold curve absorption and rebuild curves
+	DEBUG_CMD_UPLOAD_US_CURVE = 0x12, // Upload section of threshold curve for a single ultrasound array sensor
+	DEBUG_CMD_GET_US_HEALTH = 0x13, // Print ultrasound array channel health counters (0x01 to clear afterwards)
+	DEBUG_CMD_GET_LATENCY = 0x14, // Print echo to motor command latency for emergency stop and normal driving (0x01 to clear afterwards)
+	DEBUG_CMD_GET_PROFILE = 0x15, // Print CPU cycles taken by each scan and UART interrupt (0x01 to clear afterwards)
+	DEBUG_CMD_GET_DROPPED = 0x16, // Print telemetry messages dropped because UART was busy (0x01 to clear afterwards)
+	DEBUG_CMD_SET_TELEM_RATE = 0x17, // Set shortest time between frames on a telemetry channel (0 for no limit)
+	DEBUG_CMD_SET_US_WAVEFORM_ROI = 0x18, // Set bits dropped from waveform samples away from echo (0 for lossless)
+	DEBUG_CMD_SET_US_STACK_LIMITS = 0x19, // Set fewest / most pings ultrasound array stacking may use, expressed as power of 2
+	DEBUG_CMD_COUNT // Number of debug commands
+};
+
+// Debug command table entry
+struct DEBUG_CMD_ENTRY {
+	s16 length; // Argument bytes, or DEBUG_CMD_VARIABLE if first argument byte gives number following
+	void (*handler)(const u8 *data, u8 length);
+};
+
+// Debug frame acknowledgement status
+enum DEBUG_ACK {
+	DEBUG_ACK_OK = 0x00, // Every command in frame run
+	DEBUG_ACK_BAD_CRC = 0x01, // Frame corrupted, nothing run - sequence number can't be trusted
+	DEBUG_ACK_BAD_CMD = 0x02, // Unknown or truncated command, nothing run
+	DEBUG_ACK_TOO_LONG = 0x03 // Frame didn't fit receive buffer, nothing run
 };
 
 // Ultrasound data output modes
@@ -38,6 +76,16 @@ enum US_OUTPUT {
 	US_OUTPUT_RANGE = 0x02 // Range data
 };
 
+// Telemetry channels, see telemetry.h for frame layout
+enum TELEM_CH {
+	TELEM_CH_ACK = 0x01, // Debug command frame acknowledgement - sequence number, DEBUG_ACK status, commands run
+	TELEM_CH_LOG = 0x02, // Debug text, one line per frame without newline
+	TELEM_CH_RANGE = 0x03, // Changed ranges - scan (u32), sensors included (bit per sensor, u16), range of each in sensor order (mm, s16, -1 for nothing)
+	TELEM_CH_POSE = 0x04, // Platform position - X, Y, Theta (s16)
+	TELEM_CH_STATE = 0x05, // Driving state entered (DRIVE_STATE)
+	TELEM_CH_WAVEFORM = 0x06 // Waveform chunk - scan (u16), sensor, samples in capture (u16), first sample in chunk (u16), samples in chunk (u16), region of interest start and end (u16), shift, then wavecodec coded samples
+};
+
 // Mobile platform responses
 enum PLATFORM_RESP {
 	PLATFORM_RESP_NONE = -1, // No response
@@ -63,32 +111,128 @@ enum DRIVE_STATE {
 	DRIVE_SPIN_LEFT, // Spin left
 	DRIVE_SPIN_RIGHT, // Spin right
 	DRIVE_REVERSE_LEFT, // Reverse left
-	DRIVE_REVERSE_RIGHT // Reverse right
+	DRIVE_REVERSE_RIGHT, // Reverse right
+	DRIVE_STATE_COUNT // Number of driving states
 };
 
+// Timing measurement - echo to motor command latency in uS, or CPU cycles for profiling
+struct LATENCY {
+	u32 last; // Latest
+	u32 max; // Worst
+	u32 total; // Sum, for average
+	u16 count; // Times measured
+};
+
+// UART buffer sizes, must be powers of 2
+#define UART_DEBUG_TX_SIZE 1024 // bytes - output frames and debug text
+#define UART_DEBUG_RX_SIZE 128 // bytes
+#define UART_BT_TX_SIZE 256 // bytes
+#define UART_BT_RX_SIZE 64 // bytes
+#define UART_3PI_TX_SIZE BUFFER_SIZE_TX // bytes
+#define UART_3PI_RX_SIZE BUFFER_SIZE_RX // bytes
+
+// Debug commands
+#define DEBUG_CMD_VARIABLE -1 // Command length sent ahead of its arguments
+#define DEBUG_CMD_ARGS_MAX 256 // bytes - longest bare command arguments
+#define DEBUG_FRAME_MAX 256 // bytes - longest encoded command frame
+
+// Telemetry
+#define DEBUG_MSG_MAX TELEM_PAYLOAD_MAX // bytes - longest debug message, including platform debug text, longer ones are cut off
+#define TELEM_RANGE_INTERVAL 50 // ms
+#define TELEM_POSE_INTERVAL 100 // ms
+#define RANGE_DEADBAND 2 // mm - smaller range changes aren't sent
+#define RANGE_KEY_FRAMES 20 // Range frames between ones carrying every sensor
+#define WAVEFORM_HEADER_LEN 14 // bytes - waveform chunk fields ahead of coded samples
+#define WAVEFORM_CODED_MAX (TELEM_PAYLOAD_MAX - WAVEFORM_HEADER_LEN) // bytes - coded samples sent per frame
+#define WAVEFORM_ROI_BEFORE 16 // samples - sent exactly ahead of echo
+#define WAVEFORM_ROI_AFTER 48 // samples - sent exactly from echo on
+#define WAVEFORM_SHIFT_MAX 8 // Most bits that can be dropped away from echo
+#define STATUS_CLEAR_LEN 7 // bytes - terminal clear and home before Bluetooth status screen
+
 // Mobile platform
 #define MP_DEBUG_BUF_SIZE 128 // bytes
 
 // Heartbeat
 #define HEARTBEAT_INTERVAL 200 // ms
 
+// System timer
+#define SYS_TICK_CYCLES (XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ / 1000) // CPU cycles per 1ms system tick, timer runs at CPU clock
+
+// Build with PROFILE_UART_ISR defined to count cycles taken by each UART interrupt, costs two timer reads per interrupt
+#ifdef PROFILE_UART_ISR
+#define UART_ISR InterruptHandler_UART_Timed
+#else
+#define UART_ISR InterruptHandler_UART
+#endif
+
+// Ultrasound array
+#define TEMPERATURE_INTERVAL 5000 // ms
+
 // --------------------------------------------------------------------------------
 
 // Function prototypes
 
 void ProcessSerialDebug();
+void ProcessDebugFrame(); // Collect, check and run framed packet of commands
+u8 debugRunFrame(const u8 *frame, int length, enum DEBUG_ACK *status); // Run frame's commands if all are valid, returns number run
+void debugAck(u8 seq, enum DEBUG_ACK status, u8 count); // Acknowledge frame to host
 void ProcessSerial3PI();
 void ProcessUSArray();
+void OutputUSArray(); // Send latest scan to debug UART a little at a time
+void OutputRanges(const us_scan_result *result); // Send ranges that have changed since host was last told
 void Passthrough3PI();
 void TestFSL();
 void Init3PI();
 void Drive3PI();
+u8 FrontObstacle(); // Obstacle in front of robot
+void CheckCollision(u8 sensor); // Emergency stop fast path, run as each capture arrives
 
 void InterruptHandler_Timer_Sys(void *CallbackRef); // Increment system tick counter
+#ifdef PROFILE_UART_ISR
+void InterruptHandler_UART_Timed(void *CallbackRef); // Count cycles taken by UART interrupt handler
+#endif
 
 void heartBeat(); // Flash heartbeat LED
 
+u32 sysTimeMicros(); // Time since startup in uS, wraps after ~71 minutes
+u32 sysCycles(); // Time since startup in CPU cycles, wraps after ~42 seconds
+void latencyReset(struct LATENCY *latency);
+void latencyRecord(struct LATENCY *latency, u32 value);
+
+// Debug command handlers, data holds command's arguments
+void debugCmdSetDebug(const u8 *data, u8 length);
+void debugCmdSetUSMode(const u8 *data, u8 length);
+void debugCmdSetUSSensor(const u8 *data, u8 length);
+void debugCmdSetUSTriggers(const u8 *data, u8 length);
+void debugCmdSetUSOutput(const u8 *data, u8 length);
+void debugCmdRobotCommand(const u8 *data, u8 length);
+void debugCmdPing(const u8 *data, u8 length);
+void debugCmdRobotPassthrough(const u8 *data, u8 length);
+void debugCmdSetUSRanging(const u8 *data, u8 length);
+void debugCmdSetUSOffset(const u8 *data, u8 length);
+void debugCmdSetUSStream(const u8 *data, u8 length);
+void debugCmdSetUSProfile(const u8 *data, u8 length);
+void debugCmdSetUSCrosstalk(const u8 *data, u8 length);
+void debugCmdSetUSPair(const u8 *data, u8 length);
+void debugCmdSetUSStack(const u8 *data, u8 length);
+void debugCmdSetUSStackLimits(const u8 *data, u8 length);
+void debugCmdSetUSBaseline(const u8 *data, u8 length);
+void debugCmdSetUSCurve(const u8 *data, u8 length);
+void debugCmdUploadUSCurve(const u8 *data, u8 length);
+void debugCmdGetUSHealth(const u8 *data, u8 length);
+void debugCmdGetLatency(const u8 *data, u8 length);
+void debugCmdGetProfile(const u8 *data, u8 length);
+void debugCmdGetDropped(const u8 *data, u8 length);
+void debugCmdSetTelemRate(const u8 *data, u8 length);
+void debugCmdSetUSWaveformROI(const u8 *data, u8 length);
+
 void debugPrint(char* str, char newLine); // Print debugging message if debugging enabled
+void debugPrintPriority(char* str, char newLine, int priority); // Print debugging message, dropped whole if UART is too busy
+void debugPrintString(char* str); // Continue debugging message
+void debugPrintInt(int val, unsigned char isSigned); // Continue debugging message
+void debugPrintChar(char c); // Continue debugging message
+void statusPrint(char* state, char* picture); // Redraw Bluetooth status screen if UART has room
+void debugPrintLatency(char* str, struct LATENCY *latency); // Print timing measurement if debugging enabled
 
 // --------------------------------------------------------------------------------
 
@@ -1,34 +1,494 @@
 #include "usarray.h"
 
+#include <string.h>
+
 #include "xparameters.h"
 
 #include "pulsegen.h"
 #include "us_receiver.h"
+#include "usdsp.h"
+#include "mempool.h"
 
 #define USVoltageToTriggerLevel(x) (unsigned short) ((((unsigned int) x) * ((1 << USADCPrecision) - 1)) / USADCReference) // Voltage expressed in hundredths
 #define USSampleIndexToTime(x) (unsigned short) ((((1000000 * 10) / US_SAMPLE_RATE) * (((unsigned int) x) + 1)) / 10) // Time expressed in uS
 #define USTimeToSampleIndex(x) (unsigned short) ((((unsigned int) x) * 10) / ((1000000 * 10) / US_SAMPLE_RATE) - 1) // Time in uS
+#define USTimeToProfileIndex(x, period) ((int) ((((unsigned int) x) * US_RX_CLOCK) / (period)) - 1) // Time in uS, sample period in us_receiver clock cycles
 
 const unsigned char usSensorMap[] = US_SENSOR_MAP; // Sensor position to address map
+const signed short usSensorPos[US_SENSOR_COUNT][2] = US_SENSOR_POSITIONS; // Transducer positions relative to robot centre, x right, y forward (tenths of mm)
 
 unsigned char usSensorIndex = 0; // Next sensor to scan
 unsigned short usSampleIndex = 0; // Sample index, incremented once per ADC conversion, representative of ToF
-unsigned short usWaveformData[US_SENSOR_COUNT][US_RX_COUNT]; // Raw waveform data - stored as ADC results
-signed short usRangeReadings[US_SENSOR_COUNT]; // Latest range readings - stored as sample indexes
+us_profile usProfiles[US_SENSOR_COUNT]; // Acquisition profile for each sensor
+unsigned short usWaveformPool[US_WAVEFORM_POOL] LMB_BSS; // Raw waveform storage, divided between sensors according to their profiles
+unsigned short *usWaveformData[US_SENSOR_COUNT]; // Raw waveform data - stored as ADC results
+signed short usRangeReadings[US_SENSOR_COUNT]; // Latest range readings - stored in mm
+signed short usRangeFine[US_SENSOR_COUNT]; // Latest range readings - stored in tenths of mm
+unsigned char usRangeConfidence[US_SENSOR_COUNT]; // Latest range confidence - 0 when nothing found
+unsigned char usRangeStreak[US_SENSOR_COUNT]; // Consecutive pings agreeing on range, up to CONF_STREAK_MAX
+us_health_table usHealth; // Channel fault counters
+us_track_table usTracks; // Filtered range for each sensor
+us_echo_table usEchoes; // All echoes found in latest ping
+unsigned char usRangingMode = US_RANGING_THRESHOLD; // Ranging algorithm
+
+signed short usMatchedRef[USDSP_REF_MAX]; // Matched filter reference burst
+unsigned int usMatchedCorr[US_RX_MAX] LMB_BSS; // Matched filter correlation output
+unsigned short usMagnitudePool[US_WAVEFORM_POOL] LMB_BSS; // Demodulated carrier magnitude storage, laid out as waveform storage
+unsigned short *usMagnitude[US_SENSOR_COUNT]; // Demodulated carrier magnitude
+unsigned short usEnvelopeThreshold[US_RX_MAX] LMB_BSS; // Envelope trigger level for each sample
+unsigned short usCfarThreshold[US_RX_MAX] LMB_BSS; // CFAR trigger level for each sample
+unsigned short usNoiseFloor[US_SENSOR_COUNT]; // Magnitude noise floor for each sensor, expressed in sixteenths of ADC counts - 0 until first measured
+unsigned short usBias[US_SENSOR_COUNT]; // ADC bias of each sensor's channel, expressed in sixteenths of ADC counts - 0 until first measured
 
-unsigned short usTriggerChangeIndex = USTimeToSampleIndex(TRIGGER_NEAR_FAR_CHANGE); // Trigger changeover time
-unsigned short usTriggerNearUpper = USVoltageToTriggerLevel(TRIGGER_BASE + TRIGGER_OFFSET_NEAR); // Upper trigger level
-unsigned short usTriggerNearLower = USVoltageToTriggerLevel(TRIGGER_BASE - TRIGGER_OFFSET_NEAR); // Lower trigger level
-unsigned short usTriggerFarUpper = USVoltageToTriggerLevel(TRIGGER_BASE + TRIGGER_OFFSET_FAR); // Upper trigger level
-unsigned short usTriggerFarLower = USVoltageToTriggerLevel(TRIGGER_BASE - TRIGGER_OFFSET_FAR); // Lower trigger level
+unsigned short usTriggerChangeTime = TRIGGER_NEAR_FAR_CHANGE; // Time near trigger level is held before threshold curve starts falling (uS)
+unsigned short usTriggerCentre = USVoltageToTriggerLevel(TRIGGER_BASE); // Centre of trigger band
+unsigned short usTriggerNear = USVoltageToTriggerLevel(TRIGGER_BASE + TRIGGER_OFFSET_NEAR) - USVoltageToTriggerLevel(TRIGGER_BASE); // Trigger band half width close in
+unsigned short usTriggerFar = USVoltageToTriggerLevel(TRIGGER_BASE + TRIGGER_OFFSET_FAR) - USVoltageToTriggerLevel(TRIGGER_BASE); // Smallest trigger band half width
+unsigned char usTriggerAbsorption = TRIGGER_ABSORPTION; // Air absorption modelled by threshold curve (tenths of dB/m)
+unsigned char usThresholdPool[US_WAVEFORM_POOL] LMB_BSS; // Threshold curve storage, laid out as waveform storage
+unsigned char *usThresholdCurve[US_SENSOR_COUNT]; // Trigger band half width for each sample (ADC counts)
+unsigned char usThresholdUploaded[US_SENSOR_COUNT]; // Set when sensor's curve was uploaded rather than built from parameters
 
 signed short usTemperature = 210; // Temperature in degrees C, expressed in tenths
 
+signed short usRangeOffset[US_SENSOR_COUNT]; // Per sensor range calibration, expressed in tenths of mm
+signed short usRangeLUTPool[US_WAVEFORM_POOL + US_SENSOR_COUNT]; // Range table storage, laid out as waveform storage plus one entry per sensor
+signed short *usRangeLUT[US_SENSOR_COUNT]; // Range for each sample index, expressed in tenths of mm - extra entry allows interpolation of last sample
+signed short usRangeLUTTemperature = 0; // Temperature range table was built for
+unsigned char usRangeLUTValid = 0; // Range table needs rebuilding when cleared
+
+unsigned char usSchedWeight[US_SENSOR_COUNT]; // Scan rate multiplier for each sensor - 0 excludes sensor from scheduling
+u32 usSchedLastScan[US_SENSOR_COUNT]; // Time each sensor was last scheduled (ms)
+u32 usSchedDeadline[US_SENSOR_COUNT]; // Time each sensor is next due (ms)
+
+unsigned short usCrosstalk[US_SENSOR_COUNT][US_SENSOR_COUNT]; // Time after a ping (first index) during which another sensor (second index) can still hear it (uS)
+signed char usLastFired = -1; // Sensor that fired most recently, -1 before first ping
+unsigned int usLastElapsed = 0; // Time from last ping to end of its capture (uS)
+unsigned char usCrosstalkExposed[US_SENSOR_COUNT]; // Set when latest ping fired while previous ping could still be heard
+unsigned char usDither[US_SENSOR_COUNT]; // Listen time before latest ping (samples)
+u32 usDitherSeed = 0x2545F491; // Dither random number generator state
+signed short usGhostCheck[US_SENSOR_COUNT][2]; // Unfiltered range from previous monostatic and bistatic ping, used to confirm echoes heard with crosstalk about (tenths of mm)
+
+signed char usPairRx[US_SENSOR_COUNT]; // Sensor listening for alternate pings of each sensor, -1 for monostatic only
+unsigned char usPairPhase[US_SENSOR_COUNT]; // Set when next ping of sensor is bistatic
+unsigned char usCaptureRx[US_SENSOR_COUNT]; // Sensor that received latest capture
+signed short usBistaticFine[US_SENSOR_COUNT]; // Latest bistatic readings, half path length from transmitter to receiver - stored in tenths of mm
+
+u32 usStackPool[US_WAVEFORM_POOL]; // Stacking accumulator storage, laid out as waveform storage
+u32 *usStack[US_SENSOR_COUNT]; // Sum of captures stacked so far for each sample
+unsigned char usStackEnabled = 0; // Stack captures before detection
+unsigned char usStackShift[US_SENSOR_COUNT][STACK_BANDS]; // Captures stacked in each range band, expressed as power of 2
+unsigned char usStackMinShift = 0; // Fewest captures adaptive stacking may use, expressed as power of 2
+unsigned char usStackMaxShift = STACK_MAX_SHIFT; // Most captures adaptive stacking may use, expressed as power of 2
+unsigned char usStackCount[US_SENSOR_COUNT][STACK_BANDS]; // Captures accumulated so far in each range band
+unsigned char usStackFresh[US_SENSOR_COUNT][STACK_BANDS]; // Set when range band was refreshed by latest capture
+unsigned char usStackHistory[US_SENSOR_COUNT][STACK_BANDS]; // Detection in each refresh of range band, newest in bit 0
+unsigned char usStackUpdates[US_SENSOR_COUNT][STACK_BANDS]; // Refreshes recorded in history since stack depth last changed
+
+signed short usBaselinePool[US_WAVEFORM_POOL] LMB_BSS; // Baseline storage, laid out as waveform storage
+signed short *usBaseline[US_SENSOR_COUNT]; // Ringdown and chassis reflections for each sample, deviation from bias expressed in sixteenths of ADC counts
+unsigned char usBaselineEnabled = 1; // Subtract baseline before detection
+unsigned char usBaselineTracking = 0; // Allow baseline to follow slow changes, only safe while moving so obstacles don't get learnt
+unsigned char usBaselineCount[US_SENSOR_COUNT]; // Captures learnt into baseline, learning is complete at BASELINE_LEARN_PINGS
+
+unsigned short usStreamRange = 0; // Streaming acquisition stops once an echo is found within this range (mm) - 0 when disabled
+unsigned short usCaptureLength[US_SENSOR_COUNT]; // Samples actually captured in latest ranging operation
+unsigned short usCaptureFresh[US_SENSOR_COUNT][2]; // First sample and one past last sample holding new data, stacked bands still accumulating keep their previous average
+unsigned char usCaptureStage[US_SENSOR_COUNT]; // US_STAGE reached by latest capture
+us_capture_handler usCaptureHandler = NULL; // Called after each capture, lets urgent sensors be ranged mid scan
+
+us_scan_result usResults[US_RESULT_BUFFERS]; // Published scans, swapped between so a reader never sees one half rewritten
+signed char usResultLatest = -1; // Most recently published result, -1 before first
+signed char usResultHeld = -1; // Result a reader is still using, -1 when none
+
+unsigned char usAcqState = US_ACQ_IDLE; // Acquisition engine state
+u8 usAcqOrder[US_SENSOR_COUNT]; // Sensors in current scan, in firing order
+u8 usAcqCount = 0; // Sensors in current scan
+u8 usAcqPing = 0; // Position in firing order of current ping
+u8 usAcqSensor = 0; // Sensor firing current ping
+u8 usAcqRx = 0; // Sensor receiving current ping
+u8 usAcqStacking = 0; // Current capture is being stacked
+int usAcqSample = 0; // Samples received so far in current state
+int usAcqRxCount = 0; // Samples requested for current capture
+int usAcqStreamLimit = -1; // Last sample index an echo may start at for streaming to stop early, -1 when not streaming
+int usAcqStreamBlank = 0; // Samples ignored by streaming while transducer rings down
+int usAcqStreamSum = 0; // Running demodulator sum
+int usAcqStreamRun = 0; // Consecutive samples above trigger
+int usAcqListenSum = 0; // Running demodulator sum while listening before ping
+unsigned short usAcqListenHistory[1 << USDSP_ENV_SHIFT] LMB_BSS; // Samples within demodulator window while listening
+u32 usScanSequence = 0; // Scans completed
+unsigned char usPending = 0; // US_PENDING settings changed mid scan, applied once acquisition is idle
+us_profile usProfilesPending[US_SENSOR_COUNT]; // Profiles to acquire with from next scan
+signed char usPairPending[US_SENSOR_COUNT]; // Pairing to acquire with from next scan
+unsigned char usStackPending = 0; // Stacking to acquire with from next scan
+unsigned char usStackMinPending = 0; // Stacking limits to acquire with from next scan
+unsigned char usStackMaxPending = STACK_MAX_SHIFT;
+
+
+static int usarray_layout_buffers(const us_profile *profiles) {
+	int iSensor;
+	int offset = 0;
+
+	// Check everything fits before touching anything
+	for(iSensor = 0; iSensor < US_SENSOR_COUNT; iSensor++) offset += profiles[iSensor].rxCount;
+	if(offset > US_WAVEFORM_POOL) return XST_FAILURE;
+
+	// Pack sensors back to back, range tables need one extra entry each
+	offset = 0;
+	for(iSensor = 0; iSensor < US_SENSOR_COUNT; iSensor++) {
+		usWaveformData[iSensor] = &usWaveformPool[offset];
+		usStack[iSensor] = &usStackPool[offset];
+		usBaseline[iSensor] = &usBaselinePool[offset];
+		usThresholdCurve[iSensor] = &usThresholdPool[offset];
+		usMagnitude[iSensor] = &usMagnitudePool[offset];
+		usRangeLUT[iSensor] = &usRangeLUTPool[offset + iSensor];
+		offset += profiles[iSensor].rxCount;
+	}
+
+	return XST_SUCCESS;
+}
+
+static int usarray_time_to_index(u8 sensorNum, unsigned short time) {
+	// Convert time in uS to sample index for sensor's sample period
+	int index = USTimeToProfileIndex(time, usProfiles[sensorNum].rxPeriod);
+	return (index < 0) ? 0 : index;
+}
+
+static u8 usarray_quadrature(u8 sensorNum) {
+	// Odd number of quarter carrier cycles between samples gives in-phase and quadrature samples, otherwise carrier alternates sign
+	return ((usProfiles[sensorNum].rxPeriod / (US_RX_PERIOD / 2)) & 1);
+}
+
+static int usarray_burst_length(u8 sensorNum) {
+	// Samples spanned by transmitted burst
+	return (usProfiles[sensorNum].txCount * ((US_RX_CLOCK * 1000000) / USDSP_CARRIER_FREQ)) / usProfiles[sensorNum].rxPeriod;
+}
+
+static void usarray_reset_stack(u8 sensorNum) {
+	int i;
+
+	// Empty accumulators and start every band again from fewest captures allowed
+	for(i = 0; i < usProfiles[sensorNum].rxCount; i++) usStack[sensorNum][i] = 0;
+	for(i = 0; i < STACK_BANDS; i++) {
+		usStackShift[sensorNum][i] = usStackMinShift;
+		usStackCount[sensorNum][i] = 0;
+		usStackFresh[sensorNum][i] = 0;
+		usStackHistory[sensorNum][i] = 0;
+		usStackUpdates[sensorNum][i] = 0;
+	}
+}
+
+static int usarray_stack_split(u8 sensorNum) {
+	// Bands split where threshold ranging changes from near to far triggers
+	int split = usarray_time_to_index(sensorNum, usTriggerChangeTime) + 1;
+	return (split > usProfiles[sensorNum].rxCount) ? usProfiles[sensorNum].rxCount : split;
+}
+
+static void usarray_reset_baseline(u8 sensorNum) {
+	int i;
+
+	// Forget baseline, next captures are learnt from scratch
+	for(i = 0; i < usProfiles[sensorNum].rxCount; i++) usBaseline[sensorNum][i] = 0;
+	usBaselineCount[sensorNum] = 0;
+}
+
+static void usarray_build_curve(u8 sensorNum) {
+	// Attenuation of 0 - 5dB, applied on top of whole halvings (6dB), expressed in Q16
+	static const unsigned int dbToGain[6] = {65536, 58409, 52057, 46396, 41350, 36854};
+	unsigned int time;
+	unsigned int loss;
+	unsigned int level;
+	int iSample;
+
+	for(iSample = 0; iSample < usProfiles[sensorNum].rxCount; iSample++) {
+		time = ((iSample + 1) * usProfiles[sensorNum].rxPeriod) / US_RX_CLOCK;
+
+		if(time <= usTriggerChangeTime) {
+			// Ringdown and nearby echoes, hold near level
+			level = usTriggerNear;
+		} else {
+			// Echo from a small target spreads out on the way there and on the way back
+			level = (((usTriggerNear * usTriggerChangeTime) / time) * usTriggerChangeTime) / time;
+
+			// Absorption over extra path travelled, roughly 343mm per mS at room temperature (tenths of dB)
+			loss = (usTriggerAbsorption * (((time - usTriggerChangeTime) * 343) / 1000)) / 1000;
+			level = ((level >> (loss / 60)) * dbToGain[(loss / 10) % 6]) >> 16;
+
+			// Never drop below far level
+			if(level < usTriggerFar) level = usTriggerFar;
+		}
+
+		// Pack into a byte per sample
+		usThresholdCurve[sensorNum][iSample] = (level > 0xFF) ? 0xFF : level;
+	}
+}
+
+static void usarray_build_curves() {
+	int iSensor;
+
+	// Rebuild curves from parameters, uploaded curves are left alone
+	for(iSensor = 0; iSensor < US_SENSOR_COUNT; iSensor++) {
+		if(!usThresholdUploaded[iSensor]) usarray_build_curve(iSensor);
+	}
+}
+
+static void usarray_check_health(u8 sensorNum) {
+	const unsigned short *samples = usWaveformData[sensorNum];
+	int count = usCaptureLength[sensorNum];
+	int blank = usarray_time_to_index(sensorNum, MATCHED_BLANK_TIME);
+	unsigned short low = 0xFFFF;
+	unsigned short high = 0;
+	unsigned short ringLow = 0xFFFF;
+	unsigned short ringHigh = 0;
+	unsigned char saturated = 0;
+	unsigned char faults = US_HEALTH_OK;
+	int i;
+
+	if(blank > count) blank = count;
+
+	// Ringdown swing
+	for(i = 0; i < blank; i++) {
+		if(samples[i] < ringLow) ringLow = samples[i];
+		if(samples[i] > ringHigh) ringHigh = samples[i];
+	}
+
+	// Whole capture swing, and any sample pinned at an ADC rail once ringdown is over
+	low = ringLow;
+	high = ringHigh;
+	for(; i < count; i++) {
+		if(samples[i] < low) low = samples[i];
+		if(samples[i] > high) high = samples[i];
+		if(samples[i] == 0 || samples[i] == (1 << USADCPrecision) - 1) saturated = 1;
+	}
+
+	// Classify capture
+	if(high <= low + HEALTH_STUCK_SPAN) {
+		faults |= US_HEALTH_STUCK;
+	} else if(ringHigh < ringLow + HEALTH_RINGDOWN_MIN) {
+		faults |= US_HEALTH_DEAD;
+	}
+	if(saturated) faults |= US_HEALTH_SATURATED;
+
+	// Update counters, saturating rather than wrapping
+	usHealth.status[sensorNum] = faults;
+	if(usHealth.captures[sensorNum] < 0xFFFF) usHealth.captures[sensorNum]++;
+	if((faults & US_HEALTH_STUCK) && usHealth.stuck[sensorNum] < 0xFFFF) usHealth.stuck[sensorNum]++;
+	if((faults & US_HEALTH_DEAD) && usHealth.dead[sensorNum] < 0xFFFF) usHealth.dead[sensorNum]++;
+	if((faults & US_HEALTH_SATURATED) && usHealth.saturated[sensorNum] < 0xFFFF) usHealth.saturated[sensorNum]++;
+}
+
+static unsigned short usarray_bias(u8 sensorNum) {
+	// Centre of trigger band is nominal bias until channel has been measured
+	if(usBias[sensorNum] == 0) return usTriggerCentre;
+	return (usBias[sensorNum] + 8) >> 4;
+}
+
+static void usarray_track_bias(u8 sensorNum) {
+	int rxCount = usProfiles[sensorNum].rxCount;
+	int tailStart = rxCount - usarray_time_to_index(sensorNum, BIAS_TAIL_TIME) - 1;
+	unsigned short *bias = &usBias[usCaptureRx[sensorNum]];
+	unsigned int tailMean = 0;
+	int i;
+
+	// Aborted capture has no tail, and a stale stacked tail has been measured already
+	if(usCaptureLength[sensorNum] < rxCount || tailStart < 0 || usCaptureFresh[sensorNum][0] > tailStart || usCaptureFresh[sensorNum][1] < rxCount) return;
+
+	// End of capture is long past ringdown and any echo there is weak, so its carrier averages out
+	for(i = tailStart; i < rxCount; i++) tailMean += usWaveformData[sensorNum][i];
+	tailMean = (tailMean << 4) / (rxCount - tailStart);
+	if(*bias == 0) *bias = tailMean;
+	else *bias += ((int) tailMean - (int) *bias) >> BIAS_SHIFT;
+}
+
+static unsigned char usarray_score_range(u8 sensorNum, u8 detector, int previous, int range) {
+	int score;
+	int amplitude;
+	int width;
+	int burst = usarray_burst_length(sensorNum);
+
+	// Agreement with previous ping
+	if(previous >= 0 && range - previous <= CONF_CONSISTENT_RANGE && previous - range <= CONF_CONSISTENT_RANGE) {
+		if(usRangeStreak[sensorNum] < CONF_STREAK_MAX) usRangeStreak[sensorNum]++;
+	} else {
+		usRangeStreak[sensorNum] = 0;
+	}
+	score = (usRangeStreak[sensorNum] * CONF_WEIGHT) / CONF_STREAK_MAX;
+
+	// Peak height, detector confidence is 16 at threshold
+	amplitude = ((detector - 16) * CONF_WEIGHT) / (CONF_STRONG - 16);
+	score += (amplitude < 0) ? 0 : (amplitude > CONF_WEIGHT) ? CONF_WEIGHT : amplitude;
+
+	// Echo duration against transmitted burst, single sample blips score next to nothing
+	width = (burst > 0) ? (usEchoes.width[sensorNum][0] * CONF_WEIGHT) / burst : CONF_WEIGHT;
+	score += (width > CONF_WEIGHT) ? CONF_WEIGHT : width;
+
+	return (score > 255) ? 255 : score;
+}
+
+static void usarray_build_range_lut() {
+	int iSample;
+	int iSensor;
+	int range;
+
+	// Compute speed of sound based on temperature
+	unsigned int speedOfSound = (3313000 + 606 * usTemperature) / 10000; //mm/uS expressed in thousandths
+
+	for(iSensor = 0; iSensor < US_SENSOR_COUNT; iSensor++) {
+		for(iSample = 0; iSample <= usProfiles[iSensor].rxCount; iSample++) {
+			// Time (hundredths of uS) by speed of sound (thousandths of mm/uS) gives hundred thousandths of mm, halve for one way distance and convert to tenths of mm
+			range = ((iSample + 1) * usProfiles[iSensor].rxPeriod * speedOfSound) / 20000;
+
+			// Apply calibration, limiting to what fits in table
+			range += usRangeOffset[iSensor];
+			usRangeLUT[iSensor][iSample] = (range > 0x7FFF) ? 0x7FFF : range;
+		}
+	}
+
+	usRangeLUTTemperature = usTemperature;
+	usRangeLUTValid = 1;
+}
+
+static signed short usarray_index_to_range(u8 sensorNum, int indexQ8) {
+	const signed short *lut = &usRangeLUT[sensorNum][indexQ8 >> 8];
+	int frac = indexQ8 & 0xFF;
+
+	// Whole sample indexes come straight from table, interpolate between entries otherwise
+	if(frac == 0) return lut[0];
+	return lut[0] + (((lut[1] - lut[0]) * frac) >> 8);
+}
+
+static int usarray_range_to_index(u8 sensorNum, u16 range) {
+	const signed short *lut = usRangeLUT[sensorNum];
+	int low = 0;
+	int high = usProfiles[sensorNum].rxCount;
+	int mid;
+
+	// Table increases with index, binary search for first sample at or beyond range
+	while(low < high) {
+		mid = (low + high) >> 1;
+		if(lut[mid] < ((int) range) * 10) low = mid + 1;
+		else high = mid;
+	}
+
+	return low;
+}
+
+static void usarray_apply_baseline(u8 sensorNum) {
+	int start = usCaptureFresh[sensorNum][0];
+	int count = usarray_time_to_index(sensorNum, BASELINE_TIME) + 1;
+	int echoStart;
+	int echoEnd;
+	int burst;
+	int shift;
+	unsigned short bias;
+
+	// Only new samples - stale stacked bands have already had baseline removed
+	if(count > usCaptureFresh[sensorNum][1]) count = usCaptureFresh[sensorNum][1];
+	if(start >= count) return;
+
+	// Learn quickly to begin with, roughly a running mean of captures so far, then only follow slow changes
+	if(usBaselineCount[sensorNum] < BASELINE_LEARN_PINGS || usBaselineTracking) {
+		echoStart = count;
+		echoEnd = count;
+		if(usBaselineCount[sensorNum] < BASELINE_LEARN_PINGS) {
+			for(shift = 0; (2 << shift) <= usBaselineCount[sensorNum] + 1; shift++);
+			usBaselineCount[sensorNum]++;
+		} else {
+			shift = BASELINE_SHIFT;
+
+			// Obstacle keeping pace with us stays at the same range, leave out samples around previous ping's echo so it isn't learnt as chassis
+			if(usRangeFine[sensorNum] >= 0) {
+				burst = usarray_burst_length(sensorNum);
+				echoStart = usarray_range_to_index(sensorNum, usRangeFine[sensorNum] / 10) - burst;
+				echoEnd = echoStart + BASELINE_ECHO_BURSTS * burst;
+				if(echoStart < start) echoStart = start;
+				if(echoStart > count) echoStart = count;
+				if(echoEnd < echoStart) echoEnd = echoStart;
+				if(echoEnd > count) echoEnd = count;
+			}
+		}
+
+		// Deviation is measured from channel's bias, learnt at end of capture where ringdown and echoes can't pull it about
+		bias = usarray_bias(sensorNum);
+		usdsp_baseline_update(&usWaveformData[sensorNum][start], echoStart - start, bias, &usBaseline[sensorNum][start], shift);
+		if(echoEnd < count) usdsp_baseline_update(&usWaveformData[sensorNum][echoEnd], count - echoEnd, bias, &usBaseline[sensorNum][echoEnd], shift);
+	}
+
+	usdsp_baseline_subtract(&usWaveformData[sensorNum][start], count - start, &usBaseline[sensorNum][start]);
+}
+
+static int usarray_separation(u8 a, u8 b) {
+	// Sensor positions run round the array in order, so separation is steps round the ring
+	int steps = (a > b) ? a - b : b - a;
+	return (steps > US_SENSOR_COUNT / 2) ? US_SENSOR_COUNT - steps : steps;
+}
 
 int init_usarray() {
 	// Reset all ranges
 	int i;
-	for(i = 0; i < US_SENSOR_COUNT; i++) usRangeReadings[i] = -1;
+	int j;
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		usRangeReadings[i] = -1;
+		usRangeFine[i] = -1;
+		usRangeConfidence[i] = 0;
+		usRangeStreak[i] = 0;
+		usEchoes.count[i] = 0;
+		usNoiseFloor[i] = 0;
+		usBias[i] = 0;
+		usRangeOffset[i] = RANGE_OFFSET_DEFAULT;
+		usCaptureLength[i] = 0;
+		usCaptureStage[i] = US_STAGE_IDLE;
+
+		usCrosstalkExposed[i] = 0;
+		usDither[i] = 0;
+		usGhostCheck[i][0] = -1;
+		usGhostCheck[i][1] = -1;
+		usPairRx[i] = -1;
+		usPairPending[i] = -1;
+		usPairPhase[i] = 0;
+		usCaptureRx[i] = i;
+		usBistaticFine[i] = -1;
+
+		// Default crosstalk model - a ping is heard for longer the closer the listening sensor is
+		for(j = 0; j < US_SENSOR_COUNT; j++) {
+			usCrosstalk[i][j] = (usarray_separation(i, j) > CROSSTALK_REACH) ? 0 : CROSSTALK_TIME >> usarray_separation(i, j);
+		}
+
+		// Every sensor starts due for a scan at base rate
+		usSchedWeight[i] = 1;
+		usSchedLastScan[i] = 0;
+		usSchedDeadline[i] = 0;
+
+		// Every sensor starts with default acquisition profile
+		usProfiles[i].rxCount = US_RX_COUNT;
+		usProfiles[i].rxPeriod = US_RX_PERIOD;
+		usProfiles[i].txCount = US_TX_COUNT;
+		usProfilesPending[i] = usProfiles[i];
+	}
+	usPending = 0;
+	usStackPending = usStackEnabled;
+	usStackMinPending = usStackMinShift;
+	usStackMaxPending = usStackMaxShift;
+	usarray_layout_buffers(usProfiles);
+	usarray_build_range_lut();
+	usarray_reset_health();
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		usTracks.range[i] = -1;
+		usTracks.rate[i] = 0;
+		usTracks.ttc[i] = 0xFFFF;
+		usTracks.misses[i] = 0;
+		usTracks.candidate[i] = -1;
+		usTracks.time[i] = 0;
+	}
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		usarray_reset_stack(i);
+		usarray_reset_baseline(i);
+		usThresholdUploaded[i] = 0;
+	}
+	usarray_build_curves();
+
+	// Envelope ranging uses same trigger level throughout capture
+	for(i = 0; i < US_RX_MAX; i++) usEnvelopeThreshold[i] = USVoltageToTriggerLevel(ENVELOPE_TRIGGER);
 
 	// Setup ADC by writing to setup register (0x64)
 	// Set to use internal clock for sampling and conversions, use external single ended reference
@@ -56,12 +516,287 @@ unsigned char usarray_get_sensor() {
 }
 
 void usarray_set_triggers(unsigned short changever, unsigned short nearLower, unsigned short nearUpper, unsigned short farLower, unsigned short farUpper) {
-	// Update trigger levels
-	usTriggerChangeIndex = USTimeToSampleIndex(changever);
-	usTriggerNearLower = USVoltageToTriggerLevel(nearLower);
-	usTriggerNearUpper = USVoltageToTriggerLevel(nearUpper);
-	usTriggerFarUpper = USVoltageToTriggerLevel(farLower);
-	usTriggerFarLower = USVoltageToTriggerLevel(farUpper);
+	// Update trigger levels, band centres on near levels
+	usTriggerChangeTime = changever;
+	usTriggerCentre = (USVoltageToTriggerLevel(nearUpper) + USVoltageToTriggerLevel(nearLower)) >> 1;
+	usTriggerNear = (nearUpper > nearLower) ? (USVoltageToTriggerLevel(nearUpper) - USVoltageToTriggerLevel(nearLower)) >> 1 : (USVoltageToTriggerLevel(nearLower) - USVoltageToTriggerLevel(nearUpper)) >> 1;
+	usTriggerFar = (farUpper > farLower) ? (USVoltageToTriggerLevel(farUpper) - USVoltageToTriggerLevel(farLower)) >> 1 : (USVoltageToTriggerLevel(farLower) - USVoltageToTriggerLevel(farUpper)) >> 1;
+
+	// Explicit levels replace any uploaded curves
+	usarray_set_curve(usTriggerAbsorption);
+}
+
+void usarray_set_curve(u8 absorption) {
+	int i;
+
+	// Rebuild every sensor's curve
+	usTriggerAbsorption = absorption;
+	for(i = 0; i < US_SENSOR_COUNT; i++) usThresholdUploaded[i] = 0;
+	usarray_build_curves();
+}
+
+int usarray_upload_curve(u8 sensor, u16 start, const u8 *levels, u16 count) {
+	int i;
+
+	// Check section fits sensor's curve
+	if(sensor >= US_SENSOR_COUNT || start + count > usProfiles[sensor].rxCount) return XST_FAILURE;
+
+	// Copy section, curve is kept until parameters or profile change
+	for(i = 0; i < count; i++) usThresholdCurve[sensor][start + i] = levels[i];
+	usThresholdUploaded[sensor] = 1;
+
+	return XST_SUCCESS;
+}
+
+void usarray_set_ranging(unsigned char mode) {
+	// Select ranging algorithm
+	usRangingMode = mode;
+}
+
+unsigned char usarray_get_ranging() {
+	// Return ranging algorithm
+	return usRangingMode;
+}
+
+void usarray_set_offset(u8 sensor, s16 offset) {
+	if(sensor >= US_SENSOR_COUNT) return;
+
+	// Update calibration, range table picks it up on next update
+	usRangeOffset[sensor] = offset;
+	usRangeLUTValid = 0;
+}
+
+s16 usarray_get_offset(u8 sensor) {
+	// Return calibration
+	return (sensor < US_SENSOR_COUNT) ? usRangeOffset[sensor] : 0;
+}
+
+static void usarray_apply_pending() {
+	int i;
+
+	// Waveforms have moved so previous results are meaningless, including a scan just finished
+	if(usPending & US_PENDING_PROFILE) {
+		for(i = 0; i < US_SENSOR_COUNT; i++) usProfiles[i] = usProfilesPending[i];
+		usarray_layout_buffers(usProfiles);
+		for(i = 0; i < US_SENSOR_COUNT; i++) {
+			usRangeReadings[i] = -1;
+			usRangeFine[i] = -1;
+			usRangeConfidence[i] = 0;
+			usRangeStreak[i] = 0;
+			usEchoes.count[i] = 0;
+			usCaptureLength[i] = 0;
+			usCaptureStage[i] = US_STAGE_IDLE;
+			usarray_reset_stack(i);
+			usarray_reset_baseline(i);
+			usThresholdUploaded[i] = 0;
+		}
+		usarray_build_curves();
+		usRangeLUTValid = 0;
+	}
+
+	// Changed pairs start again from a monostatic ping
+	if(usPending & US_PENDING_PAIR) {
+		for(i = 0; i < US_SENSOR_COUNT; i++) {
+			if(usPairPending[i] == usPairRx[i]) continue;
+			usPairRx[i] = usPairPending[i];
+			usPairPhase[i] = 0;
+			usBistaticFine[i] = -1;
+			usGhostCheck[i][1] = -1;
+		}
+	}
+
+	// Start stacking afresh
+	if(usPending & US_PENDING_STACKING) {
+		usStackEnabled = usStackPending;
+		usStackMinShift = usStackMinPending;
+		usStackMaxShift = usStackMaxPending;
+		for(i = 0; i < US_SENSOR_COUNT; i++) usarray_reset_stack(i);
+	}
+
+	usPending = 0;
+}
+
+int usarray_set_profile(u8 sensor, u16 rxCount, u16 rxPeriod, u16 txCount) {
+	int total = 0;
+	int i;
+
+	// Check profile is something hardware can do - period must be a whole number of quarter carrier cycles, and not a whole number of carrier cycles
+	// or every sample would land on the same phase, leaving an odd multiple of default (carrier alternates sign) or an odd number of quarters (quadrature)
+	if(sensor >= US_SENSOR_COUNT) return XST_FAILURE;
+	if(rxCount == 0 || rxCount > US_RX_MAX) return XST_FAILURE;
+	if(rxPeriod == 0 || rxPeriod > 0xFFF || rxPeriod % (US_RX_PERIOD / 2) != 0 || ((rxPeriod / (US_RX_PERIOD / 2)) & 3) == 0) return XST_FAILURE;
+	if(txCount == 0 || txCount > 0xFFF) return XST_FAILURE;
+
+	// Check new layout fits alongside other sensors, including changes still waiting
+	for(i = 0; i < US_SENSOR_COUNT; i++) total += (i == sensor) ? rxCount : usProfilesPending[i].rxCount;
+	if(total > US_WAVEFORM_POOL) return XST_FAILURE;
+
+	// Buffers can't move underneath a running scan, so change waits for acquisition to go idle
+	usProfilesPending[sensor].rxCount = rxCount;
+	usProfilesPending[sensor].rxPeriod = rxPeriod;
+	usProfilesPending[sensor].txCount = txCount;
+	usPending |= US_PENDING_PROFILE;
+	if(usAcqState == US_ACQ_IDLE) usarray_apply_pending();
+
+	return XST_SUCCESS;
+}
+
+const us_profile* usarray_get_profile(u8 sensor) {
+	// Return profile, including a change waiting for scan to finish
+	return (sensor < US_SENSOR_COUNT) ? &usProfilesPending[sensor] : 0;
+}
+
+static u32 usarray_sched_interval(u8 sensorNum) {
+	// Interval shrinks with weight, and again while something is close
+	u32 interval = SCHED_BASE_INTERVAL / usSchedWeight[sensorNum];
+	if(usRangeReadings[sensorNum] >= 0 && usRangeReadings[sensorNum] < SCHED_NEAR_RANGE) interval >>= 1;
+
+	return interval;
+}
+
+void usarray_set_weight(u8 sensor, u8 weight) {
+	if(sensor >= US_SENSOR_COUNT) return;
+
+	// Set weight
+	usSchedWeight[sensor] = weight;
+
+	// Raising weight pulls deadline in, rather than waiting out the old interval
+	if(weight > 0 && (s32) (usSchedLastScan[sensor] + usarray_sched_interval(sensor) - usSchedDeadline[sensor]) < 0) {
+		usSchedDeadline[sensor] = usSchedLastScan[sensor] + usarray_sched_interval(sensor);
+	}
+}
+
+u8 usarray_get_weight(u8 sensor) {
+	// Return weight
+	return (sensor < US_SENSOR_COUNT) ? usSchedWeight[sensor] : 0;
+}
+
+u8 usarray_schedule(u32 now, u8 sensors[], u8 maxSensors) {
+	u16 chosen = 0; // Bit mask of sensors already picked
+	u8 numSensors = 0;
+	int best;
+	int i;
+
+	// Earliest deadline first - array is kept busy, so under load each sensor's share of pings follows its weight
+	while(numSensors < maxSensors) {
+		best = -1;
+		for(i = 0; i < US_SENSOR_COUNT; i++) {
+			if(usSchedWeight[i] == 0 || (chosen & (1 << i))) continue;
+
+			// Ties go to whichever sensor has gone longest without a scan
+			if(best < 0 || (s32) (usSchedDeadline[i] - usSchedDeadline[best]) < 0
+					|| (usSchedDeadline[i] == usSchedDeadline[best] && (s32) (usSchedLastScan[i] - usSchedLastScan[best]) < 0)) {
+				best = i;
+			}
+		}
+		if(best < 0) break;
+
+		// Book sensor's next deadline
+		chosen |= 1 << best;
+		usSchedLastScan[best] = now;
+		usSchedDeadline[best] = now + usarray_sched_interval(best);
+		sensors[numSensors++] = best;
+	}
+
+	return numSensors;
+}
+
+u32 usarray_staleness(u8 sensor, u32 now) {
+	// Time since sensor was last scanned
+	return (sensor < US_SENSOR_COUNT) ? now - usSchedLastScan[sensor] : 0;
+}
+
+void usarray_set_crosstalk(u8 from, u8 to, u16 time) {
+	// Set time
+	if(from < US_SENSOR_COUNT && to < US_SENSOR_COUNT) usCrosstalk[from][to] = time;
+}
+
+u16 usarray_get_crosstalk(u8 from, u8 to) {
+	// Return time
+	return (from < US_SENSOR_COUNT && to < US_SENSOR_COUNT) ? usCrosstalk[from][to] : 0;
+}
+
+int usarray_set_pair(u8 tx, u8 rx) {
+	if(tx >= US_SENSOR_COUNT) return XST_FAILURE;
+
+	// Anything out of range or listening to itself returns sensor to monostatic only
+	if(rx >= US_SENSOR_COUNT || rx == tx) {
+		usPairPending[tx] = -1;
+	} else {
+		usPairPending[tx] = rx;
+	}
+
+	// Pings of a running scan are already ordered around current pairing, so change waits for acquisition to go idle
+	usPending |= US_PENDING_PAIR;
+	if(usAcqState == US_ACQ_IDLE) usarray_apply_pending();
+
+	return XST_SUCCESS;
+}
+
+s8 usarray_get_pair(u8 tx) {
+	// Return listening sensor, including a change waiting for scan to finish
+	return (tx < US_SENSOR_COUNT) ? usPairPending[tx] : -1;
+}
+
+void usarray_set_stacking(u8 enable) {
+	// Captures of a running scan may be part way into stacks, so change waits for acquisition to go idle
+	usStackPending = enable;
+	usPending |= US_PENDING_STACKING;
+	if(usAcqState == US_ACQ_IDLE) usarray_apply_pending();
+}
+
+u8 usarray_get_stacking() {
+	// Return stacking status, including a change waiting for scan to finish
+	return usStackPending;
+}
+
+int usarray_set_stack_limits(u8 minShift, u8 maxShift) {
+	if(minShift > maxShift || maxShift > STACK_MAX_SHIFT) return XST_FAILURE;
+
+	// Stacks are restarted at new depth, so like enabling stacking this waits for acquisition to go idle
+	usStackMinPending = minShift;
+	usStackMaxPending = maxShift;
+	usPending |= US_PENDING_STACKING;
+	if(usAcqState == US_ACQ_IDLE) usarray_apply_pending();
+
+	return XST_SUCCESS;
+}
+
+u8 usarray_stack_depth(u8 sensor, u8 band) {
+	// Captures stacked in band
+	return (sensor < US_SENSOR_COUNT && band < STACK_BANDS) ? 1 << usStackShift[sensor][band] : 0;
+}
+
+void usarray_set_baseline(u8 enable) {
+	// Set baseline subtraction
+	usBaselineEnabled = enable;
+}
+
+u8 usarray_get_baseline() {
+	// Return baseline subtraction status
+	return usBaselineEnabled;
+}
+
+void usarray_learn_baseline() {
+	int i;
+
+	// Relearn every sensor, robot should be stationary with nothing close by
+	for(i = 0; i < US_SENSOR_COUNT; i++) usarray_reset_baseline(i);
+}
+
+void usarray_set_baseline_tracking(u8 enable) {
+	// Set tracking
+	usBaselineTracking = enable;
+}
+
+void usarray_set_stream_range(u16 range) {
+	// Update streaming range, 0 disables
+	usStreamRange = range;
+}
+
+u16 usarray_get_stream_range() {
+	// Return streaming range
+	return usStreamRange;
 }
 
 short usarray_get_temperature() {
@@ -83,85 +818,874 @@ void usarray_measure_temp() {
 	usTemperature = (((int) adcTempResult) * 125 * 10) / 1000;
 }
 
-void usarray_scan(u8 sensors[], u8 numSensors) {
-	if (numSensors == 0 || numSensors > US_SENSOR_COUNT)
-		return;
+static void usarray_order_sensors(const u8 sensors[], u8 numSensors, u8 order[]) {
+	u16 used = 0; // Bit mask of list entries already placed
+	int last = usLastFired;
+	int best;
+	int i;
+	int n;
+
+	// Greedily follow each ping with the sensor least able to hear it, then the one furthest round the array
+	for(n = 0; n < numSensors; n++) {
+		best = -1;
+		for(i = 0; i < numSensors; i++) {
+			if(used & (1 << i)) continue;
+			if(best < 0) {
+				best = i;
+				continue;
+			}
+			if(last < 0) continue;
+
+			// Ties keep caller's order
+			if(usCrosstalk[last][sensors[i]] < usCrosstalk[last][sensors[best]]
+					|| (usCrosstalk[last][sensors[i]] == usCrosstalk[last][sensors[best]] && usarray_separation(last, sensors[i]) > usarray_separation(last, sensors[best]))) {
+				best = i;
+			}
+		}
+
+		used |= 1 << best;
+		order[n] = sensors[best];
+		last = sensors[best];
+	}
+}
+
+static unsigned char usarray_next_dither(u8 sensorNum) {
+	// Xorshift, cheap enough to run every ping
+	usDitherSeed ^= usDitherSeed << 13;
+	usDitherSeed ^= usDitherSeed >> 17;
+	usDitherSeed ^= usDitherSeed << 5;
+
+	// Make sure dither moves far enough from last ping's that a ghost echo can't stay within GHOST_TOLERANCE
+	unsigned char dither = usDitherSeed & DITHER_MASK;
+	int step = dither - usDither[sensorNum];
+	if(step < DITHER_MIN_STEP && step > -DITHER_MIN_STEP) dither ^= (DITHER_MASK + 1) >> 1;
+
+	return dither;
+}
+
+static void usarray_listen_start(u8 sensorNum, int count) {
+	// Sample sensor before it fires, demodulating the same way as usdsp_demodulate
+	usAcqListenSum = 0;
+	sendUSSampleRequest(usSensorMap[sensorNum], count, US_RX_PERIOD);
+}
+
+static void usarray_listen_sample(int sample, u32 adcResult) {
+	// Window is even so sample leaving the sum has same sign as the one entering
+	int delta = adcResult - ((sample >= (1 << USDSP_ENV_SHIFT)) ? usAcqListenHistory[sample & ((1 << USDSP_ENV_SHIFT) - 1)] : 0);
+	if(sample & 1) usAcqListenSum -= delta; else usAcqListenSum += delta;
+	usAcqListenHistory[sample & ((1 << USDSP_ENV_SHIFT) - 1)] = adcResult;
+}
+
+static void usarray_listen_finish(u8 sensorNum, int count) {
+	int sum = usAcqListenSum;
+
+	// Too short to measure anything, only dithers timing
+	if(usLastFired < 0 || count < (1 << USDSP_ENV_SHIFT)) return;
+
+	// Learn how long previous ping rings on in this sensor - still hearing it means it lasts at least this long,
+	// silence means it had died away before listening started
+	unsigned int start = usLastElapsed;
+	unsigned int end = usLastElapsed + (count * US_RX_PERIOD) / US_RX_CLOCK;
+	unsigned short *crosstalk = &usCrosstalk[(u8) usLastFired][sensorNum];
+	if(((sum < 0) ? -sum : sum) >= (USVoltageToTriggerLevel(ENVELOPE_TRIGGER) << USDSP_ENV_SHIFT)) {
+		if(*crosstalk < end + CROSSTALK_MARGIN) *crosstalk = (end + CROSSTALK_MARGIN > 0xFFFF) ? 0xFFFF : end + CROSSTALK_MARGIN;
+	} else if(*crosstalk > start) {
+		*crosstalk -= (*crosstalk - start) >> CROSSTALK_DECAY_SHIFT;
+	}
+}
+
+static void usarray_fire() {
+	u8 sensorNum = usAcqSensor;
+
+	// Note whether previous ping can still be heard, ranges found in this capture then need confirming
+	usCrosstalkExposed[sensorNum] = (usLastFired >= 0 && usCrosstalk[(u8) usLastFired][usAcqRx] > usLastElapsed + (usDither[sensorNum] * US_RX_PERIOD) / US_RX_CLOCK);
+
+	// Generate ultrasound pulse
+	pulseGen_GeneratePulse(XPAR_AXI_PULSEGEN_US_BASEADDR, 1, usSensorMap[sensorNum], usProfiles[sensorNum].txCount);
+
+	// Start sampling
+	sendUSSampleRequest(usSensorMap[usAcqRx], usAcqRxCount, usProfiles[sensorNum].rxPeriod);
+
+	// Stacking needs captures of the same sensor and the full length, paired sensors alternate receivers so are left alone
+	usAcqStacking = usStackEnabled && usPairRx[sensorNum] < 0;
+
+	// Work out last sample an echo may start at and still be within streaming range, streaming demodulates the same way as usdsp_demodulate so needs an alternating profile
+	usAcqStreamLimit = (usStreamRange > 0 && !usAcqStacking && !usarray_quadrature(sensorNum)) ? usarray_range_to_index(sensorNum, usStreamRange) : -1;
+	usAcqStreamBlank = usarray_time_to_index(sensorNum, MATCHED_BLANK_TIME);
+	usAcqStreamSum = 0;
+	usAcqStreamRun = 0;
+
+	usAcqSample = 0;
+	usAcqState = US_ACQ_CAPTURE;
+}
+
+static void usarray_start_ping() {
+	u8 sensorNum = usAcqOrder[usAcqPing];
+	usAcqSensor = sensorNum;
+
+	// Paired sensors alternate between listening to their own ping and letting their partner listen
+	usAcqRx = sensorNum;
+	if(usPairRx[sensorNum] >= 0) {
+		if(usPairPhase[sensorNum]) usAcqRx = usPairRx[sensorNum];
+		usPairPhase[sensorNum] ^= 1;
+	}
+	usCaptureRx[sensorNum] = usAcqRx;
+	usAcqRxCount = usProfiles[sensorNum].rxCount;
+
+	// Listen for a random time before firing so echoes from previous ping land somewhere different each time
+	usDither[sensorNum] = usarray_next_dither(sensorNum);
+	if(usDither[sensorNum] > 0) {
+		usarray_listen_start(usAcqRx, usDither[sensorNum]);
+		usAcqSample = 0;
+		usAcqState = US_ACQ_LISTEN;
+	} else {
+		usarray_fire();
+	}
+}
+
+static u8 usarray_capture_sample(u32 adcResult) {
+	u8 sensorNum = usAcqSensor;
+	int sample = usAcqSample++;
+
+	// Stacking accumulates straight from FSL, waveform is only written once a band is complete
+	if(usAcqStacking) {
+		usStack[sensorNum][sample] += adcResult;
+		return usAcqSample >= usAcqRxCount;
+	}
+
+	usWaveformData[sensorNum][sample] = adcResult;
+
+	if(usAcqStreamLimit < 0) return usAcqSample >= usAcqRxCount;
+
+	// Streaming - demodulate as samples arrive, same as usdsp_demodulate
+	if(sample & 1) usAcqStreamSum -= adcResult; else usAcqStreamSum += adcResult;
+	if(sample >= (1 << USDSP_ENV_SHIFT)) {
+		if(sample & 1) usAcqStreamSum += usWaveformData[sensorNum][sample - (1 << USDSP_ENV_SHIFT)];
+		else usAcqStreamSum -= usWaveformData[sensorNum][sample - (1 << USDSP_ENV_SHIFT)];
+	}
+	if(sample < usAcqStreamBlank) return usAcqSample >= usAcqRxCount;
+
+	// Ringdown carries on well past blanking, so trigger follows threshold curve, which holds near level until ringdown is over
+	int level = usThresholdCurve[sensorNum][sample];
+	if(level < USVoltageToTriggerLevel(ENVELOPE_TRIGGER)) level = USVoltageToTriggerLevel(ENVELOPE_TRIGGER);
+
+	// Count samples above trigger, stopping once a confident echo has died away within range
+	if(((usAcqStreamSum < 0) ? -usAcqStreamSum : usAcqStreamSum) >= (level << USDSP_ENV_SHIFT)) {
+		usAcqStreamRun++;
+	} else if(usAcqStreamRun >= STREAM_MIN_SAMPLES && sample - usAcqStreamRun <= usAcqStreamLimit && sample + 1 < usAcqRxCount) {
+		// Keep samples already in flight until abort is acknowledged
+		sendUSAbort();
+		usAcqState = US_ACQ_DRAIN;
+	} else {
+		usAcqStreamRun = 0;
+	}
+
+	return usAcqSample >= usAcqRxCount;
+}
+
+static void usarray_finish_ping() {
+	u8 sensorNum = usAcqSensor;
+	int rxCount = usAcqRxCount;
+	int sample;
+	int band;
+	int bandStart;
+	int bandEnd;
+	int freshStart;
+	int freshEnd;
+	unsigned short bias;
+
+	// Pad rest of an aborted capture with receiving channel's bias so later stages see silence - samples so far hold ringdown and echo
+	usCaptureLength[sensorNum] = (usAcqSample < rxCount) ? usAcqSample : rxCount;
+	if(usCaptureLength[sensorNum] < rxCount) {
+		bias = usarray_bias(usAcqRx);
+		for(sample = usCaptureLength[sensorNum]; sample < rxCount; sample++) usWaveformData[sensorNum][sample] = bias;
+	}
+
+	// Whole capture is new, unless stacking where only bands that now hold enough captures are published
+	freshStart = 0;
+	freshEnd = rxCount;
+	if(usAcqStacking) {
+		freshStart = rxCount;
+		freshEnd = 0;
+		bandStart = 0;
+		for(band = 0; band < STACK_BANDS; band++) {
+			bandEnd = (band == 0) ? usarray_stack_split(sensorNum) : rxCount;
+			usStackFresh[sensorNum][band] = (++usStackCount[sensorNum][band] >= (1 << usStackShift[sensorNum][band]));
+			if(usStackFresh[sensorNum][band]) {
+				for(sample = bandStart; sample < bandEnd; sample++) {
+					usWaveformData[sensorNum][sample] = usStack[sensorNum][sample] >> usStackShift[sensorNum][band];
+					usStack[sensorNum][sample] = 0;
+				}
+				usStackCount[sensorNum][band] = 0;
+				if(bandStart < freshStart) freshStart = bandStart;
+				freshEnd = bandEnd;
+			}
+			bandStart = bandEnd;
+		}
+	}
+
+	// Remember ping for next sensor's crosstalk check
+	usLastFired = sensorNum;
+	usLastElapsed = (usCaptureLength[sensorNum] * usProfiles[sensorNum].rxPeriod) / US_RX_CLOCK;
+
+	// Nothing to range until a band completes, so stale averages aren't processed again
+	if(freshStart >= freshEnd) return;
+
+	// Capture not ranged yet still has new data of its own
+	if(usCaptureStage[sensorNum] == US_STAGE_CAPTURED) {
+		if(usCaptureFresh[sensorNum][0] < freshStart) freshStart = usCaptureFresh[sensorNum][0];
+		if(usCaptureFresh[sensorNum][1] > freshEnd) freshEnd = usCaptureFresh[sensorNum][1];
+	}
+	usCaptureFresh[sensorNum][0] = freshStart;
+	usCaptureFresh[sensorNum][1] = freshEnd;
+
+	// Hand capture over before next ping, handler may range it straight away
+	usCaptureStage[sensorNum] = US_STAGE_CAPTURED;
+	if(usCaptureHandler != NULL) usCaptureHandler(sensorNum);
+}
+
+int usarray_scan_start(u8 sensors[], u8 numSensors) {
+	if (numSensors == 0 || numSensors > US_SENSOR_COUNT || usAcqState != US_ACQ_IDLE)
+		return XST_FAILURE;
 
 	// Reset sample index
 	usSampleIndex = 0;
 
-	int sensor;
-	int sample;
+	// Fire sensors in order that keeps consecutive pings apart
+	usarray_order_sensors(sensors, numSensors, usAcqOrder);
+	usAcqCount = numSensors;
+	usAcqPing = 0;
+	usarray_start_ping();
+
+	return XST_SUCCESS;
+}
+
+u8 usarray_scan_poll() {
+	u8 status;
+	u8 type;
+	u32 adcResult;
+	int work;
+	u8 done;
+
+	// Handle whatever us_receiver has sent so far, up to a fixed amount so caller gets control back quickly
+	for(work = 0; work < US_POLL_SAMPLES && usAcqState != US_ACQ_IDLE; work++) {
+		if(readUSDataNB(&status, &type, &adcResult) != XST_SUCCESS) break;
+
+		done = 0;
+		switch(usAcqState) {
+			case US_ACQ_LISTEN: {
+				usarray_listen_sample(usAcqSample, adcResult);
+				if(++usAcqSample >= usDither[usAcqSensor]) {
+					usarray_listen_finish(usAcqRx, usAcqSample);
+					usarray_fire();
+				}
+				break;
+			}
+			case US_ACQ_CAPTURE: {
+				done = usarray_capture_sample(adcResult);
+				break;
+			}
+			case US_ACQ_DRAIN: {
+				// Abort is acknowledged once samples in flight have arrived
+				if(type == US_RESP_SAMPLE && usAcqSample < usAcqRxCount) usWaveformData[usAcqSensor][usAcqSample++] = adcResult;
+				done = (type == US_RESP_NONE);
+				break;
+			}
+			default: {
+				break;
+			}
+		}
+
+		if(!done) continue;
+
+		// Move on to next ping, whole scan is published at once when last capture is in
+		usarray_finish_ping();
+		if(++usAcqPing < usAcqCount) {
+			usarray_start_ping();
+		} else {
+			usAcqState = US_ACQ_IDLE;
+			usScanSequence++;
+
+			// Settings changed mid scan take effect between scans
+			if(usPending) usarray_apply_pending();
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+u8 usarray_scan_busy() {
+	return usAcqState != US_ACQ_IDLE;
+}
+
+u32 usarray_scan_sequence() {
+	return usScanSequence;
+}
+
+const us_scan_result* usarray_publish(u8 sensors[], u8 numSensors) {
+	if (numSensors == 0 || numSensors > US_SENSOR_COUNT)
+		return NULL;
+
+	// Fill whichever buffer isn't latest, unless a reader still has it
+	int index = (usResultLatest < 0) ? 0 : usResultLatest ^ 1;
+	if(index == usResultHeld) index ^= 1;
+	us_scan_result *result = &usResults[index];
+
+	// Lay waveforms out same as acquisition buffers so each sensor has room for its profile
+	int offset = 0;
+	int i;
 	u8 sensorNum;
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		result->waveform[i] = &result->pool[offset];
+		result->rxCount[i] = usProfiles[i].rxCount;
+		result->range[i] = usRangeReadings[i];
+		result->echoIndex[i] = (usRangeReadings[i] >= 0) ? usarray_range_to_index(i, usRangeReadings[i]) : -1;
+		offset += usProfiles[i].rxCount;
+	}
 
-	// Iterate through sensors
-	for (sensor = 0; sensor < numSensors; sensor++) {
-		sensorNum = sensors[sensor];
+	// Only sensors in scan have new waveforms
+	for(i = 0; i < numSensors; i++) {
+		sensorNum = sensors[i];
+		result->sensors[i] = sensorNum;
+		memcpy(result->waveform[sensorNum], usWaveformData[sensorNum], usProfiles[sensorNum].rxCount * sizeof(unsigned short));
+	}
+	result->count = numSensors;
+	result->sequence = usScanSequence;
 
-		// Generate ultrasound pulse
-		pulseGen_GeneratePulse(XPAR_AXI_PULSEGEN_US_BASEADDR, 1, usSensorMap[sensorNum], US_TX_COUNT);
+	// Swap
+	usResultLatest = index;
+	return result;
+}
 
-		// Start sampling at 80kHz
-		sendUSSampleRequest(usSensorMap[sensorNum], US_RX_COUNT, 1250);
+const us_scan_result* usarray_latest_result() {
+	return (usResultLatest < 0) ? NULL : &usResults[(u8) usResultLatest];
+}
 
-		// Read all sample data
-		for (sample = 0; sample < US_RX_COUNT; sample++) {
-			u8 status;
-			u8 type;
-			u32 adcResult;
-			readUSData(&status, &type, &adcResult);
+const us_scan_result* usarray_hold_result() {
+	if(usResultLatest < 0) return NULL;
+	usResultHeld = usResultLatest;
+	return &usResults[(u8) usResultHeld];
+}
 
-			usWaveformData[sensorNum][sample] = adcResult;
+void usarray_release_result(const us_scan_result *result) {
+	if(usResultHeld >= 0 && result == &usResults[(u8) usResultHeld]) usResultHeld = -1;
+}
+
+void usarray_scan(u8 sensors[], u8 numSensors) {
+	if (usarray_scan_start(sensors, numSensors) != XST_SUCCESS)
+		return;
+
+	// Wait for whole scan
+	while(!usarray_scan_poll());
+}
+
+void usarray_set_capture_handler(us_capture_handler handler) {
+	usCaptureHandler = handler;
+}
+
+u32 usarray_echo_age(u8 sensor) {
+	if(usRangeFine[sensor] < 0) return 0;
+
+	// Time from echo arriving to end of capture
+	int index = usarray_range_to_index(sensor, usRangeFine[sensor] / 10);
+	if(index >= usCaptureLength[sensor]) return 0;
+	return ((usCaptureLength[sensor] - index) * usProfiles[sensor].rxPeriod) / US_RX_CLOCK;
+}
+
+static void usarray_add_echo(u8 sensorNum, int indexQ8, unsigned short amplitude, unsigned short width) {
+	u8 echo = usEchoes.count[sensorNum];
+
+	// Table full, later echoes are dropped
+	if(echo >= US_ECHO_MAX) return;
+
+	usEchoes.range[sensorNum][echo] = usarray_index_to_range(sensorNum, indexQ8) / 10;
+	usEchoes.amplitude[sensorNum][echo] = amplitude;
+	usEchoes.width[sensorNum][echo] = (width > 255) ? 255 : width;
+	usEchoes.count[sensorNum] = echo + 1;
+}
+
+static int usarray_find_echo_threshold(u8 sensorNum) {
+	int iSample;
+	int delta;
+	int mask;
+	unsigned short deviation;
+	const unsigned char *curve = usThresholdCurve[sensorNum];
+	int firstIndex = -1; // First crossing found
+	int echoStart = -1; // First crossing of echo being tracked, -1 when not in an echo
+	int echoEnd = 0; // Last crossing of echo being tracked
+	unsigned short echoPeak = 0; // Largest deviation within echo being tracked
+	int gapSamples = usarray_time_to_index(sensorNum, ECHO_GAP_TIME) + 1;
+
+	// Example each sample
+	for(iSample = 0; iSample < usProfiles[sensorNum].rxCount; iSample++) {
+		// Deviation from centre of trigger band, absolute value taken without branching
+		delta = (int) usWaveformData[sensorNum][iSample] - usTriggerCentre;
+		mask = delta >> 31;
+		deviation = (delta ^ mask) - mask;
+
+		// Check sample against threshold curve
+		if(deviation >= curve[iSample]) {
+			// Start new echo
+			if(echoStart < 0) {
+				if(usEchoes.count[sensorNum] >= US_ECHO_MAX) break;
+				if(firstIndex < 0) firstIndex = iSample;
+				echoStart = iSample;
+				echoPeak = 0;
+			}
+
+			// Track echo extent and peak deviation from centre of trigger band
+			echoEnd = iSample;
+			if(deviation > echoPeak) echoPeak = deviation;
+		} else if(echoStart >= 0 && iSample - echoEnd >= gapSamples) {
+			// Echo has died away
+			usarray_add_echo(sensorNum, echoStart << 8, echoPeak, echoEnd - echoStart + 1);
+			echoStart = -1;
 		}
 	}
+
+	// Close echo still open at end of capture
+	if(echoStart >= 0) usarray_add_echo(sensorNum, echoStart << 8, echoPeak, echoEnd - echoStart + 1);
+
+	// Confidence is first echo's peak height relative to threshold curve
+	if(firstIndex < 0) {
+		usRangeConfidence[sensorNum] = 0;
+	} else {
+		unsigned int ratio = (curve[firstIndex] > 0) ? (usEchoes.amplitude[sensorNum][0] * 16) / curve[firstIndex] : 255;
+		usRangeConfidence[sensorNum] = (ratio > 255) ? 255 : ratio;
+	}
+	return (firstIndex < 0) ? -1 : firstIndex << 8;
+}
+
+static int usarray_find_echo_matched(u8 sensorNum) {
+	int rxCount = usProfiles[sensorNum].rxCount;
+	usdsp_peak peak;
+
+	// Build reference from sensor's transmitted burst
+	int refLength = usdsp_build_reference(usMatchedRef, (US_RX_CLOCK * 1000000) / usProfiles[sensorNum].rxPeriod, usProfiles[sensorNum].txCount);
+	if(refLength > rxCount) refLength = rxCount;
+
+	// Correlate capture against transmitted burst, using capture mean as DC bias
+	unsigned short bias = usdsp_mean(usWaveformData[sensorNum], rxCount);
+	usdsp_correlate(usWaveformData[sensorNum], rxCount, bias, usMatchedRef, refLength, usMatchedCorr);
+
+	// Pick strongest match once transmit coupling has died away
+	usdsp_find_peak(usMatchedCorr, rxCount - refLength + 1, usarray_time_to_index(sensorNum, MATCHED_BLANK_TIME), &peak);
+
+	// Reject peaks that don't stand out from the noise
+	if(peak.confidence < MATCHED_MIN_CONFIDENCE) {
+		usRangeConfidence[sensorNum] = 0;
+		return -1;
+	}
+
+	usRangeConfidence[sensorNum] = peak.confidence;
+
+	// Correlation only gives a single echo, amplitude is mean deviation across burst
+	usarray_add_echo(sensorNum, peak.index << 8, peak.value / (USDSP_REF_SCALE * refLength), refLength);
+
+	return peak.index << 8;
+}
+
+static int usarray_walk_echoes(u8 sensorNum, const unsigned short *threshold) {
+	int firstQ8 = -1;
+	int rxCount = usProfiles[sensorNum].rxCount;
+	int start = usarray_time_to_index(sensorNum, MATCHED_BLANK_TIME);
+	int delayQ8 = ((usarray_burst_length(sensorNum) + (1 << USDSP_ENV_SHIFT) - 1) << 8) / 2;
+	int peakIndex;
+	int peakQ8;
+	int startIndex;
+	int endIndex;
+
+	// Walk echoes in magnitude once transmit coupling has died away
+	while(usEchoes.count[sensorNum] < US_ECHO_MAX) {
+		// Find top of next echo
+		peakIndex = usdsp_find_envelope_peak(usMagnitude[sensorNum], rxCount, start, threshold);
+		if(peakIndex < 0) break;
+
+		// Fit parabola through peak for sub-sample position
+		peakQ8 = usdsp_interpolate_peak(usMagnitude[sensorNum], rxCount, peakIndex);
+
+		// Magnitude peaks around half a burst after echo arrives, plus half the averaging window
+		peakQ8 -= delayQ8;
+		if(peakQ8 < 0) peakQ8 = 0;
+
+		// Find where echo rises above and drops back below threshold
+		startIndex = peakIndex;
+		while(startIndex > start && usMagnitude[sensorNum][startIndex - 1] >= threshold[startIndex - 1]) startIndex--;
+		endIndex = usdsp_find_envelope_end(usMagnitude[sensorNum], rxCount, peakIndex, threshold);
+		usarray_add_echo(sensorNum, peakQ8, usMagnitude[sensorNum][peakIndex], endIndex - startIndex);
+
+		// First echo gives range reading, confidence is peak height relative to threshold
+		if(firstQ8 < 0) {
+			unsigned int ratio = (threshold[peakIndex] > 0) ? (usMagnitude[sensorNum][peakIndex] * 16) / threshold[peakIndex] : 255;
+			usRangeConfidence[sensorNum] = (ratio > 255) ? 255 : ratio;
+			firstQ8 = peakQ8;
+		}
+
+		start = endIndex;
+	}
+
+	if(firstQ8 < 0) usRangeConfidence[sensorNum] = 0;
+	return firstQ8;
+}
+
+static int usarray_find_echo_envelope(u8 sensorNum) {
+	// Compare magnitude against fixed trigger level
+	return usarray_walk_echoes(sensorNum, usEnvelopeThreshold);
+}
+
+static int usarray_find_echo_cfar(u8 sensorNum) {
+	int rxCount = usProfiles[sensorNum].rxCount;
+	int tailStart = rxCount - usarray_time_to_index(sensorNum, CFAR_TAIL_TIME) - 1;
+	int i;
+
+	// Threshold follows local noise, never dropping below sensor's noise floor
+	usdsp_cfar_threshold(usMagnitude[sensorNum], rxCount, usNoiseFloor[sensorNum] >> 4, CFAR_SCALE, usCfarThreshold);
+
+	// Tail of an aborted capture is padding, and a bistatic capture hears another sensor's noise
+	if(usCaptureLength[sensorNum] < rxCount || usCaptureRx[sensorNum] != sensorNum || tailStart < 0) return usarray_walk_echoes(sensorNum, usCfarThreshold);
+
+	// Update noise floor from end of capture, limiting rise so a far echo in the tail can't drag it up quickly
+	unsigned int tailMean = 0;
+	for(i = tailStart; i < rxCount; i++) tailMean += usMagnitude[sensorNum][i];
+	tailMean = (tailMean << 4) / (rxCount - tailStart);
+	if(usNoiseFloor[sensorNum] == 0) {
+		usNoiseFloor[sensorNum] = tailMean;
+	} else {
+		if(tailMean > 2 * (unsigned int) usNoiseFloor[sensorNum]) tailMean = 2 * usNoiseFloor[sensorNum];
+		usNoiseFloor[sensorNum] += ((int) tailMean - (int) usNoiseFloor[sensorNum]) >> CFAR_FLOOR_SHIFT;
+	}
+
+	return usarray_walk_echoes(sensorNum, usCfarThreshold);
+}
+
+static void usarray_adapt_stack(u8 sensorNum) {
+	int band;
+	int hits;
+	int i;
+	unsigned char found;
+
+	// Range separating bands (mm)
+	int bandEnd = usarray_index_to_range(sensorNum, usarray_stack_split(sensorNum) << 8) / 10;
+
+	for(band = 0; band < STACK_BANDS; band++) {
+		if(!usStackFresh[sensorNum][band]) continue;
+
+		// Record whether band held an echo this time
+		found = 0;
+		for(i = 0; i < usEchoes.count[sensorNum]; i++) {
+			if((usEchoes.range[sensorNum][i] < bandEnd) == (band == 0)) found = 1;
+		}
+		usStackHistory[sensorNum][band] = (usStackHistory[sensorNum][band] << 1) | found;
+		if(++usStackUpdates[sensorNum][band] < STACK_HISTORY) continue;
+
+		// Echo dropping in and out needs more stacking, steady echo or steady silence can make do with less
+		hits = 0;
+		for(i = 0; i < STACK_HISTORY; i++) hits += (usStackHistory[sensorNum][band] >> i) & 1;
+		if(hits > STACK_HISTORY / 4 && hits < STACK_HISTORY - STACK_HISTORY / 4) {
+			if(usStackShift[sensorNum][band] < usStackMaxShift) usStackShift[sensorNum][band]++;
+		} else if(hits == 0 || hits == STACK_HISTORY) {
+			if(usStackShift[sensorNum][band] > usStackMinShift) usStackShift[sensorNum][band]--;
+		}
+		usStackUpdates[sensorNum][band] = 0;
+	}
 }
 
 void usarray_update_ranges(u8 sensors[], u8 numSensors) {
 	if (numSensors == 0 || numSensors > US_SENSOR_COUNT)
 		return;
 
-	// Compute speed of sound based on temperature
-	unsigned int speedOfSound = (3313000 + 606 * usTemperature) / 10000; //mm/uS expressed in thousandths
+	// Rebuild range table if temperature or calibration has changed
+	if(!usRangeLUTValid || usRangeLUTTemperature != usTemperature) usarray_build_range_lut();
 
 	// Update range readings for each sensor
 	u8 sensorNum;
 	int iSensor;
-	int iSample;
-	unsigned short triggerUpper;
-	unsigned short triggerLower;
+	int echoIndex; // Sample index of echo, expressed in Q8
+	int range;
+	int accepted;
+	u8 bistatic;
+	u8 confidence;
 	for(iSensor = 0; iSensor < numSensors; iSensor++) {
 		sensorNum = sensors[iSensor];
 
-		// Assume nothing will be found
-		usRangeReadings[sensorNum] = -1;
+		// Skip captures already ranged by capture handler
+		if(usCaptureStage[sensorNum] != US_STAGE_CAPTURED) continue;
+		usCaptureStage[sensorNum] = US_STAGE_RANGED;
 
-		// Example each sample
-		for(iSample = 0; iSample < US_RX_COUNT; iSample++) {
-			// Work out trigger levels for sample
-			if(iSample <= usTriggerChangeIndex) {
-				triggerUpper = usTriggerNearUpper;
-				triggerLower = usTriggerNearLower;
-			} else {
-				triggerUpper = usTriggerFarUpper;
-				triggerLower = usTriggerFarLower;
-			}
+		// Follow channel's ADC bias from quiet end of capture
+		usarray_track_bias(sensorNum);
+
+		// Check channel on raw capture, bistatic captures have no ringdown to look for and a stale ringdown has already had baseline removed
+		if(usCaptureRx[sensorNum] == sensorNum && usCaptureFresh[sensorNum][0] == 0) usarray_check_health(sensorNum);
 
-			// Check sample against trigger levels
-			if(usWaveformData[sensorNum][iSample] <= triggerLower || usWaveformData[sensorNum][iSample] >= triggerUpper) {
-				// Update range reading - converting distance from thousandths of mm to mm and halving to retrieve one way distance
-				usRangeReadings[sensorNum] = ((((unsigned int) USSampleIndexToTime(iSample)) * speedOfSound) / (1000 * 2)) - 20;
+		// Remove ringdown and chassis reflections - bistatic captures have neither
+		if(usBaselineEnabled && usCaptureRx[sensorNum] == sensorNum) usarray_apply_baseline(sensorNum);
 
-				// Done
+		// Demodulate carrier so envelope and CFAR work on magnitude rather than biased ADC codes, quadrature profiles don't fade with echo phase
+		// Matched filter correlates raw codes against the carrier, which keeps the phase that magnitude throws away, and threshold mode keeps trigger levels in ADC counts
+		if(usRangingMode == US_RANGING_ENVELOPE || usRangingMode == US_RANGING_CFAR) {
+			if(usarray_quadrature(sensorNum)) usdsp_demodulate_iq(usWaveformData[sensorNum], usProfiles[sensorNum].rxCount, usMagnitude[sensorNum]);
+			else usdsp_demodulate(usWaveformData[sensorNum], usProfiles[sensorNum].rxCount, usMagnitude[sensorNum]);
+		}
+
+		// Locate echoes using selected algorithm - echo table always describes latest capture, whoever received it
+		bistatic = (usCaptureRx[sensorNum] != sensorNum);
+		confidence = usRangeConfidence[sensorNum];
+		usEchoes.count[sensorNum] = 0;
+		switch(usRangingMode) {
+			case US_RANGING_MATCHED: {
+				echoIndex = usarray_find_echo_matched(sensorNum);
+				break;
+			}
+			case US_RANGING_ENVELOPE: {
+				echoIndex = usarray_find_echo_envelope(sensorNum);
 				break;
 			}
+			case US_RANGING_CFAR: {
+				echoIndex = usarray_find_echo_cfar(sensorNum);
+				break;
+			}
+			default: {
+				echoIndex = usarray_find_echo_threshold(sensorNum);
+				break;
+			}
+		}
+
+		if(echoIndex < 0) {
+			// Nothing found
+			range = -1;
+			accepted = -1;
+		} else {
+			range = usarray_index_to_range(sensorNum, echoIndex);
+
+			// Dither moves crosstalk echoes between pings, so with crosstalk about only accept a range the previous ping agrees with
+			accepted = range;
+			if(usCrosstalkExposed[sensorNum] && (usGhostCheck[sensorNum][bistatic] < 0 || range - usGhostCheck[sensorNum][bistatic] > GHOST_TOLERANCE || usGhostCheck[sensorNum][bistatic] - range > GHOST_TOLERANCE)) {
+				accepted = -1;
+			}
+		}
+		usGhostCheck[sensorNum][bistatic] = range;
+
+		// Tune stacking depth from how steadily each band finds echoes
+		if(usStackEnabled && !bistatic && usPairRx[sensorNum] < 0) usarray_adapt_stack(sensorNum);
+
+		if(bistatic) {
+			// Bistatic reading leaves monostatic reading alone
+			usBistaticFine[sensorNum] = accepted;
+			usRangeConfidence[sensorNum] = confidence;
+		} else {
+			// Confidence combines peak height, echo width and agreement with recent pings
+			usRangeConfidence[sensorNum] = (accepted < 0) ? 0 : usarray_score_range(sensorNum, usRangeConfidence[sensorNum], usRangeFine[sensorNum], accepted);
+			if(accepted < 0) usRangeStreak[sensorNum] = 0;
+
+			// Update range reading
+			usRangeFine[sensorNum] = accepted;
+			usRangeReadings[sensorNum] = (accepted < 0) ? -1 : accepted / 10;
+		}
+	}
+}
+
+static void usarray_start_track(u8 sensorNum, int range) {
+	// Nothing known about motion yet
+	usTracks.range[sensorNum] = range;
+	usTracks.rate[sensorNum] = 0;
+	usTracks.misses[sensorNum] = 0;
+	usTracks.candidate[sensorNum] = -1;
+}
+
+void usarray_track(u8 sensors[], u8 numSensors, u32 now) {
+	if (numSensors == 0 || numSensors > US_SENSOR_COUNT)
+		return;
+
+	u8 sensorNum;
+	int iSensor;
+	int measured;
+	int predicted;
+	int error;
+	int gate;
+	int rate;
+	int dt;
+	u32 elapsed;
+	for(iSensor = 0; iSensor < numSensors; iSensor++) {
+		sensorNum = sensors[iSensor];
+
+		// Skip ranges already tracked by capture handler
+		if(usCaptureStage[sensorNum] != US_STAGE_RANGED) continue;
+		usCaptureStage[sensorNum] = US_STAGE_IDLE;
+
+		// Bistatic pings don't produce a new monostatic range
+		if(usCaptureRx[sensorNum] != sensorNum) continue;
+
+		// Motion can't be predicted across a long gap, and rate times gap must stay within range of an int
+		elapsed = now - usTracks.time[sensorNum];
+		if(elapsed > TRACK_MAX_GAP) {
+			usTracks.range[sensorNum] = -1;
+			usTracks.rate[sensorNum] = 0;
+		}
+		dt = (elapsed == 0) ? 1 : elapsed;
+		usTracks.time[sensorNum] = now;
+
+		// Weak detections count as nothing found
+		measured = (usRangeConfidence[sensorNum] >= TRACK_MIN_CONFIDENCE) ? usRangeFine[sensorNum] : -1;
+
+		if(usTracks.range[sensorNum] < 0) {
+			// No track, start one from any measurement
+			if(measured >= 0) usarray_start_track(sensorNum, measured);
+		} else {
+			// Predict where target has moved to
+			predicted = usTracks.range[sensorNum] + (usTracks.rate[sensorNum] * dt) / 1000;
+			if(predicted < 0) predicted = 0;
+
+			// Gate widens while coasting
+			error = measured - predicted;
+			gate = TRACK_GATE * (usTracks.misses[sensorNum] + 1);
+
+			if(measured >= 0 && error <= gate && error >= -gate) {
+				// Alpha-beta update
+				usTracks.range[sensorNum] = predicted + ((error * TRACK_ALPHA) >> 8);
+				rate = usTracks.rate[sensorNum] + ((((error * 1000) / dt) * TRACK_BETA) >> 8);
+				usTracks.rate[sensorNum] = (rate > 0x7FFF) ? 0x7FFF : (rate < -0x7FFF) ? -0x7FFF : rate;
+				usTracks.misses[sensorNum] = 0;
+				usTracks.candidate[sensorNum] = -1;
+			} else if(measured >= 0 && usTracks.candidate[sensorNum] >= 0 && measured - usTracks.candidate[sensorNum] <= TRACK_GATE && usTracks.candidate[sensorNum] - measured <= TRACK_GATE) {
+				// Two outliers in a row agree, target has really changed
+				usarray_start_track(sensorNum, measured);
+			} else {
+				// Spike or dropout, coast on prediction until too many are missed
+				usTracks.candidate[sensorNum] = measured;
+				usTracks.range[sensorNum] = predicted;
+				if(++usTracks.misses[sensorNum] > TRACK_MAX_MISSES) {
+					usTracks.range[sensorNum] = -1;
+					usTracks.rate[sensorNum] = 0;
+				}
+			}
+		}
+
+		// Time to collision only exists while closing
+		if(usTracks.range[sensorNum] >= 0 && usTracks.rate[sensorNum] < 0) {
+			rate = (usTracks.range[sensorNum] * 1000) / -usTracks.rate[sensorNum];
+			usTracks.ttc[sensorNum] = (rate > 0xFFFF) ? 0xFFFF : rate;
+		} else {
+			usTracks.ttc[sensorNum] = 0xFFFF;
 		}
 	}
 }
 
+s16 usarray_track_distance(u8 sensor) {
+	return (usTracks.range[sensor] < 0) ? -1 : usTracks.range[sensor] / 10;
+}
+
+s16 usarray_track_rate(u8 sensor) {
+	return usTracks.rate[sensor];
+}
+
+u16 usarray_ttc(u8 sensor) {
+	return usTracks.ttc[sensor];
+}
+
+int usarray_locate(u8 tx, s16 *x, s16 *y) {
+	if(tx >= US_SENSOR_COUNT || usPairRx[tx] < 0) return XST_FAILURE;
+	u8 rx = usPairRx[tx];
+
+	// Need a monostatic range and a bistatic half path from the same transmitter
+	int ra = usRangeFine[tx];
+	int rb = 2 * usBistaticFine[tx] - ra;
+	if(ra < 0 || usBistaticFine[tx] < 0 || rb < 0 || rb > 0x7FFF) return XST_FAILURE;
+
+	// Baseline between transducers
+	int bx = usSensorPos[rx][0] - usSensorPos[tx][0];
+	int by = usSensorPos[rx][1] - usSensorPos[tx][1];
+	int d = usdsp_isqrt(bx * bx + by * by);
+	if(d == 0) return XST_FAILURE;
+
+	// Distance along baseline from transmitter to foot of target, then distance out from baseline
+	int a = (ra * ra - rb * rb + d * d) / (2 * d);
+	if(a > ra || a < -ra) return XST_FAILURE; // Echoes can't come from the same point
+	int h = usdsp_isqrt(ra * ra - a * a);
+
+	// Two mirror image solutions either side of baseline, target is the one outside the robot
+	int px1 = usSensorPos[tx][0] + (a * bx - h * by) / d;
+	int py1 = usSensorPos[tx][1] + (a * by + h * bx) / d;
+	int px2 = usSensorPos[tx][0] + (a * bx + h * by) / d;
+	int py2 = usSensorPos[tx][1] + (a * by - h * bx) / d;
+	if(px1 * px1 + py1 * py1 >= px2 * px2 + py2 * py2) {
+		*x = px1 / 10;
+		*y = py1 / 10;
+	} else {
+		*x = px2 / 10;
+		*y = py2 / 10;
+	}
+
+	return XST_SUCCESS;
+}
+
+s16 usarray_bistatic_distance_fine(u8 sensor) {
+	return usBistaticFine[sensor];
+}
+
+u8 usarray_capture_rx(u8 sensor) {
+	return usCaptureRx[sensor];
+}
+
 u16 usarray_distance(u8 sensor) {
 	return usRangeReadings[sensor];
 }
 
+u8 usarray_echo_count(u8 sensor) {
+	return usEchoes.count[sensor];
+}
+
+s16 usarray_echo_distance(u8 sensor, u8 echo) {
+	return (echo < usEchoes.count[sensor]) ? usEchoes.range[sensor][echo] : -1;
+}
+
+u16 usarray_echo_amplitude(u8 sensor, u8 echo) {
+	return (echo < usEchoes.count[sensor]) ? usEchoes.amplitude[sensor][echo] : 0;
+}
+
+u8 usarray_echo_width(u8 sensor, u8 echo) {
+	return (echo < usEchoes.count[sensor]) ? usEchoes.width[sensor][echo] : 0;
+}
+
+s16 usarray_distance_fine(u8 sensor) {
+	return usRangeFine[sensor];
+}
+
+u16 usarray_noise_floor(u8 sensor) {
+	return usNoiseFloor[sensor];
+}
+
+u8 usarray_confidence(u8 sensor) {
+	return usRangeConfidence[sensor];
+}
+
 u8 usarray_detect_obstacle(u8 sensor, u16 distance) {
-	return (usRangeReadings[sensor] > 0 && usRangeReadings[sensor] < distance);
+	// Coasting track closing in is held at 0, which is nearest of all rather than nothing found
+	return (usTracks.range[sensor] >= 0 && usTracks.range[sensor] / 10 < distance);
+}
+
+u8 usarray_detect_obstacle_confident(u8 sensor, u16 distance, u8 confidence) {
+	return (usRangeReadings[sensor] > 0 && usRangeReadings[sensor] < distance && usRangeConfidence[sensor] >= confidence);
+}
+
+u8 usarray_health(u8 sensor) {
+	return usHealth.status[sensor];
+}
+
+const us_health_table* usarray_health_table() {
+	return &usHealth;
+}
+
+void usarray_reset_health() {
+	int i;
+
+	// Clear counters
+	for(i = 0; i < US_SENSOR_COUNT; i++) {
+		usHealth.status[i] = US_HEALTH_OK;
+		usHealth.captures[i] = 0;
+		usHealth.stuck[i] = 0;
+		usHealth.dead[i] = 0;
+		usHealth.saturated[i] = 0;
+	}
 }
@@ -5,17 +5,92 @@
 
 #define US_SENSOR_COUNT 10 // Number of sensors installed on platform
 #define US_SENSOR_MAP {9, 10, 11, 1, 2, 3, 4, 5, 6, 8} //Map sensor positions to sensor addresses
+#define US_SENSOR_POSITIONS {{475, 0}, {384, -279}, {147, -452}, {-147, -452}, {-384, -279}, {-475, 0}, {-384, 279}, {-147, 452}, {147, 452}, {384, 279}} // Transducer x, y relative to robot centre, evenly spaced round chassis (tenths of mm)
 #define US_SAMPLE_RATE 80000 // Hz
 #define US_RX_COUNT 200 // Number of waveform samples to take at US_SAMPLE_RATE in a single ranging operation
 #define US_TX_COUNT 8 // Cycles of 40Khz ultrasound to transmit
+#define US_RX_PERIOD 1250 // us_receiver clock cycles between samples at US_SAMPLE_RATE
+#define US_RX_PERIOD_IQ 1875 // us_receiver clock cycles between samples for quadrature capture, three quarters of a carrier cycle
+#define US_RX_CLOCK 100 // us_receiver clock cycles per uS
+#define US_RX_MAX 511 // Largest sample count us_receiver can be asked for
+#define US_WAVEFORM_POOL (US_SENSOR_COUNT * US_RX_COUNT) // Waveform storage shared between all sensors (samples)
+#define US_RESULT_BUFFERS 2 // Published scan results, one can be read while the other is refilled
+#define US_POLL_SAMPLES 64 // Most us_receiver responses handled per usarray_scan_poll - FSL FIFO holds 256 samples (3.2ms) so callers must poll at least that often
 
 #define USADCPrecision 10 // Bits
 #define USADCReference 330 // Volts - expressed in hundredths
 
-#define TRIGGER_NEAR_FAR_CHANGE 900 //  Time at which far trigger is used instead of near trigger
+#define TRIGGER_NEAR_FAR_CHANGE 900 //  Time after which threshold curve falls from near trigger towards far trigger (uS)
 #define TRIGGER_BASE 160 // Default trigger voltage for distance detection (V*100)
 #define TRIGGER_OFFSET_NEAR 41 // Default amount near trigger is away from base value
 #define TRIGGER_OFFSET_FAR 11 // Default amount far trigger is away from base value
+#define TRIGGER_ABSORPTION 13 // Default air absorption at 40kHz modelled by threshold curve (tenths of dB/m)
+#define TRIGGER_CURVE_CHUNK 16 // Threshold curve levels sent in a single upload
+
+#define RANGE_OFFSET_DEFAULT -200 // Default range calibration applied to every sensor (tenths of mm)
+
+#define MATCHED_BLANK_TIME 200 // Time after transmission ignored by matched filter (uS)
+#define MATCHED_MIN_CONFIDENCE 48 // Minimum correlation peak to mean ratio accepted as an echo (sixteenths)
+
+#define ENVELOPE_TRIGGER 8 // Carrier magnitude at which an echo is detected (V*100)
+
+#define CFAR_SCALE 48 // CFAR threshold above local noise, expressed in sixteenths (roughly 1e-3 false alarms per sample with 16 training cells)
+#define CFAR_TAIL_TIME 400 // Time at end of capture used to track sensor noise floor (uS)
+#define CFAR_FLOOR_SHIFT 3 // Noise floor tracking rate, expressed as power of 2 captures
+
+#define BIAS_TAIL_TIME 400 // Time at end of capture used to track each channel's ADC bias (uS)
+#define BIAS_SHIFT 3 // ADC bias tracking rate, expressed as power of 2 captures
+
+#define STREAM_MIN_SAMPLES 4 // Samples above envelope trigger needed before streaming acquisition trusts an echo and stops early
+
+#define SCHED_BASE_INTERVAL 240 // Time between scans of a sensor with weight 1 (ms)
+#define SCHED_NEAR_RANGE 150 // Sensors seeing an echo nearer than this are scanned twice as often (mm)
+#define SCHED_BATCH 2 // Sensors scanned per scheduling pass
+
+#define CROSSTALK_TIME 12000 // Default time a ping can be heard by its own sensor (uS), halved for each step round the array
+#define CROSSTALK_REACH 3 // Steps round the array beyond which sensors are assumed not to hear each other
+#define CROSSTALK_MARGIN 500 // Added to a crosstalk time when a ping is heard later than expected (uS)
+#define CROSSTALK_DECAY_SHIFT 3 // Rate crosstalk times shrink when a ping is found to have died away, expressed as power of 2 pings
+
+#define DITHER_MASK 0x3F // Random listen time before each ping (samples)
+#define DITHER_MIN_STEP 16 // Smallest change in listen time between consecutive pings of a sensor (samples)
+#define GHOST_TOLERANCE 200 // Largest range change between pings accepted while crosstalk is about (tenths of mm), must be below DITHER_MIN_STEP worth of range
+
+#define STACK_BANDS 2 // Range bands stacked independently, split where near trigger changes to far trigger
+#define STACK_MAX_SHIFT 4 // Most captures stacked in a band, expressed as power of 2
+#define STACK_HISTORY 8 // Band refreshes examined before changing stack depth
+
+#define BASELINE_TIME 1500 // Start of capture covered by baseline, long enough for ringdown and chassis reflections (uS)
+#define BASELINE_LEARN_PINGS 16 // Captures learnt into baseline at startup
+#define BASELINE_SHIFT 6 // Baseline tracking rate once learnt, expressed as power of 2 captures
+#define BASELINE_ECHO_BURSTS 4 // Bursts around previous echo left out of baseline tracking, from one burst before it arrives
+
+#define CONF_WEIGHT 85 // Most each of peak height, echo width and consistency adds to range confidence
+#define CONF_STRONG 64 // Detector confidence at which peak height scores fully (sixteenths of threshold)
+#define CONF_CONSISTENT_RANGE 300 // Largest range change between pings counted as agreement (tenths of mm)
+#define CONF_STREAK_MAX 4 // Agreeing pings needed for consistency to score fully
+#define OBSTACLE_MIN_CONFIDENCE 64 // Range confidence needed before a range is treated as an obstacle
+
+#define TRACK_MIN_CONFIDENCE OBSTACLE_MIN_CONFIDENCE // Range confidence needed before tracker uses a range
+#define TRACK_GATE 500 // Largest difference between measured and predicted range accepted by tracker (tenths of mm), widens while coasting
+#define TRACK_MAX_MISSES 3 // Pings a track coasts through before it is dropped
+#define TRACK_ALPHA 128 // Tracker range gain (256ths)
+#define TRACK_BETA 32 // Tracker rate gain (256ths)
+#define TRACK_MAX_GAP 2000 // Longest time between updates a track survives, after that it starts again from the next measurement (ms)
+
+#define HEALTH_STUCK_SPAN 2 // Largest swing across a whole capture from a stuck channel (ADC counts)
+#define HEALTH_RINGDOWN_MIN 20 // Smallest ringdown swing from a working transducer (ADC counts)
+
+#define US_ECHO_MAX 4 // Maximum number of echoes recorded per sensor in a single ranging operation
+#define ECHO_GAP_TIME 100 // Time without a trigger crossing after which an echo is considered finished (uS)
+
+// Ranging algorithms
+enum US_RANGING {
+	US_RANGING_THRESHOLD = 0x00, // First sample outside near / far trigger levels
+	US_RANGING_MATCHED = 0x01, // Peak of correlation against transmitted burst
+	US_RANGING_ENVELOPE = 0x02, // Interpolated peak of carrier magnitude, sub-sample resolution
+	US_RANGING_CFAR = 0x03 // Carrier magnitude against adaptive CFAR threshold, tracks each sensor's noise floor
+};
 
 // Sensor locations
 enum SENSOR_POSITION {
@@ -31,8 +106,91 @@ enum SENSOR_POSITION {
 	SENSOR_FRONT_LEFT  = 7
 };
 
-extern unsigned short usWaveformData[US_SENSOR_COUNT][US_RX_COUNT]; // Provide external access to sample results
+// Acquisition settings for a single sensor
+typedef struct us_profile {
+	u16 rxCount; // Number of waveform samples to take
+	u16 rxPeriod; // us_receiver clock cycles between samples, an odd multiple of US_RX_PERIOD or of a quarter carrier cycle (quadrature, see US_RX_PERIOD_IQ)
+	u16 txCount; // Cycles of 40Khz ultrasound to transmit
+} us_profile;
+
+// Acquisition engine states
+enum US_ACQ {
+	US_ACQ_IDLE = 0x00, // No scan running
+	US_ACQ_LISTEN = 0x01, // Listening before ping
+	US_ACQ_CAPTURE = 0x02, // Capturing echoes
+	US_ACQ_DRAIN = 0x03 // Capture aborted, waiting for samples already in flight
+};
+
+// Processing reached by latest capture of each sensor, so captures handled early aren't processed twice
+enum US_STAGE {
+	US_STAGE_IDLE = 0x00, // Nothing new
+	US_STAGE_CAPTURED = 0x01, // Captured, waiting for usarray_update_ranges
+	US_STAGE_RANGED = 0x02 // Ranged, waiting for usarray_track
+};
+
+// Settings changed while a scan is running, applied once acquisition is idle
+enum US_PENDING {
+	US_PENDING_PROFILE = 0x01, // Acquisition profile
+	US_PENDING_PAIR = 0x02, // Bistatic pairing
+	US_PENDING_STACKING = 0x04 // Stacking enable
+};
+
+// Called as soon as each capture of a scan has been read
+typedef void (*us_capture_handler)(u8 sensor);
+
+// Channel faults seen in latest capture
+enum US_HEALTH {
+	US_HEALTH_OK = 0x00, // Nothing wrong
+	US_HEALTH_STUCK = 0x01, // Capture barely moves, ADC channel or multiplexer stuck
+	US_HEALTH_DEAD = 0x02, // No ringdown after transmit, transducer or driver not working
+	US_HEALTH_SATURATED = 0x04 // Samples pinned at ADC rails after ringdown
+};
+
+// Channel health counters, stored as struct of arrays indexed by sensor
+typedef struct us_health_table {
+	u8 status[US_SENSOR_COUNT]; // US_HEALTH flags for latest capture
+	u16 captures[US_SENSOR_COUNT]; // Captures checked
+	u16 stuck[US_SENSOR_COUNT]; // Captures found stuck
+	u16 dead[US_SENSOR_COUNT]; // Captures found dead
+	u16 saturated[US_SENSOR_COUNT]; // Captures found saturated
+} us_health_table;
+
+// Range tracks, stored as struct of arrays indexed by sensor
+typedef struct us_track_table {
+	s16 range[US_SENSOR_COUNT]; // Filtered range (tenths of mm), -1 when no track
+	s16 rate[US_SENSOR_COUNT]; // Range rate, negative when closing (tenths of mm per second)
+	u16 ttc[US_SENSOR_COUNT]; // Time to collision (ms), 0xFFFF when not closing
+	u8 misses[US_SENSOR_COUNT]; // Consecutive pings without a measurement inside gate
+	s16 candidate[US_SENSOR_COUNT]; // Measurement outside gate waiting for confirmation, -1 when none
+	u32 time[US_SENSOR_COUNT]; // Time of last update (ms)
+} us_track_table;
+
+// Completed scan published for readers, kept apart from buffers acquisition and ranging work in
+typedef struct us_scan_result {
+	u32 sequence; // Scan that filled buffer, 0 when never filled
+	u8 count; // Sensors in scan
+	u8 sensors[US_SENSOR_COUNT]; // Sensors in scan, in order scan was asked for
+	u16 rxCount[US_SENSOR_COUNT]; // Samples in each waveform, indexed by sensor
+	s16 range[US_SENSOR_COUNT]; // Range readings (mm), -1 when nothing found, indexed by sensor
+	s16 echoIndex[US_SENSOR_COUNT]; // Sample each range reading came from, -1 when nothing found, indexed by sensor
+	unsigned short *waveform[US_SENSOR_COUNT]; // Waveforms as used for ranging, indexed by sensor, pointing into pool
+	unsigned short pool[US_WAVEFORM_POOL]; // Waveform storage
+} us_scan_result;
+
+// Echoes found in latest ranging operation, stored as struct of arrays indexed by sensor then echo
+typedef struct us_echo_table {
+	u8 count[US_SENSOR_COUNT]; // Number of echoes found
+	s16 range[US_SENSOR_COUNT][US_ECHO_MAX]; // Echo range (mm)
+	u16 amplitude[US_SENSOR_COUNT][US_ECHO_MAX]; // Peak deviation from bias (ADC counts)
+	u8 width[US_SENSOR_COUNT][US_ECHO_MAX]; // Echo duration (samples)
+} us_echo_table;
+
+extern unsigned short *usWaveformData[US_SENSOR_COUNT]; // Provide external access to sample results, each sensor holds its profile's rxCount samples
+extern unsigned short *usMagnitude[US_SENSOR_COUNT]; // Provide external access to demodulated waveforms, only filled in envelope and CFAR ranging modes
 extern signed short usRangeReadings[US_SENSOR_COUNT]; // Provide external access to range readings
+extern signed short usRangeFine[US_SENSOR_COUNT]; // Provide external access to high resolution range readings
+extern unsigned char usRangeConfidence[US_SENSOR_COUNT]; // Provide external access to range confidence
+extern us_echo_table usEchoes; // Provide external access to echo table
 
 int init_usarray();
 
@@ -41,13 +199,82 @@ unsigned char usarray_get_sensor();
 
 void usarray_set_triggers(unsigned short changever, unsigned short nearLower, unsigned short nearUpper, unsigned short farLower, unsigned short farUpper);
 
+void usarray_set_curve(u8 absorption);
+int usarray_upload_curve(u8 sensor, u16 start, const u8 *levels, u16 count);
+
+void usarray_set_ranging(unsigned char mode);
+unsigned char usarray_get_ranging();
+
+void usarray_set_offset(u8 sensor, s16 offset);
+s16 usarray_get_offset(u8 sensor);
+
+int usarray_set_profile(u8 sensor, u16 rxCount, u16 rxPeriod, u16 txCount);
+const us_profile* usarray_get_profile(u8 sensor);
+
+void usarray_set_weight(u8 sensor, u8 weight);
+u8 usarray_get_weight(u8 sensor);
+u8 usarray_schedule(u32 now, u8 sensors[], u8 maxSensors);
+u32 usarray_staleness(u8 sensor, u32 now);
+
+void usarray_set_crosstalk(u8 from, u8 to, u16 time);
+u16 usarray_get_crosstalk(u8 from, u8 to);
+
+int usarray_set_pair(u8 tx, u8 rx);
+s8 usarray_get_pair(u8 tx);
+
+void usarray_set_stacking(u8 enable);
+u8 usarray_get_stacking();
+int usarray_set_stack_limits(u8 minShift, u8 maxShift); // Adaptive depth limits as power of 2 captures, equal limits fix depth
+u8 usarray_stack_depth(u8 sensor, u8 band);
+
+void usarray_set_baseline(u8 enable);
+u8 usarray_get_baseline();
+void usarray_learn_baseline();
+void usarray_set_baseline_tracking(u8 enable);
+
+void usarray_set_stream_range(u16 range);
+u16 usarray_get_stream_range();
+
 short usarray_get_temperature();
 
 void usarray_measure_temp();
-void usarray_scan(u8 sensors[], u8 numSensors);
+void usarray_scan(u8 sensors[], u8 numSensors); // Blocks until scan complete
+int usarray_scan_start(u8 sensors[], u8 numSensors); // Fails while a scan is running
+u8 usarray_scan_poll(); // Does a bounded amount of work, returns 1 as scan completes
+u8 usarray_scan_busy();
+u32 usarray_scan_sequence();
+void usarray_set_capture_handler(us_capture_handler handler); // NULL to disable
+u32 usarray_echo_age(u8 sensor);
 void usarray_update_ranges(u8 sensors[], u8 numSensors);
 
+const us_scan_result* usarray_publish(u8 sensors[], u8 numSensors); // Run after usarray_update_ranges
+const us_scan_result* usarray_latest_result(); // NULL before first scan is published
+const us_scan_result* usarray_hold_result(); // Latest result, not overwritten until released
+void usarray_release_result(const us_scan_result *result);
+
 u16 usarray_distance(u8 sensor);
-u8 usarray_detect_obstacle(u8 sensor, u16 distance);
+s16 usarray_distance_fine(u8 sensor);
+u8 usarray_confidence(u8 sensor);
+u16 usarray_noise_floor(u8 sensor);
+
+u8 usarray_echo_count(u8 sensor);
+s16 usarray_echo_distance(u8 sensor, u8 echo);
+u16 usarray_echo_amplitude(u8 sensor, u8 echo);
+u8 usarray_echo_width(u8 sensor, u8 echo);
+void usarray_track(u8 sensors[], u8 numSensors, u32 now); // Run after usarray_update_ranges
+s16 usarray_track_distance(u8 sensor);
+s16 usarray_track_rate(u8 sensor);
+u16 usarray_ttc(u8 sensor);
+
+u8 usarray_detect_obstacle(u8 sensor, u16 distance); // Uses tracked range
+u8 usarray_detect_obstacle_confident(u8 sensor, u16 distance, u8 confidence);
+
+u8 usarray_health(u8 sensor);
+const us_health_table* usarray_health_table();
+void usarray_reset_health();
+
+s16 usarray_bistatic_distance_fine(u8 sensor);
+u8 usarray_capture_rx(u8 sensor);
+int usarray_locate(u8 tx, s16 *x, s16 *y);
 
 #endif /* USARRAY_H_ */
@@ -0,0 +1,268 @@
+#include "usdsp.h"
+
+// One cycle of cosine expressed in Q8, sampled at 16 points
+static const signed short usdspCosTable[16] = {256, 237, 181, 98, 0, -98, -181, -237, -256, -237, -181, -98, 0, 98, 181, 237};
+
+int usdsp_build_reference(signed short *ref, int sampleRate, int cycles) {
+	// Work out burst length in samples, limited to reference buffer size
+	int length = (cycles * sampleRate) / USDSP_CARRIER_FREQ;
+	if(length > USDSP_REF_MAX) length = USDSP_REF_MAX;
+
+	// Generate carrier - at 2x sample rate this reduces to an alternating +/- pattern
+	int i;
+	for(i = 0; i < length; i++) ref[i] = usdspCosTable[((i * USDSP_CARRIER_FREQ * 16) / sampleRate) & 0x0F];
+
+	return length;
+}
+
+unsigned short usdsp_mean(const unsigned short *samples, int count) {
+	if(count <= 0) return 0;
+
+	// Sum samples
+	unsigned int sum = 0;
+	int i;
+	for(i = 0; i < count; i++) sum += samples[i];
+
+	return sum / count;
+}
+
+void usdsp_correlate(const unsigned short *samples, int count, unsigned short bias, const signed short *ref, int refLen, unsigned int *out) {
+	int n;
+	int k;
+
+	// Removing bias from every sample is equivalent to removing bias * sum(ref) from every result
+	int refSum = 0;
+	for(k = 0; k < refLen; k++) refSum += ref[k];
+	int offset = refSum * bias;
+
+	// Slide reference across capture - inner loop unrolled by 4 with independent accumulators to keep the multiplier busy
+	for(n = 0; n <= count - refLen; n++) {
+		const unsigned short *x = &samples[n];
+		int acc0 = 0;
+		int acc1 = 0;
+		int acc2 = 0;
+		int acc3 = 0;
+
+		for(k = 0; k + 3 < refLen; k += 4) {
+			acc0 += ref[k] * x[k];
+			acc1 += ref[k + 1] * x[k + 1];
+			acc2 += ref[k + 2] * x[k + 2];
+			acc3 += ref[k + 3] * x[k + 3];
+		}
+		for(; k < refLen; k++) acc0 += ref[k] * x[k];
+
+		// Phase of echo is unknown so only the magnitude is meaningful
+		int acc = acc0 + acc1 + acc2 + acc3 - offset;
+		out[n] = (acc < 0) ? -acc : acc;
+	}
+}
+
+void usdsp_find_peak(const unsigned int *corr, int count, int start, usdsp_peak *peak) {
+	// Assume nothing will be found
+	peak->index = -1;
+	peak->value = 0;
+	peak->confidence = 0;
+
+	if(count <= 0 || start >= count) return;
+
+	// Find largest value after start, summing everything for mean
+	unsigned int sum = 0;
+	int i;
+	for(i = 0; i < count; i++) {
+		sum += corr[i];
+		if(i >= start && corr[i] > peak->value) {
+			peak->value = corr[i];
+			peak->index = i;
+		}
+	}
+
+	// Confidence is how far peak stands above mean correlation
+	unsigned int mean = sum / count;
+	unsigned int ratio = (mean > 0) ? (peak->value * 16) / mean : 255;
+	peak->confidence = (ratio > 255) ? 255 : ratio;
+}
+
+void usdsp_demodulate(const unsigned short *samples, int count, unsigned short *mag) {
+	// At exactly 2x carrier frequency the in-phase carrier is an alternating +1 / -1 pattern and the quadrature carrier samples are all zero,
+	// so mixing down is just alternating add and subtract and the phase carried by the samples reduces to a sign
+	// A running sum over an even number of samples low pass filters the result and cancels the ADC bias without ever subtracting it
+	// Only the in-phase part is seen, so an echo of amplitude A arriving at carrier phase p relative to the samples gives A * |cos p|,
+	// fading to nothing each time range moves samples onto the carrier's zero crossings (every 2mm or so) - use a quadrature profile where that matters
+	const int window = 1 << USDSP_ENV_SHIFT;
+	int sum = 0;
+	int acc;
+	int n;
+
+	// Window is even so samples leaving the sum have the same sign pattern as those entering, handle samples in pairs to avoid testing parity
+	for(n = 0; n + 1 < count; n += 2) {
+		sum += samples[n];
+		if(n >= window) sum -= samples[n - window];
+		acc = (sum < 0) ? -sum : sum;
+		mag[n] = (n >= window - 1) ? acc >> USDSP_ENV_SHIFT : 0;
+
+		sum -= samples[n + 1];
+		if(n + 1 >= window) sum += samples[n + 1 - window];
+		acc = (sum < 0) ? -sum : sum;
+		mag[n + 1] = (n + 1 >= window - 1) ? acc >> USDSP_ENV_SHIFT : 0;
+	}
+
+	// Odd sample count leaves one even sample
+	if(n < count) {
+		sum += samples[n];
+		if(n >= window) sum -= samples[n - window];
+		acc = (sum < 0) ? -sum : sum;
+		mag[n] = (n >= window - 1) ? acc >> USDSP_ENV_SHIFT : 0;
+	}
+}
+
+static inline unsigned short usdsp_magnitude(int i, int q) {
+	// Larger plus 3/8 of smaller is within 7% of sqrt(i * i + q * q) using only shifts and adds
+	if(i < 0) i = -i;
+	if(q < 0) q = -q;
+	int big = (i > q) ? i : q;
+	int small = (i > q) ? q : i;
+
+	// Each sum holds half the window's samples
+	return (big + ((small + (small << 1)) >> 3)) >> (USDSP_ENV_SHIFT - 1);
+}
+
+void usdsp_demodulate_iq(const unsigned short *samples, int count, unsigned short *mag) {
+	// Sampling an odd number of quarter carrier cycles apart steps carrier phase by 90 or 270 degrees, so the in-phase carrier is 1, 0, -1, 0
+	// and the quadrature carrier 0, 1, 0, -1 (or its negative, which magnitude doesn't care about) - each sample feeds one sum with a sign
+	// Running sums over a multiple of 4 samples low pass filter and cancel the ADC bias, as in usdsp_demodulate, but magnitude no longer fades with phase
+	const int window = 1 << USDSP_ENV_SHIFT;
+	int i = 0;
+	int q = 0;
+	int delta;
+	int n;
+
+	// Sample leaving the window has the same place in the pattern as the one entering, handle samples in fours to avoid testing position
+	for(n = 0; n + 3 < count; n += 4) {
+		i += samples[n] - ((n >= window) ? samples[n - window] : 0);
+		mag[n] = (n >= window - 1) ? usdsp_magnitude(i, q) : 0;
+
+		q += samples[n + 1] - ((n + 1 >= window) ? samples[n + 1 - window] : 0);
+		mag[n + 1] = (n + 1 >= window - 1) ? usdsp_magnitude(i, q) : 0;
+
+		i -= samples[n + 2] - ((n + 2 >= window) ? samples[n + 2 - window] : 0);
+		mag[n + 2] = (n + 2 >= window - 1) ? usdsp_magnitude(i, q) : 0;
+
+		q -= samples[n + 3] - ((n + 3 >= window) ? samples[n + 3 - window] : 0);
+		mag[n + 3] = (n + 3 >= window - 1) ? usdsp_magnitude(i, q) : 0;
+	}
+
+	// Up to three samples left over
+	for(; n < count; n++) {
+		delta = samples[n] - ((n >= window) ? samples[n - window] : 0);
+		if(n & 2) delta = -delta;
+		if(n & 1) q += delta; else i += delta;
+		mag[n] = (n >= window - 1) ? usdsp_magnitude(i, q) : 0;
+	}
+}
+
+int usdsp_find_envelope_peak(const unsigned short *env, int count, int start, const unsigned short *threshold) {
+	int n;
+
+	// Find first sample above threshold
+	for(n = start; n < count; n++) {
+		if(env[n] >= threshold[n]) break;
+	}
+	if(n >= count) return -1;
+
+	// Highest point of region above threshold, noise on the rising edge would stop a simple climb short of the top
+	int peak = n;
+	for(n++; n < count && env[n] >= threshold[n]; n++) {
+		if(env[n] > env[peak]) peak = n;
+	}
+
+	return peak;
+}
+
+int usdsp_find_envelope_end(const unsigned short *env, int count, int index, const unsigned short *threshold) {
+	// Walk down trailing edge of echo
+	while(index < count && env[index] >= threshold[index]) index++;
+
+	return index;
+}
+
+int usdsp_interpolate_peak(const unsigned short *data, int count, int index) {
+	// Need a neighbour either side to fit through
+	if(index <= 0 || index >= count - 1) return index << 8;
+
+	int a = data[index - 1];
+	int b = data[index];
+	int c = data[index + 1];
+
+	// Vertex of parabola through three points is 0.5 * (a - c) / (a - 2b + c) from centre
+	int den = a - 2 * b + c;
+	if(den >= 0) return index << 8; // Flat top or not a maximum
+
+	int offset = ((a - c) * 128) / den;
+	if(offset > 128) offset = 128;
+	if(offset < -128) offset = -128;
+
+	return (index << 8) + offset;
+}
+
+void usdsp_cfar_threshold(const unsigned short *env, int count, unsigned short floor, unsigned short scale, unsigned short *threshold) {
+	const int train = 1 << USDSP_CFAR_TRAIN_SHIFT;
+	unsigned int lagSum = 0; // Training cells before cell under test
+	unsigned int leadSum = 0; // Training cells after cell under test
+	int n;
+
+	// Prime leading window for first cell
+	for(n = USDSP_CFAR_GUARD + 1; n <= USDSP_CFAR_GUARD + train && n < count; n++) leadSum += env[n];
+
+	for(n = 0; n < count; n++) {
+		// Greatest-of both windows copes with clutter edges, only windows lying entirely within capture are used
+		unsigned int noise = floor;
+		if(n - USDSP_CFAR_GUARD - train >= 0 && (lagSum >> USDSP_CFAR_TRAIN_SHIFT) > noise) noise = lagSum >> USDSP_CFAR_TRAIN_SHIFT;
+		if(n + USDSP_CFAR_GUARD + train < count && (leadSum >> USDSP_CFAR_TRAIN_SHIFT) > noise) noise = leadSum >> USDSP_CFAR_TRAIN_SHIFT;
+
+		unsigned int level = (noise * scale) >> 4;
+		threshold[n] = (level > 0xFFFF) ? 0xFFFF : level;
+
+		// Slide windows on by one sample
+		if(n - USDSP_CFAR_GUARD >= 0) lagSum += env[n - USDSP_CFAR_GUARD];
+		if(n - USDSP_CFAR_GUARD - train >= 0) lagSum -= env[n - USDSP_CFAR_GUARD - train];
+		if(n + USDSP_CFAR_GUARD + 1 < count) leadSum -= env[n + USDSP_CFAR_GUARD + 1];
+		if(n + USDSP_CFAR_GUARD + train + 1 < count) leadSum += env[n + USDSP_CFAR_GUARD + train + 1];
+	}
+}
+
+void usdsp_baseline_update(const unsigned short *samples, int count, unsigned short bias, signed short *baseline, int shift) {
+	int n;
+
+	// Exponential average of each sample's deviation from bias, kept in Q4 so slow updates don't stall
+	for(n = 0; n < count; n++) baseline[n] += ((((int) samples[n] - bias) << 4) - baseline[n]) >> shift;
+}
+
+void usdsp_baseline_subtract(unsigned short *samples, int count, const signed short *baseline) {
+	int n;
+	int v;
+
+	// Clamp rather than wrap if baseline is briefly wrong
+	for(n = 0; n < count; n++) {
+		v = samples[n] - (baseline[n] >> 4);
+		samples[n] = (v < 0) ? 0 : v;
+	}
+}
+
+unsigned int usdsp_isqrt(unsigned int x) {
+	unsigned int root = 0;
+	unsigned int bit = 1 << 30;
+
+	// Bit by bit, shifts and adds only
+	while(bit > x) bit >>= 2;
+	while(bit != 0) {
+		if(x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
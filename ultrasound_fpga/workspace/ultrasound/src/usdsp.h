@@ -0,0 +1,42 @@
+#ifndef USDSP_H_
+#define USDSP_H_
+
+// Fixed point signal processing kernels used for ultrasound ranging
+// Kept free of platform headers so the same code can be built and profiled on a host PC
+
+#define USDSP_CARRIER_FREQ 40000 // Hz
+#define USDSP_REF_MAX 64 // Maximum reference burst length in samples
+#define USDSP_REF_SCALE 256 // Reference burst amplitude (Q8)
+#define USDSP_ENV_SHIFT 2 // Demodulator averaging window, expressed as power of 2 samples (two carrier cycles at 2x sample rate), at least 2 for quadrature
+#define USDSP_CFAR_GUARD 12 // CFAR guard cells either side of cell under test, wide enough to keep a whole echo out of the training cells
+#define USDSP_CFAR_TRAIN_SHIFT 3 // CFAR training cells either side of guard cells, expressed as power of 2
+
+// Result of a correlation peak search
+typedef struct usdsp_peak {
+	signed short index; // Sample index at which best match begins (-1 if none)
+	unsigned int value; // Correlation magnitude at peak
+	unsigned char confidence; // Peak to mean magnitude ratio, expressed in sixteenths, saturated at 255
+} usdsp_peak;
+
+int usdsp_build_reference(signed short *ref, int sampleRate, int cycles); // Build carrier burst reference, returns length in samples
+
+unsigned short usdsp_mean(const unsigned short *samples, int count); // Mean of samples, used as DC bias estimate
+
+void usdsp_correlate(const unsigned short *samples, int count, unsigned short bias, const signed short *ref, int refLen, unsigned int *out); // Correlation magnitude, writes (count - refLen + 1) results
+
+void usdsp_find_peak(const unsigned int *corr, int count, int start, usdsp_peak *peak); // Locate correlation peak at or after start
+
+void usdsp_demodulate(const unsigned short *samples, int count, unsigned short *mag); // Carrier magnitude for captures taken at exactly 2x carrier frequency, ADC bias is cancelled, fades with carrier phase
+void usdsp_demodulate_iq(const unsigned short *samples, int count, unsigned short *mag); // Carrier magnitude for captures taken an odd number of quarter carrier cycles apart, ADC bias is cancelled
+int usdsp_find_envelope_peak(const unsigned short *env, int count, int start, const unsigned short *threshold); // Highest point of first envelope region above per-sample threshold (-1 if none)
+int usdsp_find_envelope_end(const unsigned short *env, int count, int index, const unsigned short *threshold); // First sample after index below per-sample threshold
+int usdsp_interpolate_peak(const unsigned short *data, int count, int index); // Parabolic fit around index, returns peak position in Q8
+
+void usdsp_cfar_threshold(const unsigned short *env, int count, unsigned short floor, unsigned short scale, unsigned short *threshold); // Greatest-of cell averaging CFAR, scale expressed in sixteenths
+
+void usdsp_baseline_update(const unsigned short *samples, int count, unsigned short bias, signed short *baseline, int shift); // Move baseline (deviation from bias, Q4) towards capture by 1 / 2^shift
+void usdsp_baseline_subtract(unsigned short *samples, int count, const signed short *baseline); // Remove baseline from capture in place
+
+unsigned int usdsp_isqrt(unsigned int x); // Integer square root, rounded down
+
+#endif /* USDSP_H_ */
@@ -0,0 +1,152 @@
+#include "wavecodec.h"
+
+void wavecodec_start(wavecodec_state *state, unsigned char *data, int capacity, int first, int roiStart, int roiEnd, int shift) {
+	state->data = data;
+	state->capacity = capacity;
+	state->length = 0;
+	state->bits = 0;
+	state->bitCount = 0;
+	state->previous = WAVECODEC_FIRST;
+	state->twoBack = WAVECODEC_FIRST;
+
+	// History of one difference of 4 starts Rice parameter at 2, about right for ADC noise
+	state->sum = 4;
+	state->count = 1;
+
+	state->index = first;
+	state->roiStart = roiStart;
+	state->roiEnd = roiEnd;
+	state->shift = shift;
+}
+
+static int wavecodec_parameter(const wavecodec_state *state) {
+	int k = 0;
+
+	// Smallest k for which 2^k reaches mean difference
+	while(((unsigned int) state->count << k) < state->sum) k++;
+
+	return k;
+}
+
+static void wavecodec_adapt(wavecodec_state *state, unsigned int mapped) {
+	state->sum += mapped;
+	state->count++;
+	if(state->count >= WAVECODEC_RESET) {
+		state->sum >>= 1;
+		state->count >>= 1;
+	}
+}
+
+static int wavecodec_shift(const wavecodec_state *state) {
+	// Outside region of interest bottom bits aren't worth sending
+	return (state->index >= state->roiStart && state->index < state->roiEnd) ? 0 : state->shift;
+}
+
+static int wavecodec_rebuild(int value, int shift) {
+	// Put coarse sample back in middle of range it stands for
+	return (shift > 0) ? (value << shift) | (1 << (shift - 1)) : value;
+}
+
+static void wavecodec_put_bits(wavecodec_state *state, unsigned int value, int count) {
+	// Most significant bit first, at most 16 bits at a time
+	state->bits = (state->bits << count) | (value & ((1 << count) - 1));
+	state->bitCount += count;
+	while(state->bitCount >= 8) {
+		state->bitCount -= 8;
+		state->data[state->length++] = state->bits >> state->bitCount;
+	}
+}
+
+static int wavecodec_get_bit(wavecodec_state *state) {
+	if(state->bitCount == 0) {
+		if(state->length >= state->capacity) return -1;
+		state->bits = state->data[state->length++];
+		state->bitCount = 8;
+	}
+
+	state->bitCount--;
+	return (state->bits >> state->bitCount) & 1;
+}
+
+static int wavecodec_get_bits(wavecodec_state *state, int count) {
+	int value = 0;
+	int bit;
+
+	while(count-- > 0) {
+		bit = wavecodec_get_bit(state);
+		if(bit < 0) return -1;
+		value = (value << 1) | bit;
+	}
+
+	return value;
+}
+
+int wavecodec_encode(wavecodec_state *state, unsigned short sample) {
+	int shift = wavecodec_shift(state);
+	int k = wavecodec_parameter(state);
+
+	// Only start a sample if the worst case fits, so a full buffer is never left with half a sample in it
+	if(state->length + (state->bitCount + WAVECODEC_MAX_BITS + 7) / 8 > state->capacity) return -1;
+
+	// Carrier alternates sign between samples, so predict from the one two back which is in phase with this one
+	// Map signed difference onto 0, -1, 1, -2, 2...
+	int value = sample >> shift;
+	int difference = value - (state->twoBack >> shift);
+	unsigned int mapped = (difference < 0) ? (-difference << 1) - 1 : difference << 1;
+
+	// Quotient in unary then remainder, escape to raw value if quotient is too long
+	unsigned int quotient = mapped >> k;
+	if(quotient < WAVECODEC_LIMIT) {
+		wavecodec_put_bits(state, ((1 << quotient) - 1) << 1, quotient + 1);
+		if(k > 0) wavecodec_put_bits(state, mapped, k);
+	} else {
+		wavecodec_put_bits(state, (1 << WAVECODEC_LIMIT) - 1, WAVECODEC_LIMIT);
+		wavecodec_put_bits(state, mapped, WAVECODEC_RAW_BITS);
+	}
+
+	// Follow decoder, which only knows coarse samples outside region of interest
+	state->twoBack = state->previous;
+	state->previous = wavecodec_rebuild(value, shift);
+	wavecodec_adapt(state, mapped);
+	state->index++;
+
+	return 0;
+}
+
+int wavecodec_finish(wavecodec_state *state) {
+	// Pad with zeros, decoder knows how many samples to expect
+	if(state->bitCount > 0) wavecodec_put_bits(state, 0, 8 - state->bitCount);
+
+	return state->length;
+}
+
+int wavecodec_decode(wavecodec_state *state, unsigned short *sample) {
+	int shift = wavecodec_shift(state);
+	int k = wavecodec_parameter(state);
+	int quotient = 0;
+	int bit = 0;
+	int mapped;
+
+	// Count unary quotient, escaped values follow straight on
+	while(quotient < WAVECODEC_LIMIT && (bit = wavecodec_get_bit(state)) == 1) quotient++;
+	if(quotient < WAVECODEC_LIMIT && bit < 0) return -1;
+	if(quotient == WAVECODEC_LIMIT) {
+		mapped = wavecodec_get_bits(state, WAVECODEC_RAW_BITS);
+	} else {
+		mapped = wavecodec_get_bits(state, k);
+		if(mapped >= 0) mapped |= quotient << k;
+	}
+	if(mapped < 0) return -1;
+
+	// Undo mapping and prediction
+	int difference = (mapped & 1) ? -((mapped + 1) >> 1) : mapped >> 1;
+	int value = (state->twoBack >> shift) + difference;
+
+	state->twoBack = state->previous;
+	state->previous = wavecodec_rebuild(value, shift);
+	wavecodec_adapt(state, mapped);
+	state->index++;
+
+	*sample = state->previous;
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef WAVECODEC_H_
+#define WAVECODEC_H_
+
+// Waveform compression - each sample is predicted from the one two before and the difference Rice coded, with the Rice parameter following recent differences
+// Samples go in and come out one at a time so encoding can keep pace with capture, integer only
+// Kept free of platform headers so the same code can be built on a host PC to decode what the board sends
+
+#define WAVECODEC_FIRST 512 // Prediction for first two samples, middle of 10-bit ADC range
+#define WAVECODEC_LIMIT 12 // Longest unary quotient, larger differences are escaped and sent raw
+#define WAVECODEC_RAW_BITS 16 // Size of escaped difference
+#define WAVECODEC_RESET 32 // Samples after which adaptation history is halved, so parameter follows changes in noise
+#define WAVECODEC_MAX_BITS (WAVECODEC_LIMIT + WAVECODEC_RAW_BITS) // Worst case size of one coded sample
+
+// Encoder or decoder state, encoder and decoder must be started with same region of interest
+typedef struct wavecodec_state {
+	unsigned char *data; // Coded bytes
+	int capacity; // Size of data (bytes)
+	int length; // Bytes written or read so far
+	unsigned int bits; // Bits waiting to be written, or read ahead
+	int bitCount;
+	int previous; // Last sample as decoder sees it
+	int twoBack; // Sample before that, prediction for next one
+	unsigned int sum; // Recent differences, Rice parameter is worked out from their mean
+	int count;
+	int index; // Position of next sample in capture
+	int roiStart; // Samples from roiStart up to roiEnd are exact, the rest lose their bottom shift bits
+	int roiEnd;
+	int shift;
+} wavecodec_state;
+
+void wavecodec_start(wavecodec_state *state, unsigned char *data, int capacity, int first, int roiStart, int roiEnd, int shift); // first is position of first sample in capture
+
+int wavecodec_encode(wavecodec_state *state, unsigned short sample); // -1 if sample might not fit, nothing written
+int wavecodec_finish(wavecodec_state *state); // Pad last byte, returns coded length
+
+int wavecodec_decode(wavecodec_state *state, unsigned short *sample); // -1 if coded data runs out
+
+#endif /* WAVECODEC_H_ */
@@ -0,0 +1,13 @@
+#ifndef FSL_H
+#define FSL_H
+
+// Host stand-in for MicroBlaze FSL instructions, connected to the us_receiver model
+
+#include "us_receiver_model.h"
+
+#define putfsl(value, id) model_fsl_put(value)
+#define getfsl(value, id) ((value) = model_fsl_get())
+#define ngetfsl(value, id) ((value) = model_fsl_nget(&modelFslInvalid))
+#define fsl_isinvalid(result) ((result) = modelFslInvalid)
+
+#endif /* FSL_H */
@@ -0,0 +1,10 @@
+#ifndef XBASIC_TYPES_H
+#define XBASIC_TYPES_H
+
+// Host stand-in for Xilinx standalone BSP legacy types
+
+#include "xil_types.h"
+
+typedef u32 Xuint32;
+
+#endif /* XBASIC_TYPES_H */
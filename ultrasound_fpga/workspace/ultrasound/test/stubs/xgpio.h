@@ -0,0 +1,14 @@
+#ifndef XGPIO_H
+#define XGPIO_H
+
+// Host stand-in for GPIO driver, pins go nowhere on host
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef struct {
+	u32 BaseAddress;
+	u32 IsReady;
+} XGpio;
+
+#endif /* XGPIO_H */
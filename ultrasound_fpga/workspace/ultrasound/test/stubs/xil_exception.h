@@ -0,0 +1,8 @@
+#ifndef XIL_EXCEPTION_H
+#define XIL_EXCEPTION_H
+
+// Host stand-in for MicroBlaze exception handling, nothing is needed by host tests
+
+#include "xil_types.h"
+
+#endif /* XIL_EXCEPTION_H */
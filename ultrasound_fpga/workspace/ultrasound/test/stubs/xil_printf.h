@@ -0,0 +1,9 @@
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+// Host stand-in for standalone BSP console output, firmware gets these without including the header
+
+void xil_printf(const char *ctrl1, ...);
+void print(const char *ptr);
+
+#endif /* XIL_PRINTF_H */
@@ -0,0 +1,17 @@
+#ifndef XIL_TYPES_H
+#define XIL_TYPES_H
+
+// Host stand-in for Xilinx standalone BSP types
+
+typedef unsigned char u8;
+typedef unsigned short u16;
+typedef unsigned int u32;
+typedef signed char s8;
+typedef signed short s16;
+typedef signed int s32;
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#endif /* XIL_TYPES_H */
@@ -0,0 +1,16 @@
+#ifndef XINTC_H
+#define XINTC_H
+
+// Host stand-in for interrupt controller driver, host tests call handlers themselves
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef void (*XInterruptHandler)(void *CallBackRef);
+typedef void (*XFastInterruptHandler)(void);
+
+typedef struct {
+	u32 IsReady;
+} XIntc;
+
+#endif /* XINTC_H */
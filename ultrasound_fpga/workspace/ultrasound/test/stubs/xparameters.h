@@ -0,0 +1,21 @@
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+// Host stand-in for generated hardware parameters, only what host tests build against
+
+#define XPAR_AXI_PULSEGEN_US_BASEADDR 0x7DE00000
+#define XPAR_MICROBLAZE_0_CORE_CLOCK_FREQ_HZ 100000000
+
+// Devices, UARTs are served by the uart model under these IDs
+#define XPAR_USB_UART_DEVICE_ID 0
+#define XPAR_AXI_UARTLITE_3PI_DEVICE_ID 1
+#define XPAR_AXI_UARTLITE_BLUETOOTH_DEVICE_ID 2
+#define XPAR_LEDS_4BITS_DEVICE_ID 0
+#define XPAR_AXI_TIMER_0_DEVICE_ID 0
+#define XPAR_AXI_TIMER_0_CLOCK_FREQ_HZ 100000000
+#define XPAR_MICROBLAZE_0_INTC_AXI_TIMER_0_INTERRUPT_INTR 0
+#define XPAR_MICROBLAZE_0_INTC_USB_UART_INTERRUPT_INTR 1
+#define XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_3PI_INTERRUPT_INTR 2
+#define XPAR_MICROBLAZE_0_INTC_AXI_UARTLITE_BLUETOOTH_INTERRUPT_INTR 3
+
+#endif /* XPARAMETERS_H */
@@ -0,0 +1,12 @@
+#ifndef XSTATUS_H
+#define XSTATUS_H
+
+// Host stand-in for Xilinx standalone BSP status codes
+
+#include "xil_types.h"
+
+#define XST_SUCCESS 0L
+#define XST_FAILURE 1L
+#define XST_NO_DATA 13L
+
+#endif /* XSTATUS_H */
@@ -0,0 +1,19 @@
+#ifndef XTMRCTR_H
+#define XTMRCTR_H
+
+// Host stand-in for timer counter driver, host tests set the time themselves
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef void (*XTmrCtr_Handler)(void *CallBackRef, u8 TmrCtrNumber);
+
+typedef struct {
+	u32 BaseAddress;
+	u32 IsReady;
+} XTmrCtr;
+
+void XTmrCtr_InterruptHandler(void *InstancePtr);
+u32 XTmrCtr_GetValue(XTmrCtr *InstancePtr, u8 TmrCtrNumber);
+
+#endif /* XTMRCTR_H */
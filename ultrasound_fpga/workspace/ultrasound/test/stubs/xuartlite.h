@@ -0,0 +1,18 @@
+#ifndef XUARTLITE_H
+#define XUARTLITE_H
+
+// Host stand-in for UART Lite driver, devices are served by the uart model
+
+#include "xil_types.h"
+#include "xstatus.h"
+
+typedef struct {
+	u32 RegBaseAddress;
+	u32 IsReady;
+} XUartLite;
+
+int XUartLite_Initialize(XUartLite *InstancePtr, u16 DeviceId);
+void XUartLite_EnableInterrupt(XUartLite *InstancePtr);
+void XUartLite_DisableInterrupt(XUartLite *InstancePtr);
+
+#endif /* XUARTLITE_H */
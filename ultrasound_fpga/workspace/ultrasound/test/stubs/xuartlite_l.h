@@ -0,0 +1,23 @@
+#ifndef XUARTLITE_L_H
+#define XUARTLITE_L_H
+
+// Host stand-in for UART Lite register access, same offsets and status bits as the hardware
+
+#include "xil_types.h"
+#include "uart_model.h"
+
+#define XUL_RX_FIFO_OFFSET 0
+#define XUL_TX_FIFO_OFFSET 4
+#define XUL_STATUS_REG_OFFSET 8
+#define XUL_CONTROL_REG_OFFSET 12
+
+#define XUL_SR_RX_FIFO_VALID_DATA 0x01
+#define XUL_SR_RX_FIFO_FULL 0x02
+#define XUL_SR_TX_FIFO_EMPTY 0x04
+#define XUL_SR_TX_FIFO_FULL 0x08
+
+#define XUartLite_GetStatusReg(base) uart_model_status(base)
+#define XUartLite_WriteReg(base, offset, data) uart_model_write(base, offset, data)
+#define XUartLite_RecvByte(base) uart_model_recv(base)
+
+#endif /* XUARTLITE_L_H */
@@ -0,0 +1,40 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+#include <time.h>
+
+// Minimal support for host tests - failed checks are reported and counted, main returns test_result()
+
+static int testChecks = 0;
+static int testFailures = 0;
+static unsigned int testSeed = 1;
+
+#define CHECK(condition) do { \
+	testChecks++; \
+	if(!(condition)) { \
+		testFailures++; \
+		printf("%s:%d: check failed - %s\n", __FILE__, __LINE__, #condition); \
+	} \
+} while(0)
+
+static inline int test_result(const char *name) {
+	printf("%s: %d checks, %d failed\n", name, testChecks, testFailures);
+	return (testFailures > 0) ? 1 : 0;
+}
+
+// Repeatable noise, same sequence on every host, uniform from -amplitude to amplitude
+static inline int test_noise(int amplitude) {
+	testSeed = testSeed * 1103515245 + 12345;
+	return (int) ((testSeed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+// Host monotonic clock in nanoseconds, for rough cost comparisons between kernels
+static inline double test_clock() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+#endif /* TEST_H_ */
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "test.h"
+#include "ultrasound.h"
+#include "uart_model.h"
+
+// Bare debug commands through the real parser, fed off the debug line a FIFO at a time as the main loop would see them
+
+#define OVERSIZED 200 // Argument bytes claimed by oversized robot command, more than the debug RX buffer holds
+#define MAX_PASSES 1000 // Give up after this many main loop passes
+
+// Linker script provides bounds of LMB BRAM data, mempool_init isn't used on host so anything will do
+char __lmb_bss_start[1];
+char __lmb_bss_end[1];
+
+extern uart_buff UartBuffDebug;
+extern char debugEnabled;
+
+// Board support the parser is linked against but never reaches
+void print(const char *ptr) {}
+void xil_printf(const char *ctrl1, ...) {}
+void init_platform() {}
+void cleanup_platform() {}
+int init_gpio(int deviceID, u32 direction_mask, u32 interrupt_mask, gpio_state* gpioState) { return XST_SUCCESS; }
+void gpio_write_bit(gpio_state* gpioState, unsigned char bit, unsigned char value) {}
+int init_timer(int deviceID, XTmrCtr *timer, u32 timer_freq, u32 target_freq, XTmrCtr_Handler interruptHandler) { return XST_SUCCESS; }
+void timer_setstate(XTmrCtr *timer, char state) {}
+u32 XTmrCtr_GetValue(XTmrCtr *InstancePtr, u8 TmrCtrNumber) { return 0; }
+void XTmrCtr_InterruptHandler(void *InstancePtr) {}
+int init_interrupt_ctrl(XIntc *int_ctrl) { return XST_SUCCESS; }
+int interrupt_ctrl_setup(XIntc *int_ctrl, u8 interruptID, XInterruptHandler interruptHandler, void *interruptCallbackRef) { return XST_SUCCESS; }
+
+// Interrupt as hardware raises it - bytes waiting or TX FIFO empty, and only while enabled
+static void interrupt(int device, uart_buff *buf) {
+	if(uart_model_enabled(device) && (uart_model_status(buf->uart.RegBaseAddress) & (XUL_SR_RX_FIFO_VALID_DATA | XUL_SR_TX_FIFO_EMPTY))) {
+		InterruptHandler_UART(buf);
+	}
+}
+
+// Times text turns up on line, log frames carry printable text unchanged through byte stuffing
+static int count_text(const u8 *line, int length, const char *text) {
+	const u8 *at = line;
+	int found = 0;
+
+	while((at = memmem(at, line + length - at, text, strlen(text))) != NULL) {
+		found++;
+		at++;
+	}
+	return found;
+}
+
+static void test_oversized_command() {
+	static u8 input[2 + OVERSIZED + 2 + 4 + 1];
+	static u8 debugLine[8192];
+	static u8 robotLine[64];
+	static const u8 stop[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_FORWARD, 0, 0};
+	int debugLength = 0;
+	int robotLength = 0;
+	int length = 0;
+	int sent = 0;
+	int passes;
+	int i;
+
+	uart_model_reset();
+	CHECK(init_uart_buffers(XPAR_USB_UART_DEVICE_ID, &UartBuffDebug, UART_DEBUG_TX_SIZE, UART_DEBUG_RX_SIZE) == XST_SUCCESS);
+	CHECK(init_uart_buffers(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, &UartBuffRobot, UART_3PI_TX_SIZE, UART_3PI_RX_SIZE) == XST_SUCCESS);
+	UartBuffRobot.frameLengthTX = mpCommandLength;
+	CHECK(init_telemetry(&UartBuffDebug) == XST_SUCCESS);
+	debugEnabled = 0x01;
+
+	// Robot command longer than debug RX buffer, its arguments are pings so any taken for commands show up, then a command that fits and a ping
+	input[length++] = DEBUG_CMD_ROBOT_COMMAND;
+	input[length++] = OVERSIZED;
+	for(i = 0; i < OVERSIZED; i++) input[length++] = DEBUG_CMD_PING;
+	input[length++] = DEBUG_CMD_ROBOT_COMMAND;
+	input[length++] = sizeof(stop);
+	for(i = 0; i < (int) sizeof(stop); i++) input[length++] = stop[i];
+	input[length++] = DEBUG_CMD_PING;
+
+	// Main loop passes, host sends a FIFO's worth between each
+	for(passes = 0; passes < MAX_PASSES && (sent < length || get_rx_count(&UartBuffDebug) > 0); passes++) {
+		while(sent < length && uart_model_rx_space(XPAR_USB_UART_DEVICE_ID) > 0) uart_model_arrive(XPAR_USB_UART_DEVICE_ID, input[sent++]);
+		interrupt(XPAR_USB_UART_DEVICE_ID, &UartBuffDebug);
+		ProcessSerialDebug();
+
+		// Both lines drain whatever firmware sends
+		while(uart_model_transmit(XPAR_USB_UART_DEVICE_ID, UART_MODEL_FIFO) > 0 || get_tx_count(&UartBuffDebug) > 0) interrupt(XPAR_USB_UART_DEVICE_ID, &UartBuffDebug);
+		while(uart_model_transmit(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, UART_MODEL_FIFO) > 0 || get_tx_count(&UartBuffRobot) > 0) interrupt(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, &UartBuffRobot);
+		debugLength += uart_model_take(XPAR_USB_UART_DEVICE_ID, &debugLine[debugLength], sizeof(debugLine) - debugLength);
+		robotLength += uart_model_take(XPAR_AXI_UARTLITE_3PI_DEVICE_ID, &robotLine[robotLength], sizeof(robotLine) - robotLength);
+	}
+
+	// Oversized command rejected and its arguments dropped, parser carries on with commands after it
+	CHECK(passes < MAX_PASSES);
+	CHECK(count_text(debugLine, debugLength, "ERROR CMD TOO LONG!") == 1);
+	CHECK(count_text(debugLine, debugLength, "ROBOT CMD ISSUED") == 1);
+	CHECK(count_text(debugLine, debugLength, "PING!") == 1);
+	CHECK(robotLength == sizeof(stop) && memcmp(robotLine, stop, sizeof(stop)) == 0);
+	CHECK(!UartBuffDebug.overflowRX);
+
+	printf("debug: %d byte robot command rejected against %d byte RX buffer in %d passes, following commands run\n", OVERSIZED, UART_DEBUG_RX_SIZE, passes);
+}
+
+int main() {
+	test_oversized_command();
+
+	return test_result("debug");
+}
@@ -0,0 +1,188 @@
+#include <math.h>
+#include <string.h>
+
+#include "test.h"
+#include "xstatus.h"
+#include "usarray.h"
+#include "uart.h"
+#include "mobplat.h"
+#include "us_receiver_model.h"
+#include "uart_model.h"
+
+// Echo to motor command latency for an obstacle closing on the front sensors, through the receiver and robot UART models
+// Emergency path stops from the capture handler as CheckCollision() does, normal path turns once the scan is complete as Drive3PI() does
+
+#define BIAS 512 // ADC counts - middle of 10-bit range
+#define CARRIER 0.04 // Cycles per uS
+#define BURST (US_TX_COUNT / CARRIER) // Transmitted burst length (uS)
+#define STRETCH 50 // Time transducer stretches an echo by (uS)
+#define SOUND 0.343 // Speed of sound (mm per uS)
+#define POLL_CYCLES 2000 // FSL clock cycles between main loop passes
+#define ROBOT 1 // Model device carrying robot commands
+#define BYTE_CYCLES (MODEL_CLOCK * 10000000 / 57600) // FSL clock cycles to send a byte to the 3pi, 10 bits at 57600 baud
+#define START_RANGE 600 // Obstacle range as it starts closing (mm)
+#define CLOSING 0.0008 // Obstacle closing speed (mm per uS)
+#define QUEUED 48 // Robot command bytes host keeps queued, waypoints sent ahead of time
+#define ESTOP_TTC 250 // ESTOP_TTC (ms)
+#define FRONT_TTC 500 // FRONT_TTC (ms)
+#define FRONT_DIST 70 // FRONT_DIST (mm)
+#define SPEED_TURN_FAST 30 // SPEED_TURN_FAST
+#define MAX_PASSES 200000 // Give up after this many main loop passes
+
+// Linker script provides bounds of LMB BRAM data, mempool_init isn't used on host so anything will do
+char __lmb_bss_start[1];
+char __lmb_bss_end[1];
+
+static const u8 sensorMap[US_SENSOR_COUNT] = US_SENSOR_MAP;
+static const u8 forwardWeights[US_SENSOR_COUNT] = {1, 0, 0, 0, 0, 1, 2, 3, 3, 2}; // usarrayWeights[DRIVE_FORWARD]
+
+// Scene - every transducer rings down after firing, obstacle ahead of front sensors closes in once started
+static u32 closingStart; // Model cycle obstacle starts closing, 0 while there is no obstacle
+static u32 echoCycle[16]; // Model cycle latest echo started arriving at each address
+
+static double obstacle_range(u32 cycle) {
+	return START_RANGE - CLOSING * (cycle - closingStart) / MODEL_CLOCK;
+}
+
+static unsigned short scene_sample(u8 address, u32 sinceFire) {
+	double t = sinceFire / (double) MODEL_CLOCK;
+	double v = BIAS + test_noise(3);
+	double range;
+	double e;
+
+	if(t < 4000) v += 300 * exp(-t / 200) * cos(2 * M_PI * CARRIER * t);
+
+	// Echo off obstacle where it was as sensor fired
+	if(closingStart > 0 && (address == sensorMap[SENSOR_FRONT_LEFT] || address == sensorMap[SENSOR_FRONT_RIGHT])) {
+		range = obstacle_range(model_cycle() - sinceFire);
+		e = t - 2 * range / SOUND;
+		if(e >= 0 && e < BURST + STRETCH) {
+			v += 200 * (0.5 - 0.5 * cos(2 * M_PI * e / (BURST + STRETCH))) * cos(2 * M_PI * CARRIER * e);
+			echoCycle[address] = model_cycle() - sinceFire + (u32) (2 * range / SOUND * MODEL_CLOCK);
+		}
+	}
+
+	return (v < 0) ? 0 : (v > 1023) ? 1023 : (unsigned short) lround(v);
+}
+
+static u32 now_ms() {
+	return model_cycle() / (MODEL_CLOCK * 1000);
+}
+
+// Set when command is decided, echo it was decided on
+static u8 decided;
+static u32 decidedEcho;
+
+static void check_collision(u8 sensor) {
+	if(sensor != SENSOR_FRONT_RIGHT && sensor != SENSOR_FRONT_LEFT) return;
+	if(decided) return;
+
+	usarray_update_ranges(&sensor, 1);
+	usarray_track(&sensor, 1, now_ms());
+	if(usarray_ttc(sensor) < ESTOP_TTC) {
+		mpEmergencyStop();
+		decided = 1;
+		decidedEcho = echoCycle[sensorMap[sensor]];
+	}
+}
+
+static u8 front_obstacle() {
+	return usarray_detect_obstacle(SENSOR_FRONT_RIGHT, FRONT_DIST)
+			|| usarray_detect_obstacle(SENSOR_FRONT_LEFT, FRONT_DIST)
+			|| usarray_ttc(SENSOR_FRONT_RIGHT) < FRONT_TTC
+			|| usarray_ttc(SENSOR_FRONT_LEFT) < FRONT_TTC;
+}
+
+// Drive along until path's command has left for the 3pi, returns FSL clock cycles from echo it was decided on
+static u32 run_path(u8 emergency, const u8 *command) {
+	u8 sensors[US_SENSOR_COUNT];
+	u8 count = 0;
+	u8 line[UART_MODEL_FIFO];
+	u8 frame[8];
+	int frameLength = 0;
+	int frameWanted = 0;
+	u32 credit = 0;
+	u32 sentCycle = 0;
+	int passes;
+	int taken;
+	int i;
+
+	model_reset(scene_sample);
+	CHECK(init_usarray() == XST_SUCCESS);
+	for(i = 0; i < US_SENSOR_COUNT; i++) usarray_set_weight(i, forwardWeights[i]);
+	uart_model_reset();
+	CHECK(init_uart_buffers(ROBOT, &UartBuffRobot, BUFFER_SIZE_TX, BUFFER_SIZE_RX) == XST_SUCCESS);
+	UartBuffRobot.frameLengthTX = mpCommandLength;
+	usarray_set_capture_handler(emergency ? check_collision : NULL);
+	usarray_set_baseline_tracking(1);
+	closingStart = 0;
+	decided = 0;
+
+	for(passes = 0; passes < MAX_PASSES && sentCycle == 0; passes++) {
+		// Obstacle appears once baseline has had time to learn
+		if(closingStart == 0 && now_ms() >= 2000) closingStart = model_cycle();
+
+		// Main loop - scan, then normal path decides on the completed scan
+		if(!usarray_scan_busy()) {
+			count = usarray_schedule(now_ms(), sensors, SCHED_BATCH);
+			if(count > 0) usarray_scan_start(sensors, count);
+		}
+		if(usarray_scan_poll()) {
+			usarray_update_ranges(sensors, count);
+			usarray_track(sensors, count, now_ms());
+			if(!emergency && !decided && closingStart > 0 && front_obstacle()) {
+				mpSetMotorSpeed(PLATFORM_DIR_LEFT, SPEED_TURN_FAST, SPEED_TURN_FAST);
+				decided = 1;
+				decidedEcho = (echoCycle[sensorMap[SENSOR_FRONT_RIGHT]] - echoCycle[sensorMap[SENSOR_FRONT_LEFT]] < 0x80000000) ? echoCycle[sensorMap[SENSOR_FRONT_RIGHT]] : echoCycle[sensorMap[SENSOR_FRONT_LEFT]];
+			}
+		}
+
+		// Host keeps waypoints queued for the 3pi
+		while(get_tx_count(&UartBuffRobot) < QUEUED) mpSetPos(100, 200, 300);
+
+		// Line to 3pi drains at its baud rate, interrupt refills TX FIFO as it empties
+		model_step(POLL_CYCLES);
+		for(credit += POLL_CYCLES; credit >= BYTE_CYCLES; credit -= BYTE_CYCLES) {
+			uart_model_transmit(ROBOT, 1);
+			if(uart_model_enabled(ROBOT) && (uart_model_status(UartBuffRobot.uart.RegBaseAddress) & XUL_SR_TX_FIFO_EMPTY)) InterruptHandler_UART(&UartBuffRobot);
+		}
+
+		// Split line into commands, command has arrived once its last byte is out
+		while((taken = uart_model_take(ROBOT, line, sizeof(line))) > 0) {
+			for(i = 0; i < taken; i++) {
+				if(frameLength == 0) frameWanted = mpCommandLength(line[i]);
+				frame[frameLength++] = line[i];
+				if(frameLength < frameWanted) continue;
+				if(decided && memcmp(frame, command, 4) == 0) sentCycle = model_cycle();
+				frameLength = 0;
+			}
+		}
+	}
+
+	CHECK(decided);
+	CHECK(sentCycle > 0);
+
+	// Leave acquisition idle for next path
+	usarray_set_capture_handler(NULL);
+	while(usarray_scan_busy()) {
+		model_step(POLL_CYCLES);
+		usarray_scan_poll();
+	}
+	return sentCycle - decidedEcho;
+}
+
+static void test_estop_latency() {
+	static const u8 stop[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_FORWARD, 0, 0};
+	static const u8 turn[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_LEFT, SPEED_TURN_FAST, SPEED_TURN_FAST};
+	u32 estop = run_path(1, stop) / MODEL_CLOCK;
+	u32 drive = run_path(0, turn) / MODEL_CLOCK;
+
+	CHECK(estop < drive);
+	printf("estop: echo to stop command sent %u us, echo to turn command sent by normal path %u us, behind %d queued bytes at 57600 baud\n", estop, drive, QUEUED);
+}
+
+int main() {
+	test_estop_latency();
+
+	return test_result("estop");
+}
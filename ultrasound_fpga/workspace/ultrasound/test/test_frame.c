@@ -0,0 +1,207 @@
+#include <string.h>
+
+#include "test.h"
+#include "xstatus.h"
+#include "frame.h"
+#include "telemetry.h"
+#include "uart_model.h"
+
+// Byte stuffing and CRC against known vectors and a bitwise reference, then telemetry frames as the host receives them off the line
+
+#define DEVICE 0 // Model device carrying telemetry
+#define RING 512 // Telemetry TX ring (bytes)
+#define CHANNEL 3 // Channel used by telemetry test
+
+// Linker script provides bounds of LMB BRAM data, mempool_init isn't used on host so anything will do
+char __lmb_bss_start[1];
+char __lmb_bss_end[1];
+
+// CRC-16/CCITT a bit at a time, straight from the polynomial
+static unsigned short crc_reference(const unsigned char *data, int length, unsigned short crc) {
+	int i;
+	int bit;
+
+	for(i = 0; i < length; i++) {
+		crc ^= data[i] << 8;
+		for(bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+static void test_crc() {
+	unsigned char data[64];
+	unsigned short crc;
+	int missed = 0;
+	int length;
+	int bit;
+	int i;
+
+	// Check value for CRC-16/CCITT-FALSE
+	CHECK(frame_crc16((const unsigned char *) "123456789", 9, FRAME_CRC_INIT) == 0x29B1);
+	CHECK(frame_crc16(data, 0, FRAME_CRC_INIT) == FRAME_CRC_INIT);
+
+	for(length = 1; length < (int) sizeof(data); length++) {
+		for(i = 0; i < length; i++) data[i] = test_noise(128);
+		crc = frame_crc16(data, length, FRAME_CRC_INIT);
+
+		// Table free version matches polynomial, and can be run over a frame in pieces
+		CHECK(crc == crc_reference(data, length, FRAME_CRC_INIT));
+		CHECK(crc == frame_crc16(&data[length / 2], length - length / 2, frame_crc16(data, length / 2, FRAME_CRC_INIT)));
+
+		// Every single bit error is caught
+		for(bit = 0; bit < length * 8; bit++) {
+			data[bit / 8] ^= 1 << (bit % 8);
+			missed += (frame_crc16(data, length, FRAME_CRC_INIT) == crc);
+			data[bit / 8] ^= 1 << (bit % 8);
+		}
+	}
+	CHECK(missed == 0);
+}
+
+// Encode to expected bytes then decode back
+static void check_cobs(const unsigned char *data, int length, const unsigned char *expected, int expectedLength) {
+	unsigned char encoded[16];
+	unsigned char decoded[16];
+	int count = frame_cobs_encode(data, length, encoded);
+
+	CHECK(count == expectedLength && memcmp(encoded, expected, count) == 0);
+	CHECK(frame_cobs_decode(encoded, count, decoded) == length && memcmp(decoded, data, length) == 0);
+}
+
+static void test_cobs() {
+	static unsigned char data[1024];
+	static unsigned char encoded[FRAME_ENCODED_MAX(1024)];
+	static unsigned char decoded[1024];
+	int zeros = 0;
+	int length;
+	int density;
+	int count;
+	int i;
+
+	// Examples from the COBS paper
+	check_cobs((const unsigned char *) "\x00", 1, (const unsigned char *) "\x01\x01", 2);
+	check_cobs((const unsigned char *) "\x00\x00", 2, (const unsigned char *) "\x01\x01\x01", 3);
+	check_cobs((const unsigned char *) "\x00\x11\x00", 3, (const unsigned char *) "\x01\x02\x11\x01", 4);
+	check_cobs((const unsigned char *) "\x11\x22\x00\x33", 4, (const unsigned char *) "\x03\x11\x22\x02\x33", 5);
+	check_cobs((const unsigned char *) "\x11\x22\x33\x44", 4, (const unsigned char *) "\x05\x11\x22\x33\x44", 5);
+	check_cobs((const unsigned char *) "\x11\x00\x00\x00", 4, (const unsigned char *) "\x02\x11\x01\x01\x01", 5);
+	check_cobs(data, 0, (const unsigned char *) "\x01", 1);
+
+	// Runs either side of 254 non-zero bytes, where a block fills up without a zero to end it
+	for(length = 250; length < 260; length++) {
+		for(i = 0; i < length; i++) data[i] = 1 + i % 255;
+		count = frame_cobs_encode(data, length, encoded);
+		CHECK(encoded[0] == ((length >= 254) ? 0xFF : length + 1));
+		CHECK(count <= FRAME_ENCODED_MAX(length));
+		CHECK(frame_cobs_decode(encoded, count, decoded) == length && memcmp(decoded, data, length) == 0);
+	}
+
+	// Random data from no zeros to all zeros, encoded form has none and decodes in place
+	for(length = 0; length <= (int) sizeof(data); length += 1 + length / 8) {
+		for(density = 0; density <= 256; density += 32) {
+			for(i = 0; i < length; i++) {
+				data[i] = test_noise(127) + 128;
+				if((test_noise(127) + 128) < density) data[i] = 0;
+			}
+			count = frame_cobs_encode(data, length, encoded);
+			CHECK(count <= FRAME_ENCODED_MAX(length));
+			for(i = 0; i < count; i++) zeros += (encoded[i] == 0);
+			CHECK(frame_cobs_decode(encoded, count, encoded) == length && memcmp(encoded, data, length) == 0);
+		}
+	}
+	CHECK(zeros == 0);
+
+	// Block running past end of data, or a zero inside it, is malformed rather than read beyond buffer
+	CHECK(frame_cobs_decode((const unsigned char *) "\x05\x11\x22", 3, decoded) == -1);
+	CHECK(frame_cobs_decode((const unsigned char *) "\x03\x11\x00", 3, decoded) == -1);
+	CHECK(frame_cobs_decode((const unsigned char *) "\x02\x11\x00\x22", 4, decoded) == -1);
+}
+
+// Split line into frames at delimiters and check each as host does, returns frames found
+static int host_frames(const unsigned char *line, int length, u8 *sequences, u32 *times, int *bad) {
+	static unsigned char frame[TELEM_FRAME_MAX];
+	int frames = 0;
+	int start = 0;
+	int count;
+	int i;
+
+	for(i = 0; i < length; i++) {
+		if(line[i] != FRAME_DELIMITER) continue;
+		if(i > start) {
+			count = frame_cobs_decode(&line[start], i - start, frame);
+			if(count < TELEM_HEADER_LEN + 2 || frame_crc16(frame, count - 2, FRAME_CRC_INIT) != (frame[count - 2] | (frame[count - 1] << 8)) || frame[0] != CHANNEL) {
+				(*bad)++;
+			} else {
+				sequences[frames] = frame[1];
+				times[frames] = frame[2] | (frame[3] << 8) | (frame[4] << 16) | ((u32) frame[5] << 24);
+				frames++;
+			}
+		}
+		start = i + 1;
+	}
+	return frames;
+}
+
+static void test_telemetry() {
+	static uart_buff buf;
+	static unsigned char line[4096];
+	u8 payload[TELEM_PAYLOAD_MAX];
+	u8 sequences[64];
+	u32 times[64];
+	u32 sentTimes[64];
+	u32 now = 0;
+	int sent = 0;
+	int dropped = 0;
+	int limited = 0;
+	int bad = 0;
+	int frames;
+	int length;
+	int i;
+
+	uart_model_reset();
+	CHECK(init_uart_buffers(DEVICE, &buf, RING, 16) == XST_SUCCESS);
+	CHECK(init_telemetry(&buf) == XST_SUCCESS);
+	telem_set_interval(CHANNEL, 10);
+
+	// Payloads full of zeros and delimiter-like bytes, offered faster than rate limit allows and faster than line drains
+	for(i = 0; i < 48; i++) {
+		memset(payload, (i & 1) ? FRAME_DELIMITER : 0xFF, sizeof(payload));
+		payload[0] = i;
+		if(telem_send(CHANNEL, payload, TELEM_PAYLOAD_MAX, UART_PRIORITY_NORMAL, now) == 1) {
+			sentTimes[sent++] = now;
+		} else if(telem_ready(CHANNEL, now)) {
+			dropped++;
+		} else {
+			limited++;
+		}
+		now += 5;
+		if(i % 16 == 15) while(uart_model_transmit(DEVICE, UART_MODEL_FIFO) > 0 || get_tx_count(&buf) > 0) InterruptHandler_UART(&buf);
+	}
+	while(uart_model_transmit(DEVICE, UART_MODEL_FIFO) > 0 || get_tx_count(&buf) > 0) InterruptHandler_UART(&buf);
+	length = uart_model_take(DEVICE, line, sizeof(line));
+
+	// Every frame sent arrives whole and checked, numbered without gaps as dropped frames don't use up a sequence number
+	frames = host_frames(line, length, sequences, times, &bad);
+	CHECK(bad == 0);
+	CHECK(frames == sent);
+	CHECK(dropped > 0 && limited > 0);
+	for(i = 0; i < frames; i++) {
+		CHECK(sequences[i] == (u8) i);
+		CHECK(times[i] == sentTimes[i]);
+		if(i > 0) CHECK(times[i] - times[i - 1] >= 10);
+	}
+
+	// Oversized payload and unknown channel are refused
+	CHECK(telem_send(CHANNEL, payload, TELEM_PAYLOAD_MAX + 1, UART_PRIORITY_NORMAL, now + 100) == -1);
+	CHECK(telem_ready(TELEM_CHANNEL_MAX, now + 100) == 0);
+
+	printf("frame: %d of 48 telemetry frames sent (%d rate limited, %d dropped with buffer full), %d received, %d bad\n", sent, limited, dropped, frames, bad);
+}
+
+int main() {
+	test_crc();
+	test_cobs();
+	test_telemetry();
+
+	return test_result("frame");
+}
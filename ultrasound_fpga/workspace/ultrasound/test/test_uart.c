@@ -0,0 +1,395 @@
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "test.h"
+#include "xstatus.h"
+#include "uart.h"
+#include "mobplat.h"
+#include "uart_model.h"
+
+// Runs the UART rings against the UART Lite model, interrupt handler called wherever the hardware could interrupt
+
+#define DEVICE 0 // Model device used by each test
+#define ROBOT 1 // Model device carrying robot commands
+#define RING 64 // Ring size for stress test (bytes)
+#define STRESS_BYTES (1 << 20) // Bytes sent each way by stress test
+
+// Linker script provides bounds of LMB BRAM data, mempool_init isn't used on host so anything will do
+char __lmb_bss_start[1];
+char __lmb_bss_end[1];
+
+// Byte at position of a stream, period is not a power of 2 so a slip by any ring or FIFO size shows up
+static u8 stream_byte(unsigned int position) {
+	return (position * 7 + position / 251) & 0xFF;
+}
+
+// Interrupt as hardware raises it - bytes waiting or TX FIFO empty, and only while enabled
+static void interrupt(uart_buff *buf) {
+	if(uart_model_enabled(DEVICE) && (uart_model_status(buf->uart.RegBaseAddress) & (XUL_SR_RX_FIFO_VALID_DATA | XUL_SR_TX_FIFO_EMPTY))) {
+		InterruptHandler_UART(buf);
+	}
+}
+
+// Every byte written comes out of the line in order, however full the ring, and indexes keep working as they wrap past 2^32
+static void test_ring_edges() {
+	static uart_buff buf;
+	u8 data[3 * 16];
+	u8 line[UART_MODEL_FIFO * 2];
+	unsigned int written = 0;
+	unsigned int sent = 0;
+	unsigned int received = 0;
+	unsigned int read = 0;
+	int lost = 0;
+	int full = 0;
+	int empty = 0;
+	int count;
+	int round;
+	int i;
+
+	uart_model_reset();
+	CHECK(init_uart_buffers(DEVICE, &buf, 16, 16) == XST_SUCCESS);
+	buf.headTX = buf.tailTX = 0xFFFFFFF0;
+	buf.headRX = buf.tailRX = 0xFFFFFFF0;
+
+	for(round = 0; round < 200; round++) {
+		// TX - fill FIFO and ring, anything beyond is refused and flagged
+		count = 1 + (round * 5) % (int) sizeof(data);
+		for(i = 0; i < count; i++) data[i] = stream_byte(written + i);
+		i = uart_write(&buf, (char *) data, count);
+		CHECK(i <= count);
+		written += i;
+		if(get_tx_space(&buf) == 0) {
+			full++;
+			CHECK(uart_putchar(&buf, stream_byte(written)) == -1);
+			CHECK(buf.overflowTX);
+			buf.overflowTX = 0;
+			CHECK(uart_write(&buf, (char *) data, 1) == 0);
+		}
+
+		// Line drains some of FIFO, handler refills it from ring
+		uart_model_transmit(DEVICE, round % 20);
+		interrupt(&buf);
+		count = uart_model_take(DEVICE, line, sizeof(line));
+		for(i = 0; i < count; i++) lost += (line[i] != stream_byte(sent + i));
+		sent += count;
+
+		// RX - line delivers bytes, stopping once ring is full as flow control would
+		count = round % 40;
+		for(i = 0; i < count && get_rx_count(&buf) < 16; i++) {
+			uart_model_arrive(DEVICE, stream_byte(received++));
+			interrupt(&buf);
+		}
+		if(get_rx_count(&buf) == 16) full++;
+
+		// Main loop reads in odd sized pieces, down to empty every so often
+		count = (round % 3 == 0) ? (int) sizeof(data) : round % 7;
+		count = uart_read(&buf, (char *) data, count);
+		for(i = 0; i < count; i++) lost += (data[i] != stream_byte(read + i));
+		read += count;
+		if(round % 3 == 0 && uart_model_rx_space(DEVICE) == UART_MODEL_FIFO) {
+			CHECK(get_rx_count(&buf) == 0);
+			CHECK(uart_getchar(&buf) == -1);
+			CHECK(uart_read(&buf, (char *) data, 1) == 0);
+			empty++;
+		}
+		if(get_rx_count(&buf) > 0) {
+			i = uart_getchar(&buf);
+			lost += (i != stream_byte(read));
+			read++;
+		}
+	}
+
+	// Drain everything still held
+	while(uart_model_transmit(DEVICE, UART_MODEL_FIFO) > 0 || get_tx_count(&buf) > 0) {
+		interrupt(&buf);
+		count = uart_model_take(DEVICE, line, sizeof(line));
+		for(i = 0; i < count; i++) lost += (line[i] != stream_byte(sent + i));
+		sent += count;
+	}
+	while(get_rx_count(&buf) > 0) {
+		count = uart_read(&buf, (char *) data, sizeof(data));
+		for(i = 0; i < count; i++) lost += (data[i] != stream_byte(read + i));
+		read += count;
+	}
+
+	CHECK(lost == 0);
+	CHECK(!buf.overflowRX);
+	CHECK(sent == written);
+	CHECK(read == received);
+	CHECK(buf.headTX < 0xFFFFFFF0 && buf.headRX < 0xFFFFFFF0);
+	CHECK(full > 0 && empty > 0);
+
+	// Byte arriving at a full ring is dropped rather than left blocking the FIFO, bytes already held are untouched
+	for(i = 0; i < 16; i++) {
+		uart_model_arrive(DEVICE, stream_byte(received++));
+		interrupt(&buf);
+	}
+	CHECK(get_rx_count(&buf) == 16);
+	CHECK(!buf.overflowRX);
+	uart_model_arrive(DEVICE, 0);
+	interrupt(&buf);
+	CHECK(get_rx_count(&buf) == 16);
+	CHECK(uart_model_rx_space(DEVICE) == UART_MODEL_FIFO);
+	CHECK(buf.overflowRX);
+	count = uart_read(&buf, (char *) data, sizeof(data));
+	CHECK(count == 16);
+	for(i = 0; i < count; i++) lost += (data[i] != stream_byte(read + i));
+	CHECK(lost == 0);
+
+	printf("uart rings: %u bytes each way through 16 byte rings, full %d times, empty %d times\n", written, full, empty);
+}
+
+// Stress test - interrupt handler runs on its own thread, hardware side and line side are only touched while it holds the interrupt
+static uart_buff stressBuf;
+static u8 stressLine[STRESS_BYTES];
+static volatile unsigned int stressSent;
+static volatile int stressStop;
+
+static void *stress_interrupts(void *arg) {
+	unsigned int seed = 7;
+	unsigned int arrived = 0;
+	int count;
+
+	while(!stressStop) {
+		uart_model_isr_enter(DEVICE);
+
+		// Line moves a random number of bytes each way, sender stops while ring is nearly full as flow control would
+		seed = seed * 1103515245 + 12345;
+		uart_model_transmit(DEVICE, (seed >> 16) % (UART_MODEL_FIFO + 1));
+		seed = seed * 1103515245 + 12345;
+		count = (seed >> 16) % (UART_MODEL_FIFO + 1);
+		while(count-- > 0 && arrived < STRESS_BYTES && get_rx_count(&stressBuf) < RING - UART_MODEL_FIFO && uart_model_rx_space(DEVICE) > 0) {
+			uart_model_arrive(DEVICE, stream_byte(arrived++));
+		}
+		interrupt(&stressBuf);
+		stressSent += uart_model_take(DEVICE, &stressLine[stressSent], STRESS_BYTES - stressSent);
+
+		uart_model_isr_leave(DEVICE);
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+// Main loop moves random sized pieces through rings, bulk calls or a byte at a time, returns nanoseconds spent in calls per byte moved
+static double ring_stress(int bulk) {
+	pthread_t thread;
+	u8 data[RING];
+	unsigned int written = 0;
+	unsigned int read = 0;
+	unsigned int moved;
+	unsigned int i;
+	int lost = 0;
+	int count;
+	int r;
+	double start;
+	double began;
+	double busy = 0;
+	double overhead;
+	int timings = 0;
+
+	// Cost of reading clock itself, taken off each timed call
+	began = test_clock();
+	for(i = 0; i < 1000; i++) test_clock();
+	overhead = (test_clock() - began) / 1000;
+
+	uart_model_reset();
+	CHECK(init_uart_buffers(DEVICE, &stressBuf, RING, RING) == XST_SUCCESS);
+	stressSent = 0;
+	stressStop = 0;
+	pthread_create(&thread, NULL, stress_interrupts, NULL);
+
+	// Main loop writes and reads while handler runs whenever it likes, only time in UART calls is counted
+	start = test_clock();
+	while((written < STRESS_BYTES || read < STRESS_BYTES) && test_clock() - start < 60e9) {
+		moved = written + read;
+		r = test_noise(RING);
+		count = (r < 0) ? -r : r;
+		if(written + count > STRESS_BYTES) count = STRESS_BYTES - written;
+		for(i = 0; i < (unsigned int) count; i++) data[i] = stream_byte(written + i);
+		began = test_clock();
+		if(bulk) {
+			written += uart_write(&stressBuf, (char *) data, count);
+		} else {
+			for(i = 0; i < (unsigned int) count && uart_putchar(&stressBuf, data[i]) == 1; i++);
+			written += i;
+		}
+		busy += test_clock() - began;
+		timings++;
+
+		began = test_clock();
+		if(bulk) {
+			count = uart_read(&stressBuf, (char *) data, RING);
+		} else {
+			for(count = 0; count < RING && (r = uart_getchar(&stressBuf)) >= 0; count++) data[count] = r;
+		}
+		busy += test_clock() - began;
+		timings++;
+		for(i = 0; i < (unsigned int) count; i++) lost += (data[i] != stream_byte(read + i));
+		read += count;
+
+		// Nothing to do until handler has run, give it the processor rather than spin
+		if(written + read == moved) sched_yield();
+	}
+
+	// Let line finish sending
+	while(stressSent < written && test_clock() - start < 60e9) sched_yield();
+	stressStop = 1;
+	pthread_join(thread, NULL);
+
+	for(i = 0; i < stressSent; i++) lost += (stressLine[i] != stream_byte(i));
+	CHECK(written == STRESS_BYTES);
+	CHECK(read == STRESS_BYTES);
+	CHECK(stressSent == STRESS_BYTES);
+	CHECK(lost == 0);
+	CHECK(!stressBuf.overflowRX);
+
+	return (busy - timings * overhead) / (written + read);
+}
+
+static void test_ring_stress() {
+	double single = ring_stress(0);
+	double bulk = ring_stress(1);
+
+	// Bulk calls check space and kick transmitter once per piece rather than once per byte
+	CHECK(bulk < single);
+
+	printf("uart stress: %d bytes each way through %d byte rings with handler on another thread, %.1f ns per byte through uart_putchar/uart_getchar, %.1f ns through uart_write/uart_read, %.1fx faster\n", STRESS_BYTES, RING, single, bulk, single / bulk);
+}
+
+// Queue robot commands - three position commands then a speed command and a beep, 23 bytes
+static int queue_commands(u8 *queued) {
+	static const u8 speed[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_FORWARD, 60, 60};
+	int length = 0;
+	int i;
+
+	for(i = 0; i < 3; i++) {
+		mpSetPos(100 * i, 200, 300);
+		queued[length] = PLATFORM_CMD_SET_POS;
+		memcpy(&queued[length + 1], &(short[3]) {100 * i, 200, 300}, 6);
+		length += 7;
+	}
+	mpSetMotorSpeed(speed[1], speed[2], speed[3]);
+	memcpy(&queued[length], speed, 4);
+	length += 4;
+	mpBeep();
+	queued[length++] = PLATFORM_CMD_BEEP;
+
+	return length;
+}
+
+#define PASSTHROUGH_COMMAND 40 // Bytes in robot command passed through from host, more than two TX FIFOs
+
+// Command filling TX FIFO and most of robot buffer, for when there is no room to put anything in front of it
+#define LONG_COMMAND (BUFFER_SIZE_TX + UART_MODEL_FIFO - 2)
+
+static int long_command(char c) {
+	return LONG_COMMAND;
+}
+
+// Line and interrupt handler for robot UART, run on their own thread
+static u8 robotLine[2 * LONG_COMMAND];
+static volatile int robotLength;
+static volatile int robotStop;
+
+static void *drain_robot(void *arg) {
+	while(!robotStop) {
+		uart_model_isr_enter(ROBOT);
+		uart_model_transmit(ROBOT, 1);
+		if(uart_model_enabled(ROBOT)) InterruptHandler_UART(&UartBuffRobot);
+		robotLength += uart_model_take(ROBOT, &robotLine[robotLength], sizeof(robotLine) - robotLength);
+		uart_model_isr_leave(ROBOT);
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+// Emergency stop goes in after whole commands, never splitting one already on its way out
+static void test_putfront() {
+	static const u8 stop[4] = {PLATFORM_CMD_SET_MOTOR_SPD, PLATFORM_DIR_FORWARD, 0, 0};
+	pthread_t thread;
+	u8 queued[LONG_COMMAND];
+	u8 expected[64];
+	u8 line[64];
+	int queuedLength;
+	int length;
+	int discard;
+
+	for(discard = 0; discard < 2; discard++) {
+		uart_model_reset();
+		CHECK(init_uart_buffers(ROBOT, &UartBuffRobot, BUFFER_SIZE_TX, BUFFER_SIZE_RX) == XST_SUCCESS);
+		UartBuffRobot.frameLengthTX = mpCommandLength;
+
+		// First byte starts UART, once it is out handler fills TX FIFO leaving third position command part sent
+		queuedLength = queue_commands(queued);
+		uart_model_transmit(ROBOT, 1);
+		InterruptHandler_UART(&UartBuffRobot);
+		CHECK(get_tx_count(&UartBuffRobot) == queuedLength - 1 - UART_MODEL_FIFO);
+		CHECK(UartBuffRobot.frameRemainTX == 3 * 7 - 1 - UART_MODEL_FIFO);
+
+		// Line sees FIFO, rest of that command, stop, then queued commands unless dropped
+		if(discard) mpEmergencyStop();
+		else CHECK(uart_putfront(&UartBuffRobot, (const char *) stop, 4, 0) == 1);
+		memcpy(expected, queued, 3 * 7);
+		memcpy(&expected[3 * 7], stop, 4);
+		length = 3 * 7 + 4;
+		if(!discard) {
+			memcpy(&expected[length], &queued[3 * 7], queuedLength - 3 * 7);
+			length += queuedLength - 3 * 7;
+		}
+
+		while(uart_model_transmit(ROBOT, UART_MODEL_FIFO) > 0 || get_tx_count(&UartBuffRobot) > 0) InterruptHandler_UART(&UartBuffRobot);
+		CHECK(uart_model_take(ROBOT, line, sizeof(line)) == length);
+		CHECK(memcmp(line, expected, length) == 0);
+	}
+
+	// Command passed through from host has an opcode of unknown length whose arguments look like commands, stop can't go in until it has gone
+	uart_model_reset();
+	CHECK(init_uart_buffers(ROBOT, &UartBuffRobot, BUFFER_SIZE_TX, BUFFER_SIZE_RX) == XST_SUCCESS);
+	UartBuffRobot.frameLengthTX = mpCommandLength;
+	for(length = 0; length < PASSTHROUGH_COMMAND; length++) queued[length] = (length == 0) ? 0x40 : PLATFORM_CMD_SET_POS - (length & 3);
+	CHECK(uart_write(&UartBuffRobot, (const char *) queued, PASSTHROUGH_COMMAND) == PASSTHROUGH_COMMAND);
+	uart_model_transmit(ROBOT, UART_MODEL_FIFO);
+	InterruptHandler_UART(&UartBuffRobot);
+	CHECK(get_tx_count(&UartBuffRobot) == PASSTHROUGH_COMMAND - 2 * UART_MODEL_FIFO);
+	CHECK(uart_putfront(&UartBuffRobot, (const char *) stop, 4, 1) == -1);
+	mpEmergencyStop();
+	memcpy(expected, queued, PASSTHROUGH_COMMAND);
+	memcpy(&expected[PASSTHROUGH_COMMAND], stop, 4);
+	while(uart_model_transmit(ROBOT, UART_MODEL_FIFO) > 0 || get_tx_count(&UartBuffRobot) > 0) InterruptHandler_UART(&UartBuffRobot);
+	CHECK(uart_model_take(ROBOT, line, sizeof(line)) == PASSTHROUGH_COMMAND + 4);
+	CHECK(memcmp(line, expected, PASSTHROUGH_COMMAND + 4) == 0);
+
+	// Once it has all gone boundaries are known again
+	CHECK(UartBuffRobot.frameRemainTX == 0);
+	CHECK(uart_putfront(&UartBuffRobot, (const char *) stop, 4, 1) == 1);
+
+	// Command being sent too long to leave room in front, stop waits for room behind it while line drains
+	uart_model_reset();
+	CHECK(init_uart_buffers(ROBOT, &UartBuffRobot, BUFFER_SIZE_TX, BUFFER_SIZE_RX) == XST_SUCCESS);
+	UartBuffRobot.frameLengthTX = long_command;
+	memset(queued, 0x55, sizeof(queued));
+	for(length = 0; length < LONG_COMMAND; length += uart_write(&UartBuffRobot, (const char *) queued, LONG_COMMAND - length));
+	CHECK(uart_putfront(&UartBuffRobot, (const char *) stop, 4, 1) == -1);
+	robotLength = 0;
+	robotStop = 0;
+	pthread_create(&thread, NULL, drain_robot, NULL);
+	mpEmergencyStop();
+	while(robotLength < LONG_COMMAND + 4) sched_yield();
+	robotStop = 1;
+	pthread_join(thread, NULL);
+	CHECK(robotLength == LONG_COMMAND + 4);
+	CHECK(memcmp(&robotLine[LONG_COMMAND], stop, 4) == 0);
+
+	printf("uart putfront: emergency stop sent after %d bytes of part sent command, queued commands kept or dropped as asked, sent behind %d byte command of unknown length and behind %d byte command with no room in front\n", 3 * 7 - 1 - UART_MODEL_FIFO, PASSTHROUGH_COMMAND, LONG_COMMAND);
+}
+
+int main() {
+	test_ring_edges();
+	test_ring_stress();
+	test_putfront();
+
+	return test_result("uart");
+}
@@ -0,0 +1,127 @@
+#include "test.h"
+#include "us_receiver.h"
+#include "us_receiver_model.h"
+
+// Replays us_receiver_test.v against the C transcription of the sequencer, through the real driver so command encoding is covered too
+
+#define SAMPLE_PERIOD 1250 // us_receiver clock cycles, US_RX_PERIOD
+#define ABORT_DELAY 6250 // Bench sends abort 62.5uS after sample request
+
+static u32 sampleCycles[1024]; // Cycle each sample was taken at
+static int sampleCount;
+
+static unsigned short record_sample(u8 sensor, u32 sinceFire) {
+	// Sample value is its own index so gaps and repeats show up
+	sampleCycles[sampleCount & 1023] = model_cycle();
+	return sampleCount++;
+}
+
+// Everything sequencer writes within a number of cycles
+static int collect(u32 *words, int max, int cycles) {
+	int count = 0;
+	int invalid;
+	u32 word;
+
+	while(cycles-- > 0) {
+		model_step(1);
+		word = model_fsl_nget(&invalid);
+		if(!invalid && count < max) words[count++] = word;
+	}
+
+	return count;
+}
+
+static int count_type(const u32 *words, int count, int type) {
+	int found = 0;
+	int i;
+
+	for(i = 0; i < count; i++) found += ((int) ((words[i] >> 1) & 0x7) == type);
+	return found;
+}
+
+static void test_bench() {
+	u32 words[256];
+	u8 status;
+	u8 type;
+	u32 data;
+	int count;
+	int reads;
+	int i;
+
+	model_reset(record_sample);
+	sampleCount = 0;
+
+	// Echo command comes straight back
+	sendUSEcho(0xAAAAAAA);
+	readUSData(&status, &type, &data);
+	CHECK(status == US_STATUS_OK && type == US_RESP_ECHO && data == 0xAAAAAAA);
+
+	// Two samples with no period set, sequencer waits a full 4096 cycle timer between them
+	sendUSCommand(US_COMM_SAMPLE, 0x0000025);
+	count = collect(words, 256, 10000);
+	CHECK(count == 2 && count_type(words, count, US_RESP_SAMPLE) == 2);
+	CHECK(model_state() == MODEL_IDLE);
+
+	// Driver builds the bench's 100 sample request word
+	model_reset(record_sample);
+	sampleCount = 0;
+	sendUSSampleRequest(5, 100, SAMPLE_PERIOD);
+	model_step(1);
+	CHECK(model_state() == MODEL_READ_INPUT || model_state() == MODEL_PROCESS_COMMAND);
+
+	// Abort after about five samples
+	count = collect(words, 256, ABORT_DELAY);
+	reads = model_reads();
+	sendUSAbort();
+	count += collect(&words[count], 256 - count, 100000);
+
+	// Sample responses stop, then a single acknowledgement, and abort is read exactly once
+	CHECK(count_type(words, count, US_RESP_SAMPLE) == 5);
+	CHECK(count_type(words, count, US_RESP_NONE) == 1);
+	CHECK(count > 0 && ((words[count - 1] >> 1) & 0x7) == US_RESP_NONE);
+	CHECK(model_reads() == reads + 1);
+	CHECK(model_state() == MODEL_IDLE);
+	CHECK(model_samples() == 5);
+
+	// Samples were taken a period apart and returned in order
+	for(i = 1; i < 5; i++) CHECK(sampleCycles[i] - sampleCycles[i - 1] == SAMPLE_PERIOD);
+	for(i = 0; i < 5; i++) CHECK((words[i] >> 4) == (u32) i);
+
+	// Sequencer takes commands again
+	sendUSEcho(0x1234567);
+	readUSData(&status, &type, &data);
+	CHECK(type == US_RESP_ECHO && data == 0x1234567);
+
+	printf("us_receiver: bench abort after %d cycles returned %d samples then acknowledgement\n", ABORT_DELAY, count_type(words, count, US_RESP_SAMPLE));
+}
+
+static void test_abort_timing() {
+	u32 words[256];
+	int count;
+	int delay;
+	int samples;
+
+	// Whenever abort lands, even mid conversion or after capture has finished, samples stop and exactly one acknowledgement follows
+	for(delay = 0; delay < 4 * SAMPLE_PERIOD; delay += 97) {
+		model_reset(record_sample);
+		sampleCount = 0;
+		sendUSSampleRequest(5, 3, SAMPLE_PERIOD);
+		count = collect(words, 256, delay);
+		sendUSAbort();
+		count += collect(&words[count], 256 - count, 10 * SAMPLE_PERIOD);
+
+		samples = count_type(words, count, US_RESP_SAMPLE);
+		CHECK(samples == model_samples());
+		CHECK(samples <= 3);
+		CHECK(count == samples + 1);
+		CHECK(((words[count - 1] >> 1) & 0x7) == US_RESP_NONE);
+		CHECK(model_state() == MODEL_IDLE);
+	}
+}
+
+int main() {
+	test_bench();
+	test_abort_timing();
+
+	return test_result("us_receiver");
+}
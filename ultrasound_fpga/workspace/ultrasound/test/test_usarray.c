@@ -0,0 +1,414 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "xstatus.h"
+#include "usarray.h"
+#include "us_receiver_model.h"
+
+// Runs the acquisition engine and ranging against the us_receiver model, sensors hearing a synthetic scene
+
+#define BIAS 512 // ADC counts - middle of 10-bit range
+#define CARRIER 0.04 // Cycles per uS
+#define BURST (US_TX_COUNT / CARRIER) // Transmitted burst length (uS)
+#define STRETCH 50 // Time transducer stretches an echo by (uS)
+#define SOUND 0.343 // Speed of sound (mm per uS)
+#define POLL_CYCLES 2000 // FSL clock cycles between calls to usarray_scan_poll, one main loop pass
+#define MAX_POLLS 10000 // Give up on a scan after this many passes
+#define STACK_DETECT_TRIALS 64 // Stacked captures ranged at each stacking depth
+
+static const u8 sensorMap[US_SENSOR_COUNT] = US_SENSOR_MAP;
+
+// Scene - every transducer rings down after firing, echoes are per sensor address (0 for none)
+static double sceneRingdown; // Ringdown amplitude as burst ends (ADC counts)
+static double sceneRingdownTime; // Ringdown time constant (uS)
+static double sceneRange[16]; // Echo range (mm)
+static double sceneAmplitude[16]; // Echo amplitude (ADC counts)
+static int sceneNoise; // Uniform noise either side of bias (ADC counts)
+
+static unsigned short scene_sample(u8 address, u32 sinceFire) {
+	double t = sinceFire / (double) MODEL_CLOCK;
+	double v = BIAS + test_noise(sceneNoise);
+	double e;
+
+	// Transducer keeps ringing at carrier frequency after burst
+	if(t < 20 * sceneRingdownTime) v += sceneRingdown * exp(-t / sceneRingdownTime) * cos(2 * M_PI * CARRIER * t);
+
+	// Echo arrives after round trip, rising and falling as transducer follows burst
+	if(sceneRange[address] > 0) {
+		e = t - 2 * sceneRange[address] / SOUND;
+		if(e >= 0 && e < BURST + STRETCH) v += sceneAmplitude[address] * (0.5 - 0.5 * cos(2 * M_PI * e / (BURST + STRETCH))) * cos(2 * M_PI * CARRIER * e);
+	}
+
+	return (v < 0) ? 0 : (v > 1023) ? 1023 : (unsigned short) lround(v);
+}
+
+static void set_echo(u8 sensor, double range, double amplitude) {
+	sceneRange[sensorMap[sensor]] = range;
+	sceneAmplitude[sensorMap[sensor]] = amplitude;
+}
+
+static void setup() {
+	int i;
+
+	// Quiet scene with a long ringdown, as real transducers have
+	sceneRingdown = 300;
+	sceneRingdownTime = 200;
+	sceneNoise = 3;
+	for(i = 0; i < 16; i++) sceneRange[i] = 0;
+
+	model_reset(scene_sample);
+	CHECK(init_usarray() == XST_SUCCESS);
+}
+
+// Whole scan as main loop drives it, returns FSL clock cycles taken
+static u32 run_scan(u8 *sensors, int count) {
+	u32 start = model_cycle();
+	int polls = 0;
+
+	CHECK(usarray_scan_start(sensors, count) == XST_SUCCESS);
+	while(!usarray_scan_poll() && ++polls < MAX_POLLS) model_step(POLL_CYCLES);
+	CHECK(!usarray_scan_busy());
+
+	usarray_update_ranges(sensors, count);
+	return model_cycle() - start;
+}
+
+static void test_stream_ringdown() {
+	u8 sensor = SENSOR_FRONT_LEFT;
+	u32 quiet = 0;
+	u32 echo = 0;
+	int aborts;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	usarray_set_stream_range(1000);
+
+	// Ringdown stays above envelope trigger for 500uS, well past blanking, but must never stop a capture - baseline learns it meanwhile
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(&sensor, 1);
+	for(i = 0; i < 8; i++) quiet += run_scan(&sensor, 1);
+	CHECK(model_aborts() == 0);
+	CHECK(usarray_distance_fine(sensor) < 0);
+
+	// Echo within streaming range stops capture once it has passed, and is still ranged
+	set_echo(sensor, 300, 200);
+	aborts = model_aborts();
+	for(i = 0; i < 8; i++) {
+		echo += run_scan(&sensor, 1);
+		CHECK(usarray_distance(sensor) > 270 && usarray_distance(sensor) < 330);
+
+		// Rest of aborted capture is padded with channel's bias learnt from quiet captures, not the ringdown and echo heard so far
+		CHECK(usWaveformData[sensor][US_RX_COUNT - 1] == BIAS);
+	}
+	CHECK(model_aborts() == aborts + 8);
+	CHECK(echo < quiet);
+
+	// Echo beyond streaming range leaves capture alone
+	set_echo(sensor, 400, 200);
+	aborts = model_aborts();
+	usarray_set_stream_range(350);
+	for(i = 0; i < 8; i++) run_scan(&sensor, 1);
+	CHECK(model_aborts() == aborts);
+	CHECK(usarray_distance(sensor) > 370 && usarray_distance(sensor) < 430);
+
+	printf("streaming: quiet scan %u us, echo at 300mm %u us\n", quiet / 8 / MODEL_CLOCK, echo / 8 / MODEL_CLOCK);
+}
+
+// Ranges every capture handed over, as main loop's collision check does
+static int handled;
+
+static void count_handled(u8 sensor) {
+	usarray_update_ranges(&sensor, 1);
+	handled++;
+}
+
+// Root mean square of published waveform about bias, over samples first to last - 1
+static double waveform_rms(const unsigned short *waveform, int first, int last) {
+	double sum = 0;
+	int i;
+
+	for(i = first; i < last; i++) sum += (waveform[i] - BIAS) * (double) (waveform[i] - BIAS);
+	return sqrt(sum / (last - first));
+}
+
+// Largest departure of published waveform from bias, over samples first to last - 1
+static int waveform_peak(const unsigned short *waveform, int first, int last) {
+	int peak = 0;
+	int i;
+
+	for(i = first; i < last; i++) {
+		if(abs(waveform[i] - BIAS) > peak) peak = abs(waveform[i] - BIAS);
+	}
+	return peak;
+}
+
+static void test_stacking() {
+	u8 sensor = SENSOR_FRONT_RIGHT;
+	const us_scan_result *result;
+	int rxCount = US_RX_COUNT;
+	int split = rxCount * 9 / 20; // 900uS near band at default profile
+	double plain;
+	double stacked = 0;
+	int peak = 0;
+	int scans;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	usarray_set_capture_handler(count_handled);
+
+	// Baseline learnt from single captures in a quiet room
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(&sensor, 1);
+
+	// Weak near echo in heavy noise comes and goes, so near band stacks deeper than far band
+	sceneNoise = 30;
+	set_echo(sensor, 120, 20);
+	usarray_set_stacking(1);
+	for(scans = 0; scans < 256; scans++) run_scan(&sensor, 1);
+	handled = 0;
+	for(scans = 0; scans < 256; scans++) {
+		run_scan(&sensor, 1);
+		result = usarray_publish(&sensor, 1);
+		i = waveform_peak(result->waveform[sensor], 0, split);
+		if(i > peak) peak = i;
+	}
+
+	// Pings only completing a band still accumulating aren't ranged again, and ringdown is removed just once from each average
+	CHECK(usarray_stack_depth(sensor, 0) > 1);
+	CHECK(handled > 0 && handled < scans);
+	CHECK(peak < 100);
+	printf("stacking: near band depth %d, %d of %d pings ranged, largest departure from bias %d\n", usarray_stack_depth(sensor, 0), handled, scans, peak);
+
+	// Weak far echo, noise after it falls as far band stacks deeper
+	usarray_set_stacking(0);
+	sceneNoise = 20;
+	set_echo(sensor, 300, 24);
+	for(scans = 0; scans < 16; scans++) run_scan(&sensor, 1);
+	result = usarray_publish(&sensor, 1);
+	plain = waveform_rms(result->waveform[sensor], rxCount * 4 / 5, rxCount);
+
+	usarray_set_stacking(1);
+	for(scans = 0; scans < 256; scans++) run_scan(&sensor, 1);
+	for(scans = 0; scans < 64; scans++) {
+		run_scan(&sensor, 1);
+		result = usarray_publish(&sensor, 1);
+		stacked += waveform_rms(result->waveform[sensor], rxCount * 4 / 5, rxCount) / 64;
+	}
+	CHECK(usarray_stack_depth(sensor, 1) > 2);
+	CHECK(stacked < plain * 0.75);
+	printf("stacking: far band depth %d, noise %.1f counts rms unstacked, %.1f stacked\n", usarray_stack_depth(sensor, 1), plain, stacked);
+
+	usarray_set_capture_handler(NULL);
+	usarray_set_stacking(0);
+}
+
+// Ranges every capture handed over and counts those finding echo near detectRange
+static int detected;
+static double detectRange;
+
+static void count_detected(u8 sensor) {
+	int i;
+
+	count_handled(sensor);
+	for(i = 0; i < usarray_echo_count(sensor); i++) {
+		if(fabs(usarray_echo_distance(sensor, i) - detectRange) < 30) {
+			detected++;
+			break;
+		}
+	}
+}
+
+// Detection probability of a far echo barely above the noise, with stacking depth held at each K in turn
+static void test_stacking_detection() {
+	u8 sensor = SENSOR_LEFT_FRONT;
+	double rate[STACK_MAX_SHIFT + 1];
+	int shift;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	usarray_set_capture_handler(count_detected);
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(&sensor, 1);
+
+	// Echo would clear envelope trigger easily on its own, but in single pings noise crossings ahead of it fill the echo table
+	sceneNoise = 80;
+	detectRange = 300;
+	set_echo(sensor, detectRange, 48);
+	usarray_set_stacking(1);
+	for(shift = 0; shift <= STACK_MAX_SHIFT; shift++) {
+		CHECK(usarray_set_stack_limits(shift, shift) == XST_SUCCESS);
+		handled = 0;
+		detected = 0;
+		for(i = 0; i < STACK_DETECT_TRIALS << shift; i++) run_scan(&sensor, 1);
+		CHECK(usarray_stack_depth(sensor, 1) == 1 << shift);
+		CHECK(handled == STACK_DETECT_TRIALS);
+		rate[shift] = detected / (double) handled;
+		printf("stacking: K %2d detects echo in %3.0f%% of ranged captures\n", 1 << shift, 100 * rate[shift]);
+	}
+
+	// Stacking pulls an echo lost in single pings out of the noise
+	CHECK(rate[0] < 0.5);
+	CHECK(rate[STACK_MAX_SHIFT] > 0.9);
+	for(shift = 1; shift <= STACK_MAX_SHIFT; shift++) CHECK(rate[shift] >= rate[shift - 1] - 0.1);
+
+	// Limits out of range are refused
+	CHECK(usarray_set_stack_limits(2, 1) == XST_FAILURE);
+	CHECK(usarray_set_stack_limits(0, STACK_MAX_SHIFT + 1) == XST_FAILURE);
+
+	usarray_set_stack_limits(0, STACK_MAX_SHIFT);
+	usarray_set_capture_handler(NULL);
+	usarray_set_stacking(0);
+}
+
+// Tracker coasting through dropouts as an obstacle closes in, then picking up again after a long gap
+static void test_track_coast() {
+	u8 sensor = SENSOR_FRONT_LEFT;
+	u32 now = 0;
+	double range;
+	int rate;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(&sensor, 1);
+
+	// Closing at 1 m/s, one ping every 10ms
+	for(range = 400; range > 150; range -= 10) {
+		set_echo(sensor, range, 200);
+		run_scan(&sensor, 1);
+		now += 10;
+		usarray_track(&sensor, 1, now);
+	}
+	rate = usarray_track_rate(sensor);
+	CHECK(rate < -5000);
+	CHECK(usarray_detect_obstacle(sensor, 250));
+
+	// Echo lost, prediction runs past zero but obstacle is nearer than ever rather than gone
+	set_echo(sensor, 0, 0);
+	for(i = 0; i < TRACK_MAX_MISSES; i++) {
+		run_scan(&sensor, 1);
+		now += 250;
+		usarray_track(&sensor, 1, now);
+		CHECK(usarray_detect_obstacle(sensor, 100));
+	}
+	CHECK(usarray_track_distance(sensor) == 0);
+	CHECK(usarray_ttc(sensor) == 0);
+
+	// Long gap drops the old track instead of predicting from it, next measurement starts afresh
+	set_echo(sensor, 300, 200);
+	run_scan(&sensor, 1);
+	now += 3600000;
+	usarray_track(&sensor, 1, now);
+	CHECK(usarray_track_rate(sensor) == 0);
+	CHECK(usarray_track_distance(sensor) > 270 && usarray_track_distance(sensor) < 330);
+
+	printf("tracking: closing at %d mm/s, obstacle held at 0 mm through %d dropped pings\n", -rate / 10, TRACK_MAX_MISSES);
+}
+
+// Obstacle keeping pace with platform sits at constant range for a long time, tracking must not learn it as chassis
+static void test_baseline_tracking() {
+	u8 sensor = SENSOR_REAR_LEFT;
+	int found = 0;
+	int drift;
+	int residual;
+	int scans;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(&sensor, 1);
+
+	// Echo well inside baseline region for many tracking time constants
+	usarray_set_baseline_tracking(1);
+	set_echo(sensor, 150, 100);
+	for(scans = 0; scans < 32 << BASELINE_SHIFT; scans++) {
+		run_scan(&sensor, 1);
+		if(usarray_echo_count(sensor) > 0 && usarray_echo_distance(sensor, 0) > 130 && usarray_echo_distance(sensor, 0) < 170) found++;
+	}
+	CHECK(found == scans);
+
+	// Small ringdown drift while moving, too little to be taken for an echo, is still followed
+	set_echo(sensor, 0, 0);
+	sceneNoise = 0;
+	sceneRingdown = 330;
+	run_scan(&sensor, 1);
+	drift = waveform_peak(usarray_publish(&sensor, 1)->waveform[sensor], 0, US_RX_COUNT);
+	for(i = 0; i < 8 << BASELINE_SHIFT; i++) run_scan(&sensor, 1);
+	residual = waveform_peak(usarray_publish(&sensor, 1)->waveform[sensor], 0, US_RX_COUNT);
+	CHECK(usarray_echo_count(sensor) == 0);
+	CHECK(residual < drift / 2);
+
+	printf("baseline tracking: echo at 150mm found in %d of %d pings while moving, ringdown drift %d counts tracked down to %d\n", found, scans, drift, residual);
+
+	usarray_set_baseline_tracking(0);
+}
+
+// Settings sent mid scan are accepted but wait for scan to finish, so buffers and stacks never change under a capture
+static void test_pending_settings() {
+	u8 sensors[3] = {SENSOR_RIGHT_MID, SENSOR_REAR_RIGHT, SENSOR_LEFT_MID};
+	unsigned short *waveform;
+	u32 sequence;
+	int polls = 0;
+	int found = 0;
+	int i;
+
+	setup();
+	usarray_set_ranging(US_RANGING_ENVELOPE);
+	for(i = 0; i < 3; i++) set_echo(sensors[i], 300, 200);
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) run_scan(sensors, 3);
+
+	// Part way into a scan
+	sequence = usarray_scan_sequence();
+	CHECK(usarray_scan_start(sensors, 3) == XST_SUCCESS);
+	while(polls < 4) {
+		usarray_scan_poll();
+		model_step(POLL_CYCLES);
+		polls++;
+	}
+	CHECK(usarray_scan_busy());
+
+	// Shorter capture on first sensor in pool moves every later sensor's buffer
+	waveform = usWaveformData[SENSOR_LEFT_MID];
+	CHECK(usarray_set_profile(SENSOR_RIGHT_MID, US_RX_COUNT / 2, US_RX_PERIOD, US_TX_COUNT) == XST_SUCCESS);
+	CHECK(usarray_set_pair(SENSOR_LEFT_MID, SENSOR_LEFT_REAR) == XST_SUCCESS);
+	usarray_set_stacking(1);
+	CHECK(usarray_get_profile(SENSOR_RIGHT_MID)->rxCount == US_RX_COUNT / 2);
+	CHECK(usarray_get_pair(SENSOR_LEFT_MID) == SENSOR_LEFT_REAR);
+	CHECK(usarray_get_stacking());
+
+	// Scan finishes on settings it started with
+	while(!usarray_scan_poll() && ++polls < MAX_POLLS) {
+		CHECK(usWaveformData[SENSOR_LEFT_MID] == waveform);
+		model_step(POLL_CYCLES);
+	}
+	CHECK(!usarray_scan_busy());
+	CHECK(usarray_scan_sequence() == sequence + 1);
+	CHECK(usWaveformData[SENSOR_LEFT_MID] != waveform);
+	CHECK(model_lost() == 0);
+	usarray_update_ranges(sensors, 3);
+
+	// New settings run from next scan, other sensors keep ranging once baseline is learnt again
+	for(i = 0; i < BASELINE_LEARN_PINGS; i++) {
+		run_scan(sensors, 3);
+		if(usarray_echo_count(SENSOR_REAR_RIGHT) > 0 && usarray_echo_distance(SENSOR_REAR_RIGHT, 0) > 270 && usarray_echo_distance(SENSOR_REAR_RIGHT, 0) < 330) found++;
+	}
+	CHECK(usarray_publish(sensors, 3)->rxCount[SENSOR_RIGHT_MID] == US_RX_COUNT / 2);
+	CHECK(found == i);
+
+	printf("pending settings: applied after scan of %d polls, echo found in %d of %d scans on new layout\n", polls, found, i);
+
+	usarray_set_pair(SENSOR_LEFT_MID, SENSOR_LEFT_MID);
+	usarray_set_stacking(0);
+}
+
+int main() {
+	test_stream_ringdown();
+	test_stacking();
+	test_stacking_detection();
+	test_track_coast();
+	test_baseline_tracking();
+	test_pending_settings();
+
+	return test_result("usarray");
+}
@@ -0,0 +1,282 @@
+#include <math.h>
+
+#include "test.h"
+#include "usdsp.h"
+
+#define SAMPLE_RATE 80000 // Hz - default profile, exactly 2x carrier
+#define SAMPLE_RATE_IQ (100000000 / 1875) // Hz - quadrature profile, US_RX_PERIOD_IQ
+#define CARRIER_STEP M_PI // Carrier phase between samples at default profile (radians)
+#define CARRIER_STEP_IQ (1.5 * M_PI) // Carrier phase between samples at quadrature profile (radians)
+#define CAPTURE 200 // Samples - default profile
+#define BIAS 512 // ADC counts - middle of 10-bit range
+#define BURST 8 // Carrier cycles transmitted
+#define RAMP 4 // Samples transducer stretches echo by
+#define BLANK 16 // Samples ignored after transmission, MATCHED_BLANK_TIME at default profile
+#define MIN_CONFIDENCE 48 // MATCHED_MIN_CONFIDENCE
+#define ENVELOPE_TRIGGER 8 // ENVELOPE_TRIGGER
+#define MM_PER_SAMPLE 2.14 // One way range covered by a sample at default profile and room temperature
+#define SENSORS 10 // Sensors in a full scan
+#define REPEATS 1000 // Scans timed for each benchmark
+
+// Ringdown then a single echo arriving at sample position echo (may fall between samples), phase is carrier phase as echo arrives (radians)
+static void make_capture(unsigned short *x, int count, double echo, int amplitude, double phase, int noise, double step) {
+	int burst = (BURST * 2 * M_PI) / step;
+	int n;
+	double t;
+	double v;
+	double envelope;
+
+	for(n = 0; n < count; n++) {
+		v = BIAS + test_noise(noise);
+
+		// Transmit coupling dies away over first few samples
+		if(n < BLANK) v += 300 * exp(-n / 4.0) * cos(n * step);
+
+		// Transducer bandwidth smooths the burst into a raised cosine a few samples longer than transmitted
+		t = n - echo;
+		if(t >= 0 && t < burst + RAMP) {
+			envelope = 0.5 - 0.5 * cos(2 * M_PI * t / (burst + RAMP));
+			v += amplitude * envelope * cos(t * step + phase);
+		}
+
+		x[n] = (v < 0) ? 0 : (v > 1023) ? 1023 : (unsigned short) lround(v);
+	}
+}
+
+static void test_matched_filter() {
+	unsigned short x[CAPTURE];
+	signed short ref[USDSP_REF_MAX];
+	unsigned int corr[CAPTURE];
+	usdsp_peak peak;
+	int refLen = usdsp_build_reference(ref, SAMPLE_RATE, BURST);
+	int echo;
+	int worst = 0;
+	int i;
+
+	// Reference is the burst itself, alternating at 2x carrier
+	CHECK(refLen == 16);
+	for(i = 0; i < refLen; i++) CHECK(ref[i] == ((i & 1) ? -USDSP_REF_SCALE : USDSP_REF_SCALE));
+
+	// Echo well above noise is found wherever it lands, reference lines up with middle of the stretched echo
+	for(echo = BLANK + 4; echo < CAPTURE - refLen - RAMP; echo += 3) {
+		make_capture(x, CAPTURE, echo, 40, 0, 10, CARRIER_STEP);
+		usdsp_correlate(x, CAPTURE, usdsp_mean(x, CAPTURE), ref, refLen, corr);
+		usdsp_find_peak(corr, CAPTURE - refLen + 1, BLANK, &peak);
+
+		CHECK(peak.index >= echo && peak.index <= echo + RAMP);
+		CHECK(peak.confidence >= MIN_CONFIDENCE);
+		if(peak.index - echo > worst) worst = peak.index - echo;
+	}
+
+	// Noise alone stays under confidence needed to report an echo
+	make_capture(x, CAPTURE, CAPTURE, 0, 0, 10, CARRIER_STEP);
+	usdsp_correlate(x, CAPTURE, usdsp_mean(x, CAPTURE), ref, refLen, corr);
+	usdsp_find_peak(corr, CAPTURE - refLen + 1, BLANK, &peak);
+	CHECK(peak.confidence < MIN_CONFIDENCE);
+
+	printf("matched filter: worst offset %d samples, noise only confidence %d\n", worst, peak.confidence);
+}
+
+// Sub-sample echo position from parabolic fit to envelope peak, as usarray_walk_echoes() does it, expressed in Q8
+static int envelope_position(const unsigned short *x, unsigned short *mag, int interpolate) {
+	unsigned short threshold[CAPTURE];
+	int delayQ8 = ((2 * BURST + (1 << USDSP_ENV_SHIFT) - 1) << 8) / 2;
+	int peakIndex;
+	int i;
+
+	for(i = 0; i < CAPTURE; i++) threshold[i] = ENVELOPE_TRIGGER;
+	usdsp_demodulate(x, CAPTURE, mag);
+	peakIndex = usdsp_find_envelope_peak(mag, CAPTURE, BLANK + (1 << USDSP_ENV_SHIFT), threshold); // Averaging window smears ringdown past blanking
+	if(peakIndex < 0) return -1;
+
+	return (interpolate ? usdsp_interpolate_peak(mag, CAPTURE, peakIndex) : peakIndex << 8) - delayQ8;
+}
+
+static void test_envelope_interpolation() {
+	unsigned short x[CAPTURE];
+	unsigned short mag[CAPTURE];
+	double echo;
+	double error;
+	double sum[2] = {0, 0};
+	double sumSquares[2] = {0, 0};
+	double spread[2];
+	int trials = 0;
+	int interpolate;
+	int position;
+
+	// Sweep echo across a whole sample at several ranges, carrier kept in step with sampling so only the envelope moves
+	for(echo = 30; echo < 150; echo += 1.0 / 16) {
+		for(interpolate = 0; interpolate < 2; interpolate++) {
+			make_capture(x, CAPTURE, echo, 100, M_PI * echo, 2, CARRIER_STEP);
+			position = envelope_position(x, mag, interpolate);
+			CHECK(position >= 0);
+
+			error = position / 256.0 - echo;
+			sum[interpolate] += error;
+			sumSquares[interpolate] += error * error;
+		}
+		trials++;
+	}
+
+	// Echo stretching gives a fixed offset which calibration absorbs, precision is the spread about it as echo moves between samples
+	for(interpolate = 0; interpolate < 2; interpolate++) spread[interpolate] = sqrt(sumSquares[interpolate] / trials - (sum[interpolate] / trials) * (sum[interpolate] / trials));
+	CHECK(spread[1] < 0.2);
+	CHECK(spread[1] < spread[0] / 2);
+
+	printf("envelope: precision %.2f samples (%.2f mm) interpolated, %.2f samples (%.2f mm) whole index, offset %.2f samples\n",
+			spread[1], spread[1] * MM_PER_SAMPLE, spread[0], spread[0] * MM_PER_SAMPLE, sum[1] / trials);
+}
+
+// Generic envelope detector for comparison - biquad band pass on carrier, rectify, then one pole low pass
+static void rectify_lowpass(const unsigned short *x, int count, const int *coef, unsigned short *mag) {
+	int x1 = x[0];
+	int x2 = x[0];
+	int y1 = 0;
+	int y2 = 0;
+	int env = 0;
+	int y;
+	int n;
+
+	for(n = 0; n < count; n++) {
+		// Band pass has no gain at DC so bias drops out (coefficients Q14, b1 is zero and b2 is -b0)
+		y = (coef[0] * (x[n] - x2) - coef[1] * y1 - coef[2] * y2) >> 14;
+		x2 = x1;
+		x1 = x[n];
+		y2 = y1;
+		y1 = y;
+
+		// Mean of a rectified sine is 2 / pi of its amplitude, scale back up by 201 / 128
+		env += ((((y < 0) ? -y : y) << 4) - env) >> 2;
+		mag[n] = (env * 201) >> 11;
+	}
+}
+
+static void build_bandpass(int sampleRate, int *coef) {
+	// Constant peak gain band pass centred on carrier (or its alias), Q of 2
+	double w = 2 * M_PI * USDSP_CARRIER_FREQ / sampleRate;
+	double alpha = fabs(sin(w)) / 4;
+
+	coef[0] = lround(16384 * alpha / (1 + alpha));
+	coef[1] = lround(16384 * -2 * cos(w) / (1 + alpha));
+	coef[2] = lround(16384 * (1 - alpha) / (1 + alpha));
+}
+
+static unsigned short peak_of(const unsigned short *mag, int count, int start) {
+	unsigned short peak = 0;
+	int n;
+
+	for(n = start; n < count; n++) if(mag[n] > peak) peak = mag[n];
+	return peak;
+}
+
+// Echo magnitude as carrier phase moves relative to the samples, and host cost of each demodulator over a full scan
+static void bench_demodulate() {
+	static unsigned short x[SENSORS][CAPTURE];
+	unsigned short mag[CAPTURE];
+	int coef[3];
+	double phase;
+	double low[3] = {1e9, 1e9, 1e9};
+	double high[3] = {0, 0, 0};
+	double cost[3];
+	double start;
+	double level;
+	int method;
+	int r;
+	int s;
+
+	build_bandpass(SAMPLE_RATE_IQ, coef);
+
+	// Peak magnitude of an echo of amplitude 100, relative to that amplitude
+	for(phase = 0; phase < 2 * M_PI; phase += M_PI / 32) {
+		for(method = 0; method < 3; method++) {
+			make_capture(x[0], CAPTURE, 60, 100, phase, 0, (method == 0) ? CARRIER_STEP : CARRIER_STEP_IQ);
+			if(method == 0) usdsp_demodulate(x[0], CAPTURE, mag);
+			else if(method == 1) usdsp_demodulate_iq(x[0], CAPTURE, mag);
+			else rectify_lowpass(x[0], CAPTURE, coef, mag);
+
+			level = peak_of(mag, CAPTURE, BLANK + (1 << USDSP_ENV_SHIFT)) / 100.0;
+			if(level < low[method]) low[method] = level;
+			if(level > high[method]) high[method] = level;
+		}
+	}
+
+	// In-phase only magnitude fades completely, quadrature holds up whatever the phase
+	CHECK(low[0] < 0.1);
+	CHECK(low[1] > 0.85 && high[1] < 1.1);
+
+	for(method = 0; method < 3; method++) {
+		for(s = 0; s < SENSORS; s++) make_capture(x[s], CAPTURE, 30 + 12 * s, 100, 0, 10, (method == 0) ? CARRIER_STEP : CARRIER_STEP_IQ);
+
+		start = test_clock();
+		for(r = 0; r < REPEATS; r++) {
+			for(s = 0; s < SENSORS; s++) {
+				if(method == 0) usdsp_demodulate(x[s], CAPTURE, mag);
+				else if(method == 1) usdsp_demodulate_iq(x[s], CAPTURE, mag);
+				else rectify_lowpass(x[s], CAPTURE, coef, mag);
+			}
+		}
+		cost[method] = (test_clock() - start) / REPEATS / 1000;
+	}
+
+	printf("demodulate: in-phase %.2f to %.2f of amplitude, %.1f us per scan\n", low[0], high[0], cost[0]);
+	printf("demodulate: quadrature %.2f to %.2f of amplitude, %.1f us per scan\n", low[1], high[1], cost[1]);
+	printf("demodulate: rectify and low pass %.2f to %.2f of amplitude, %.1f us per scan\n", low[2], high[2], cost[2]);
+	printf("demodulate: band pass biquad costs %.1fx in-phase, %.1fx quadrature\n", cost[2] / cost[0], cost[2] / cost[1]);
+}
+
+// Host cost of correlating and searching a full scan, only meaningful relative to other kernels
+static void bench_matched_filter() {
+	static unsigned short x[SENSORS][CAPTURE];
+	signed short ref[USDSP_REF_MAX];
+	unsigned int corr[CAPTURE];
+	usdsp_peak peak;
+	int refLen = usdsp_build_reference(ref, SAMPLE_RATE, BURST);
+	int found = 0;
+	double start;
+	int r;
+	int s;
+
+	for(s = 0; s < SENSORS; s++) make_capture(x[s], CAPTURE, 30 + 12 * s, 40, 0, 10, CARRIER_STEP);
+
+	start = test_clock();
+	for(r = 0; r < REPEATS; r++) {
+		for(s = 0; s < SENSORS; s++) {
+			usdsp_correlate(x[s], CAPTURE, usdsp_mean(x[s], CAPTURE), ref, refLen, corr);
+			usdsp_find_peak(corr, CAPTURE - refLen + 1, BLANK, &peak);
+			found += (peak.confidence >= MIN_CONFIDENCE);
+		}
+	}
+
+	CHECK(found == REPEATS * SENSORS);
+	printf("matched filter: %.1f us per %d sensor scan on host\n", (test_clock() - start) / REPEATS / 1000, SENSORS);
+}
+
+// Host cost of the envelope path over a full scan (demodulate, find peak, interpolate), to set against the matched filter
+static void bench_envelope() {
+	static unsigned short x[SENSORS][CAPTURE];
+	unsigned short mag[CAPTURE];
+	int found = 0;
+	double start;
+	int r;
+	int s;
+
+	for(s = 0; s < SENSORS; s++) make_capture(x[s], CAPTURE, 30 + 12 * s, 40, M_PI * (30 + 12 * s), 10, CARRIER_STEP);
+
+	start = test_clock();
+	for(r = 0; r < REPEATS; r++) {
+		for(s = 0; s < SENSORS; s++) found += (envelope_position(x[s], mag, 1) >= 0);
+	}
+
+	CHECK(found == REPEATS * SENSORS);
+	printf("envelope: %.1f us per %d sensor scan on host\n", (test_clock() - start) / REPEATS / 1000, SENSORS);
+}
+
+int main() {
+	test_matched_filter();
+	bench_matched_filter();
+	bench_envelope();
+	test_envelope_interpolation();
+	bench_demodulate();
+
+	return test_result("usdsp");
+}
@@ -0,0 +1,147 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "wavecodec.h"
+
+// Waveforms coded in chunks as OutputUSArray sends them and decoded as the host does, exact inside region of interest and coarse outside it
+
+#define CAPTURE 400 // Samples - longest capture coded
+#define CHUNK 146 // Coded bytes per frame, WAVEFORM_CODED_MAX
+#define BIAS 512 // ADC counts - middle of 10-bit range
+#define SHIFT_MAX 8 // WAVEFORM_SHIFT_MAX
+
+// Ringdown, an echo and noise, carrier alternating sign between samples as at default profile
+static void make_waveform(unsigned short *x, int count, int echo, int noise) {
+	double v;
+	int n;
+
+	for(n = 0; n < count; n++) {
+		v = BIAS + test_noise(noise);
+		v += 400 * exp(-n / 12.0) * ((n & 1) ? -1 : 1);
+		if(n >= echo && n < echo + 24) v += 200 * sin(M_PI * (n - echo) / 24) * ((n & 1) ? -1 : 1);
+		x[n] = (v < 0) ? 0 : (v > 1023) ? 1023 : (unsigned short) lround(v);
+	}
+}
+
+// Code and decode whole capture a chunk at a time, returns coded bytes, worst error inside and outside region of interest
+static int round_trip(const unsigned short *x, int count, int roiStart, int roiEnd, int shift, int *inside, int *outside, int *chunks) {
+	unsigned char data[CHUNK];
+	unsigned short y;
+	wavecodec_state codec;
+	int bytes = 0;
+	int sample = 0;
+	int taken;
+	int length;
+	int error;
+	int i;
+
+	*inside = 0;
+	*outside = 0;
+	*chunks = 0;
+	while(sample < count) {
+		// Board - as many samples as fit, codec started afresh for each chunk
+		wavecodec_start(&codec, data, CHUNK, sample, roiStart, roiEnd, shift);
+		taken = 0;
+		while(sample + taken < count && wavecodec_encode(&codec, x[sample + taken]) == 0) taken++;
+		length = wavecodec_finish(&codec);
+		CHECK(taken > 0 && length <= CHUNK);
+
+		// Host - told first sample and count in chunk header
+		wavecodec_start(&codec, data, length, sample, roiStart, roiEnd, shift);
+		for(i = sample; i < sample + taken; i++) {
+			CHECK(wavecodec_decode(&codec, &y) == 0);
+			error = abs((int) y - (int) x[i]);
+			if(i >= roiStart && i < roiEnd) {
+				if(error > *inside) *inside = error;
+			} else {
+				if(error > *outside) *outside = error;
+			}
+		}
+
+		sample += taken;
+		bytes += length;
+		(*chunks)++;
+	}
+
+	return bytes;
+}
+
+static void test_lossless() {
+	unsigned short x[CAPTURE];
+	int inside;
+	int outside;
+	int chunks;
+	int bytes;
+	int noise;
+
+	// Whole capture exact when shift is 0, whatever the noise
+	for(noise = 0; noise <= 64; noise += 8) {
+		make_waveform(x, CAPTURE, 150, noise);
+		bytes = round_trip(x, CAPTURE, 0, CAPTURE, 0, &inside, &outside, &chunks);
+		CHECK(inside == 0 && outside == 0);
+		if(noise == 8) printf("wavecodec: %.2f bits per sample exact with noise of 8 counts, %d chunks\n", bytes * 8.0 / CAPTURE, chunks);
+	}
+
+	// Full scale swings every sample escape to raw values and still come back exact
+	for(bytes = 0; bytes < CAPTURE; bytes++) x[bytes] = ((bytes / 2) & 1) ? 1023 : 0;
+	round_trip(x, CAPTURE, 0, CAPTURE, 0, &inside, &outside, &chunks);
+	CHECK(inside == 0 && outside == 0);
+}
+
+static void test_region_of_interest() {
+	unsigned short x[CAPTURE];
+	int roi[][2] = {{0, 0}, {150 - 16, 150 + 48}, {0, 64}, {CAPTURE - 40, CAPTURE}, {140, 141}, {120, 300}};
+	int exact;
+	int coarse;
+	int inside;
+	int outside;
+	int chunks;
+	int shift;
+	int r;
+
+	make_waveform(x, CAPTURE, 150, 8);
+	exact = round_trip(x, CAPTURE, 0, CAPTURE, 0, &inside, &outside, &chunks);
+
+	// Shift only costs bottom bits outside region, rebuilt to middle of range they stand for - region may straddle chunks or be empty
+	for(shift = 1; shift <= SHIFT_MAX; shift++) {
+		for(r = 0; r < (int) (sizeof(roi) / sizeof(roi[0])); r++) {
+			coarse = round_trip(x, CAPTURE, roi[r][0], roi[r][1], shift, &inside, &outside, &chunks);
+			CHECK(inside == 0);
+			CHECK(outside <= (1 << (shift - 1)));
+			CHECK(coarse <= exact);
+		}
+	}
+
+	// Compression gained with a typical region, as firmware would send it
+	coarse = round_trip(x, CAPTURE, 150 - 16, 150 + 48, 4, &inside, &outside, &chunks);
+	printf("wavecodec: %d bytes exact, %d bytes with shift of 4 outside 64 sample region, worst error outside %d\n", exact, coarse, outside);
+}
+
+static void test_truncated() {
+	unsigned short x[CAPTURE];
+	unsigned char data[CHUNK];
+	unsigned short y;
+	wavecodec_state codec;
+	int taken = 0;
+	int length;
+	int decoded = 0;
+
+	// Decoder given fewer bytes than were coded runs out rather than reading beyond them
+	make_waveform(x, CAPTURE, 150, 16);
+	wavecodec_start(&codec, data, CHUNK, 0, 0, CAPTURE, 0);
+	while(wavecodec_encode(&codec, x[taken]) == 0) taken++;
+	length = wavecodec_finish(&codec);
+	wavecodec_start(&codec, data, length / 2, 0, 0, CAPTURE, 0);
+	while(decoded < taken && wavecodec_decode(&codec, &y) == 0) decoded++;
+	CHECK(decoded < taken);
+	CHECK(codec.length <= length / 2);
+}
+
+int main() {
+	test_lossless();
+	test_region_of_interest();
+	test_truncated();
+
+	return test_result("wavecodec");
+}
@@ -0,0 +1,145 @@
+#include "uart_model.h"
+
+#include <pthread.h>
+
+#include "xuartlite.h"
+#include "xuartlite_l.h"
+
+#define MODEL_LINE 4096 // Transmitted bytes held until taken
+
+typedef struct uart_model {
+	u8 rx[UART_MODEL_FIFO];
+	int rxHead;
+	int rxCount;
+	u8 tx[UART_MODEL_FIFO];
+	int txHead;
+	int txCount;
+	u8 line[MODEL_LINE];
+	int lineCount;
+	int enabled;
+	int masked; // Set while firmware has interrupts disabled and holds lock
+	pthread_mutex_t lock; // Held by running handler, or by firmware while interrupts are disabled
+} uart_model;
+
+static uart_model models[UART_MODEL_DEVICES];
+
+static uart_model *uart_model_at(u32 base) {
+	return &models[((base - UART_MODEL_BASE) / UART_MODEL_STRIDE) % UART_MODEL_DEVICES];
+}
+
+void uart_model_reset() {
+	int i;
+
+	for(i = 0; i < UART_MODEL_DEVICES; i++) {
+		models[i].rxHead = models[i].rxCount = 0;
+		models[i].txHead = models[i].txCount = 0;
+		models[i].lineCount = 0;
+		models[i].enabled = 0;
+		models[i].masked = 0;
+		pthread_mutex_init(&models[i].lock, NULL);
+	}
+}
+
+u32 uart_model_status(u32 base) {
+	uart_model *m = uart_model_at(base);
+	u32 status = 0;
+
+	if(m->rxCount > 0) status |= XUL_SR_RX_FIFO_VALID_DATA;
+	if(m->rxCount == UART_MODEL_FIFO) status |= XUL_SR_RX_FIFO_FULL;
+	if(m->txCount == 0) status |= XUL_SR_TX_FIFO_EMPTY;
+	if(m->txCount == UART_MODEL_FIFO) status |= XUL_SR_TX_FIFO_FULL;
+	return status;
+}
+
+void uart_model_write(u32 base, u32 offset, u32 data) {
+	uart_model *m = uart_model_at(base);
+
+	// Writes to a full FIFO are lost, as in hardware
+	if(offset != XUL_TX_FIFO_OFFSET || m->txCount == UART_MODEL_FIFO) return;
+	m->tx[(m->txHead + m->txCount++) % UART_MODEL_FIFO] = data;
+}
+
+u8 uart_model_recv(u32 base) {
+	uart_model *m = uart_model_at(base);
+	u8 c;
+
+	if(m->rxCount == 0) return 0;
+	c = m->rx[m->rxHead];
+	m->rxHead = (m->rxHead + 1) % UART_MODEL_FIFO;
+	m->rxCount--;
+	return c;
+}
+
+int uart_model_arrive(int device, u8 c) {
+	uart_model *m = &models[device];
+
+	if(m->rxCount == UART_MODEL_FIFO) return 0;
+	m->rx[(m->rxHead + m->rxCount++) % UART_MODEL_FIFO] = c;
+	return 1;
+}
+
+int uart_model_transmit(int device, int max) {
+	uart_model *m = &models[device];
+	int moved = 0;
+
+	while(moved < max && m->txCount > 0 && m->lineCount < MODEL_LINE) {
+		m->line[m->lineCount++] = m->tx[m->txHead];
+		m->txHead = (m->txHead + 1) % UART_MODEL_FIFO;
+		m->txCount--;
+		moved++;
+	}
+	return moved;
+}
+
+int uart_model_take(int device, u8 *data, int max) {
+	uart_model *m = &models[device];
+	int count = (m->lineCount < max) ? m->lineCount : max;
+	int i;
+
+	for(i = 0; i < count; i++) data[i] = m->line[i];
+	for(i = count; i < m->lineCount; i++) m->line[i - count] = m->line[i];
+	m->lineCount -= count;
+	return count;
+}
+
+int uart_model_rx_space(int device) {
+	return UART_MODEL_FIFO - models[device].rxCount;
+}
+
+int uart_model_enabled(int device) {
+	return models[device].enabled;
+}
+
+void uart_model_isr_enter(int device) {
+	pthread_mutex_lock(&models[device].lock);
+}
+
+void uart_model_isr_leave(int device) {
+	pthread_mutex_unlock(&models[device].lock);
+}
+
+int XUartLite_Initialize(XUartLite *InstancePtr, u16 DeviceId) {
+	if(DeviceId >= UART_MODEL_DEVICES) return XST_FAILURE;
+	InstancePtr->RegBaseAddress = UART_MODEL_BASE + DeviceId * UART_MODEL_STRIDE;
+	InstancePtr->IsReady = 1;
+	return XST_SUCCESS;
+}
+
+void XUartLite_EnableInterrupt(XUartLite *InstancePtr) {
+	uart_model *m = uart_model_at(InstancePtr->RegBaseAddress);
+
+	m->enabled = 1;
+	if(m->masked) {
+		m->masked = 0;
+		pthread_mutex_unlock(&m->lock);
+	}
+}
+
+void XUartLite_DisableInterrupt(XUartLite *InstancePtr) {
+	uart_model *m = uart_model_at(InstancePtr->RegBaseAddress);
+
+	// Waits out a handler already running on another thread, as masking on the MicroBlaze can't happen mid interrupt
+	pthread_mutex_lock(&m->lock);
+	m->masked = 1;
+	m->enabled = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef UART_MODEL_H_
+#define UART_MODEL_H_
+
+#include "xil_types.h"
+
+// UART Lite as firmware sees it - 16 byte FIFOs each way, status register, and an interrupt enable that masks the handler
+// Line side is driven by the test, which decides when bytes arrive and when transmitted bytes leave the TX FIFO
+
+#define UART_MODEL_DEVICES 4 // Device IDs served
+#define UART_MODEL_FIFO 16 // Bytes held by each FIFO, as in hardware
+#define UART_MODEL_BASE 0x40600000 // Base address of device 0, later devices follow at UART_MODEL_STRIDE
+#define UART_MODEL_STRIDE 0x10000
+
+void uart_model_reset(); // All devices idle with empty FIFOs and interrupts disabled
+
+// Register access from firmware
+u32 uart_model_status(u32 base);
+void uart_model_write(u32 base, u32 offset, u32 data);
+u8 uart_model_recv(u32 base);
+
+// Line side
+int uart_model_arrive(int device, u8 c); // Byte received off the line, 0 if RX FIFO overran
+int uart_model_transmit(int device, int max); // Move up to max bytes out of TX FIFO onto the line, returns bytes moved
+int uart_model_take(int device, u8 *data, int max); // Bytes put on the line since last taken, oldest first
+int uart_model_rx_space(int device); // Room in RX FIFO
+
+// Interrupts - handler only runs while enabled, and masking from another thread waits for a running handler to finish
+int uart_model_enabled(int device);
+void uart_model_isr_enter(int device); // Interrupt taken, holds off masking until uart_model_isr_leave
+void uart_model_isr_leave(int device);
+
+#endif /* UART_MODEL_H_ */
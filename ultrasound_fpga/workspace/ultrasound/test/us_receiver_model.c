@@ -0,0 +1,347 @@
+#include "us_receiver_model.h"
+
+// Commands and responses, as us_receiver.v
+#define COMM_ECHO 0x0
+#define COMM_TEMP 0x1
+#define COMM_SAMPLE 0x2
+#define COMM_INIT 0x3
+#define COMM_ABORT 0x4
+#define COMM_RESET 0xF
+#define RESP_ECHO 0x0
+#define RESP_TEMP 0x1
+#define RESP_SAMPLE 0x2
+#define RESP_NONE 0x3
+#define RESP_UNKNOWN 0x7
+#define STATUS_OK 0x0
+#define STATUS_ERROR 0x1
+
+// Registers of us_receiver.v, each held in a wider type and masked to its width on assignment
+typedef struct model_regs {
+	int state;
+	u8 command; // [3:0]
+	u32 dataIn; // [27:0]
+	u16 sampleCount; // [9:0]
+	u16 samplePeriod; // [11:0]
+	u16 sampleTimer; // [11:0]
+	u8 sampling;
+	u8 status;
+	u8 type; // [2:0]
+	u32 dataOut; // [27:0]
+	u8 sampleSensor; // [7:0]
+} model_regs;
+
+// FIFO between MicroBlaze and sequencer
+typedef struct model_fifo {
+	u32 data[MODEL_FSL_DEPTH];
+	int head;
+	int count;
+} model_fifo;
+
+int modelFslInvalid = 0;
+
+static model_regs modelRegs;
+static model_fifo modelIn;
+static model_fifo modelOut;
+
+// ADC controller handshake - busy while a conversion or SPI transfer is in progress, result held until read
+static int modelAdcBusy;
+static u8 modelAdcHas;
+static u16 modelAdcData;
+static u16 modelAdcNext;
+static u8 modelAdcResult; // Conversion in progress returns a value, initialisation doesn't
+
+static model_adc_source modelSource;
+static u32 modelCycles;
+static u32 modelFired[16]; // Cycle each sensor address last fired
+static int modelReads;
+static int modelSamples;
+static int modelAborts;
+static int modelLost;
+
+static void model_fifo_push(model_fifo *fifo, u32 word) {
+	fifo->data[(fifo->head + fifo->count) % MODEL_FSL_DEPTH] = word;
+	fifo->count++;
+}
+
+static u32 model_fifo_pop(model_fifo *fifo) {
+	u32 word = fifo->data[fifo->head];
+	fifo->head = (fifo->head + 1) % MODEL_FSL_DEPTH;
+	fifo->count--;
+	return word;
+}
+
+void model_reset(model_adc_source source) {
+	int i;
+
+	modelRegs = (model_regs) {MODEL_IDLE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	modelIn.head = modelIn.count = 0;
+	modelOut.head = modelOut.count = 0;
+	modelAdcBusy = 0;
+	modelAdcHas = 0;
+	modelAdcData = 0;
+	modelSource = source;
+	modelCycles = 0;
+	for(i = 0; i < 16; i++) modelFired[i] = 0;
+	modelReads = 0;
+	modelSamples = 0;
+	modelAborts = 0;
+	modelLost = 0;
+}
+
+void model_step(int cycles) {
+	model_regs *n = &modelRegs;
+
+	while(cycles-- > 0) {
+		const model_regs r = modelRegs;
+		u8 exists = (modelIn.count > 0);
+		u32 data = exists ? modelIn.data[modelIn.head] : 0;
+
+		// Combinational outputs, from registers before the clock edge
+		u8 fslRead = (r.state == MODEL_READ_INPUT || r.state == MODEL_ABORT_SAMPLING) ? exists : 0;
+		u8 fslFull = (modelOut.count >= MODEL_FSL_DEPTH);
+		u8 fslWrite = (r.state == MODEL_WRITE_OUTPUT) ? !fslFull : 0;
+		u8 adcReady = (modelAdcBusy == 0);
+		u8 adcReadReady = modelAdcHas && modelAdcBusy == 0;
+		u8 adcRequest = (r.state == MODEL_REQUEST_SAMPLE || r.state == MODEL_REQUEST_TEMP || r.state == MODEL_SEND_INIT) ? adcReady : 0;
+		u8 adcRead = (r.state == MODEL_RECEIVE_SAMPLE || r.state == MODEL_RECEIVE_TEMP) ? adcReadReady : 0;
+
+		// Sequencer, non-blocking assignments from r into n
+		switch(r.state) {
+			case MODEL_IDLE: {
+				if(exists) n->state = MODEL_READ_INPUT;
+				break;
+			}
+			case MODEL_READ_INPUT: {
+				if(exists) {
+					n->command = data & 0xF;
+					n->dataIn = data >> 4;
+					n->state = MODEL_PROCESS_COMMAND;
+				}
+				break;
+			}
+			case MODEL_PROCESS_COMMAND: {
+				switch(r.command) {
+					case COMM_ECHO: {
+						n->status = STATUS_OK;
+						n->type = RESP_ECHO;
+						n->dataOut = r.dataIn;
+						n->state = MODEL_WRITE_OUTPUT;
+						break;
+					}
+					case COMM_TEMP: {
+						n->state = MODEL_REQUEST_TEMP;
+						break;
+					}
+					case COMM_SAMPLE: {
+						n->sampleSensor = r.dataIn & 0xF;
+						n->sampleCount = (r.dataIn >> 4) & 0x3FF;
+						n->samplePeriod = (r.dataIn >> 14) & 0xFFF;
+						n->state = MODEL_START_SAMPLING;
+						break;
+					}
+					case COMM_INIT: {
+						n->state = MODEL_SEND_INIT;
+						break;
+					}
+					case COMM_ABORT: {
+						n->status = STATUS_OK;
+						n->type = RESP_NONE;
+						n->dataOut = 0;
+						n->state = MODEL_WRITE_OUTPUT;
+						break;
+					}
+					case COMM_RESET: {
+						n->dataIn = 0;
+						n->sampleSensor = 0;
+						n->sampleCount = 0;
+						n->samplePeriod = 0;
+						n->sampleTimer = 0;
+						n->sampling = 0;
+						n->status = STATUS_OK;
+						n->type = RESP_NONE;
+						n->dataOut = 0;
+						n->state = MODEL_WRITE_OUTPUT;
+						break;
+					}
+					default: {
+						n->status = STATUS_ERROR;
+						n->type = RESP_UNKNOWN;
+						n->dataOut = 0;
+						n->state = MODEL_WRITE_OUTPUT;
+						break;
+					}
+				}
+				break;
+			}
+			case MODEL_WRITE_OUTPUT: {
+				if(r.sampling == 0) {
+					n->state = MODEL_IDLE;
+				} else if(r.sampleCount == 0) {
+					n->sampling = 0;
+					n->state = MODEL_IDLE;
+				} else {
+					if(r.sampleTimer != 0) n->sampleTimer = r.sampleTimer - 1;
+					n->state = MODEL_WAIT_TO_SAMPLE;
+				}
+				break;
+			}
+			case MODEL_SEND_INIT: {
+				if(adcReady) n->state = MODEL_CONFIRM_INIT;
+				break;
+			}
+			case MODEL_CONFIRM_INIT: {
+				if(adcReady) {
+					n->status = STATUS_OK;
+					n->type = RESP_NONE;
+					n->dataOut = 0;
+					n->state = MODEL_WRITE_OUTPUT;
+				}
+				break;
+			}
+			case MODEL_REQUEST_TEMP: {
+				if(adcReady) n->state = MODEL_RECEIVE_TEMP;
+				break;
+			}
+			case MODEL_RECEIVE_TEMP: {
+				if(adcReadReady) {
+					n->status = STATUS_OK;
+					n->type = RESP_TEMP;
+					n->dataOut = modelAdcData;
+					n->state = MODEL_WRITE_OUTPUT;
+				}
+				break;
+			}
+			case MODEL_START_SAMPLING: {
+				if(r.sampleCount == 0) {
+					n->sampling = 0;
+					n->state = MODEL_IDLE;
+				} else {
+					n->sampling = 1;
+					n->sampleTimer = (r.samplePeriod - 1) & 0xFFF;
+					n->state = MODEL_REQUEST_SAMPLE;
+				}
+				break;
+			}
+			case MODEL_WAIT_TO_SAMPLE: {
+				if(exists && (data & 0xF) == COMM_ABORT) {
+					n->state = MODEL_ABORT_SAMPLING;
+				} else if(r.sampleTimer == 0) {
+					n->sampleTimer = (r.samplePeriod - 1) & 0xFFF;
+					n->state = MODEL_REQUEST_SAMPLE;
+				} else {
+					n->sampleTimer = r.sampleTimer - 1;
+				}
+				break;
+			}
+			case MODEL_REQUEST_SAMPLE: {
+				if(r.sampleTimer != 0) n->sampleTimer = r.sampleTimer - 1;
+				if(adcReady) {
+					n->sampleCount = (r.sampleCount - 1) & 0x3FF;
+					n->state = MODEL_RECEIVE_SAMPLE;
+				}
+				break;
+			}
+			case MODEL_RECEIVE_SAMPLE: {
+				if(r.sampleTimer != 0) n->sampleTimer = r.sampleTimer - 1;
+				if(adcReadReady) {
+					n->status = STATUS_OK;
+					n->type = RESP_SAMPLE;
+					n->dataOut = modelAdcData;
+					n->state = MODEL_WRITE_OUTPUT;
+				}
+				break;
+			}
+			case MODEL_ABORT_SAMPLING: {
+				modelAborts++;
+				n->sampleCount = 0;
+				n->sampleTimer = 0;
+				n->sampling = 0;
+				n->status = STATUS_OK;
+				n->type = RESP_NONE;
+				n->dataOut = 0;
+				n->state = MODEL_WRITE_OUTPUT;
+				break;
+			}
+			default: {
+				n->state = MODEL_IDLE;
+				break;
+			}
+		}
+
+		// FIFOs move on the same edge
+		if(fslRead) {
+			model_fifo_pop(&modelIn);
+			modelReads++;
+		}
+		if(fslWrite) model_fifo_push(&modelOut, (r.dataOut << 4) | (r.type << 1) | r.status);
+		if(r.state == MODEL_WRITE_OUTPUT && fslFull) modelLost++;
+
+		// ADC controller - sample is taken when conversion starts, result can be read once transfer is over
+		if(modelAdcBusy > 0 && --modelAdcBusy == 0) {
+			modelAdcData = modelAdcNext;
+			modelAdcHas = modelAdcResult;
+		}
+		if(adcRead) modelAdcHas = 0;
+		if(adcRequest) {
+			modelAdcBusy = MODEL_ADC_CYCLES;
+			modelAdcResult = (r.state != MODEL_SEND_INIT);
+			if(r.state == MODEL_REQUEST_SAMPLE) {
+				modelAdcNext = (modelSource != 0) ? modelSource(r.sampleSensor & 0xF, modelCycles - modelFired[r.sampleSensor & 0xF]) & 0x3FF : 0;
+				modelSamples++;
+			} else {
+				modelAdcNext = 0;
+			}
+		}
+
+		modelCycles++;
+	}
+}
+
+u32 model_cycle() {
+	return modelCycles;
+}
+
+void model_fsl_put(u32 word) {
+	// MicroBlaze put blocks while FIFO is full
+	while(modelIn.count >= MODEL_FSL_DEPTH) model_step(1);
+	model_fifo_push(&modelIn, word);
+}
+
+u32 model_fsl_get() {
+	while(modelOut.count == 0) model_step(1);
+	return model_fifo_pop(&modelOut);
+}
+
+u32 model_fsl_nget(int *invalid) {
+	*invalid = (modelOut.count == 0);
+	return *invalid ? 0 : model_fifo_pop(&modelOut);
+}
+
+int model_fsl_waiting() {
+	return modelOut.count;
+}
+
+void model_pulse(u32 value) {
+	// Enable in bit 16, cycle count in bits 15:4, address in bits 3:0 - burst starts straight away
+	if(value & (1 << 16)) modelFired[value & 0xF] = modelCycles;
+}
+
+int model_state() {
+	return modelRegs.state;
+}
+
+int model_reads() {
+	return modelReads;
+}
+
+int model_samples() {
+	return modelSamples;
+}
+
+int model_aborts() {
+	return modelAborts;
+}
+
+int model_lost() {
+	return modelLost;
+}
@@ -0,0 +1,53 @@
+#ifndef US_RECEIVER_MODEL_H_
+#define US_RECEIVER_MODEL_H_
+
+#include "xil_types.h"
+
+// Cycle by cycle C transcription of the us_receiver.v sequencer and its FSL FIFOs, for host tests where no HDL simulator is available
+// ADC controller (mkADC) is reduced to its ready / busy handshake with a fixed conversion time, pulsegen to the time each pulse starts
+
+#define MODEL_FSL_DEPTH 256 // Words held by each FSL FIFO
+#define MODEL_ADC_CYCLES 400 // FSL clock cycles from sample request until result can be read, SPI transfers in mkADC take about this long
+#define MODEL_CLOCK 100 // FSL clock cycles per uS
+
+// States, same encoding as us_receiver.v
+enum MODEL_STATE {
+	MODEL_IDLE = 0x0001,
+	MODEL_READ_INPUT = 0x0002,
+	MODEL_PROCESS_COMMAND = 0x0004,
+	MODEL_WRITE_OUTPUT = 0x0008,
+	MODEL_SEND_INIT = 0x0010,
+	MODEL_CONFIRM_INIT = 0x0020,
+	MODEL_REQUEST_TEMP = 0x0040,
+	MODEL_RECEIVE_TEMP = 0x0080,
+	MODEL_START_SAMPLING = 0x0100,
+	MODEL_WAIT_TO_SAMPLE = 0x0200,
+	MODEL_REQUEST_SAMPLE = 0x0400,
+	MODEL_RECEIVE_SAMPLE = 0x0800,
+	MODEL_ABORT_SAMPLING = 0x1000
+};
+
+// Sample value for a sensor address, given FSL clock cycles since that sensor last fired (or since reset if it never has)
+typedef unsigned short (*model_adc_source)(u8 sensor, u32 sinceFire);
+
+void model_reset(model_adc_source source); // FSL_Rst, empties both FIFOs
+void model_step(int cycles); // Run FSL clock for a number of cycles
+u32 model_cycle(); // FSL clock cycles since reset
+
+void model_fsl_put(u32 word); // MicroBlaze writes command word
+u32 model_fsl_get(); // MicroBlaze blocking read, clock runs until a word is waiting
+u32 model_fsl_nget(int *invalid); // MicroBlaze non-blocking read, invalid set when nothing is waiting
+int model_fsl_waiting(); // Words waiting for MicroBlaze
+
+void model_pulse(u32 value); // pulsegen register write, value as written by pulseGen_GeneratePulse
+
+extern int modelFslInvalid; // Carry flag after latest non-blocking read, as fsl_isinvalid() sees it
+
+// Observation
+int model_state(); // Current sequencer state
+int model_reads(); // Cycles FSL_S_Read has been high since reset
+int model_samples(); // Samples converted since reset
+int model_aborts(); // Abort commands taken while sampling since reset
+int model_lost(); // Words written while output FIFO was full, dropped by the sequencer
+
+#endif /* US_RECEIVER_MODEL_H_ */
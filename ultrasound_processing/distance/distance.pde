@@ -23,6 +23,11 @@ final static boolean SENSOR_AUTOSCALE = true; // Automatically scale rather than
 final static float SENSOR_MAX_RANGE = 300; // mm
 final static float SCREEN_EDGE_OFFSET = 5; // pixels - do not allow line to get closer than this to edge
 
+// FPGA telemetry channels
+final static int TELEM_CH_LOG = 0x02;
+final static int TELEM_CH_RANGE = 0x03;
+final static int TELEM_HEADER_LEN = 6; // Channel, sequence number, timestamp
+
 final static float SENSOR_ANGLE = TWO_PI / SENSOR_COUNT;
 
 final static float SENSOR_ANGLE_OFFSET = -SENSOR_ANGLE / 2;
@@ -125,8 +130,8 @@ void setup() {
     }
   
     if (FPGA)
-      // Generate a serialEvent each 2 bytes
-      serialPort.buffer(2);
+      // Generate a serialEvent at the end of each frame
+      serialPort.bufferUntil(0);
     else
       // Generate serialEvent for each line
       serialPort.bufferUntil('\n');
@@ -326,76 +331,88 @@ void readFile() {
 void serialEvent(Serial port) {
   // Process sample from serial port, logging it to file one a complete sample is recieved (if logging enabled)
   if (FPGA) {
-    if (port.available() > 1) {
-      int[] inBuffer = new int[2];
-      inBuffer[0] = port.read();
-      inBuffer[1] = port.read();
-      processSample(inBuffer, true);
-    }
+    byte[] inBuffer = port.readBytesUntil(0);
+    if (inBuffer != null) processFrame(inBuffer, inBuffer.length - 1, true);
   }
   else
     processSample(port.readStringUntil('\n'), true);
 }
 
-// FPGA version
-void processSample(int[] input, boolean log) {
-  if (input != null) {
-    // Check input against start / end
-    if (input[0] == 0xFF && input[1] == 0xFF) {
-      // Check state
-      if (state == WAITING) {
-        // Reset index
-        dataIndex = 0;
-
-        // Change state
-        state = SAMPLING;
-      }
-    } 
-    else if (input[0] == 0x7F && input[1] == 0xFF) {
-      // Check state
-      if (state == SAMPLING) {
-        // Check index
-        if (dataIndex == data.length) {         
-          // Log sample
-          if(log) {
-            writeFile("START");
-            for(int i = 0; i < data.length; i++) writeFile(String.valueOf(data[i]));
-            writeFile("END");
-          }
-          
-          // Update cycle count
-          cycleCount++;
-
-          // Change state                   
-          state = (continuous ? WAITING : COMPLETE);
-        } 
-        else {
-          // Change state
-          state = ERROR;
-        }
-      }
-    } 
-    else if (state == SAMPLING) {      
-      int index = input[0] & 0x0F;
-      
-      int value = ((input[0] & 0xF0) << 4) | input[1];
+// FPGA version - frames are COBS encoded, with a CRC16 on the end
+void processFrame(byte[] input, int length, boolean log) {
+  int[] frame = cobsDecode(input, length);
+  
+  // Ignore anything corrupted or cut short
+  if (frame == null || frame.length < TELEM_HEADER_LEN + 2) return;
+  int crc = frame[frame.length - 2] | (frame[frame.length - 1] << 8);
+  if (crc16(frame, frame.length - 2) != crc) return;
+  
+  if (frame[0] == TELEM_CH_LOG) {
+    // Print debug messages
+    String sMsg = "";
+    for (int i = TELEM_HEADER_LEN; i < frame.length - 2; i++) sMsg += (char) frame[i];
+    println("#DBG: " + sMsg);
+  }
+  else if (frame[0] == TELEM_CH_RANGE && state == WAITING) {
+    // Only sensors whose range changed are sent, rest keep their last value
+    int mask = frame[TELEM_HEADER_LEN + 4] | (frame[TELEM_HEADER_LEN + 5] << 8);
+    int index = TELEM_HEADER_LEN + 6;
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+      if ((mask & (1 << i)) == 0) continue;
+      if (index + 1 >= frame.length - 2) return;
       
-      if (value > 4000)
-        value = -1;
-
-      // Check index
-      if (dataIndex >= data.length) {
-        // Change state
-        state = ERROR;
-
-        // Return early
-        return;
-      }
+      // Signed 16-bit range, -1 for nothing found
+      int value = (short) (frame[index] | (frame[index + 1] << 8));
+      index += 2;
 
       // Store value
-      data[dataIndex++] = value;
+      data[i] = value;
+    }
+    
+    // Log sample
+    if(log) {
+      writeFile("START");
+      for(int i = 0; i < data.length; i++) writeFile(String.valueOf(data[i]));
+      writeFile("END");
     }
+    
+    // Update cycle count
+    cycleCount++;
+
+    // Change state                   
+    state = (continuous ? WAITING : COMPLETE);
+  }
+}
+
+int[] cobsDecode(byte[] input, int length) {
+  int[] output = new int[length];
+  int inIndex = 0;
+  int outIndex = 0;
+  
+  while (inIndex < length) {
+    int code = input[inIndex++] & 0xFF;
+    if (code == 0 || inIndex + code - 1 > length) return null;
+    
+    for (int i = 1; i < code; i++) output[outIndex++] = input[inIndex++] & 0xFF;
+    
+    // Every block but a full length one or the last stands for a zero
+    if (code != 0xFF && inIndex < length) output[outIndex++] = 0;
+  }
+  
+  return subset(output, 0, outIndex);
+}
+
+int crc16(int[] data, int length) {
+  // CRC-16/CCITT, same as frame_crc16 on the FPGA
+  int crc = 0xFFFF;
+  for (int i = 0; i < length; i++) {
+    crc = ((crc >> 8) | (crc << 8)) & 0xFFFF;
+    crc ^= data[i];
+    crc ^= (crc & 0xFF) >> 4;
+    crc = (crc ^ (crc << 12)) & 0xFFFF;
+    crc = (crc ^ ((crc & 0xFF) << 5)) & 0xFFFF;
   }
+  return crc;
 }
 
 // mBed version
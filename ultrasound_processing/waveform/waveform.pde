@@ -32,6 +32,18 @@ final static int DISPLAY_MESSAGE_TIME = 5; // Seconds to display onscreen messag
 
 final static String LOG_FILE_NAME = "ultrasound_log_"; // Prefix of log file name
 
+// FPGA telemetry channels
+final static int TELEM_CH_LOG = 0x02;
+final static int TELEM_CH_WAVEFORM = 0x06;
+final static int TELEM_HEADER_LEN = 6; // Channel, sequence number, timestamp
+final static int WAVEFORM_HEADER_LEN = 14; // Scan, sensor, samples in capture, first sample, samples in chunk, region of interest, shift
+
+// FPGA waveform codec, must match wavecodec.h
+final static int WAVECODEC_FIRST = 512; // Prediction for first two samples
+final static int WAVECODEC_LIMIT = 12; // Longest unary quotient before escape
+final static int WAVECODEC_RAW_BITS = 16; // Size of escaped difference
+final static int WAVECODEC_RESET = 32; // Samples after which adaptation history is halved
+
 final static int DEFAULT_PAGE_SIZE = 400; // Samples per screen
 final static int PAGE_CHANGE = 10; // Amount to inc / dec page size by per key stroke
 
@@ -174,8 +186,8 @@ void setup() {
     }
     
     if (FPGA)
-      // Generate a serialEvent each 2 bytes
-      serialPort.buffer(2);
+      // Generate a serialEvent at the end of each frame
+      serialPort.bufferUntil(0);
     else
       // Generate serialEvent for each line
       serialPort.bufferUntil('\n');
@@ -383,18 +395,133 @@ void readFile() {
 void serialEvent(Serial port) {
   // Process sample from serial port, logging it to file one a complete sample is recieved (if logging enabled)
   if (FPGA) {
-    if (port.available() > 1) {
-      int[] inBuffer = new int[2];
-      inBuffer[0] = port.read();
-      inBuffer[1] = port.read();
-      processSample(inBuffer, true);
-    }
+    byte[] inBuffer = port.readBytesUntil(0);
+    if (inBuffer != null) processFrame(inBuffer, inBuffer.length - 1, true);
   }
   else
     processSample(port.readStringUntil('\n'), true);
 }
 
-// FPGA version
+// FPGA version - frames are COBS encoded, with a CRC16 on the end
+void processFrame(byte[] input, int length, boolean log) {
+  int[] frame = cobsDecode(input, length);
+  
+  // Ignore anything corrupted or cut short
+  if (frame == null || frame.length < TELEM_HEADER_LEN + 2) return;
+  int crc = frame[frame.length - 2] | (frame[frame.length - 1] << 8);
+  if (crc16(frame, frame.length - 2) != crc) return;
+  
+  if (frame[0] == TELEM_CH_LOG) {
+    // Print debug messages
+    String sMsg = "";
+    for (int i = TELEM_HEADER_LEN; i < frame.length - 2; i++) sMsg += (char) frame[i];
+    println("#DBG: " + sMsg);
+  }
+  else if (frame[0] == TELEM_CH_WAVEFORM && frame.length >= TELEM_HEADER_LEN + WAVEFORM_HEADER_LEN + 2) {
+    int index = TELEM_HEADER_LEN;
+    int sensor = frame[index + 2];
+    int total = frame[index + 3] | (frame[index + 4] << 8);
+    int first = frame[index + 5] | (frame[index + 6] << 8);
+    int count = frame[index + 7] | (frame[index + 8] << 8);
+    int roiStart = frame[index + 9] | (frame[index + 10] << 8);
+    int roiEnd = frame[index + 11] | (frame[index + 12] << 8);
+    int shift = frame[index + 13];
+    
+    // Check sensor index - ignore other data
+    if (sensor != sensorIndex) return;
+    
+    int[] samples = waveDecode(frame, TELEM_HEADER_LEN + WAVEFORM_HEADER_LEN, frame.length - 2, count, first, roiStart, roiEnd, shift);
+    if (samples == null) return;
+    
+    // Feed samples through as start marker, sensor and value pairs, then end marker
+    if (first == 0) processSample(new int[] {0xFF, 0xFF}, log);
+    for (int i = 0; i < count; i++) processSample(new int[] {((samples[i] >> 4) & 0xF0) | sensor, samples[i] & 0xFF}, log);
+    if (first + count >= total) processSample(new int[] {0x7F, 0xFF}, log);
+  }
+}
+
+// Decode chunk of waveform samples, mirror of wavecodec_decode on the FPGA
+int[] waveDecode(int[] frame, int start, int end, int count, int first, int roiStart, int roiEnd, int shift) {
+  int[] samples = new int[count];
+  int bitIndex = start * 8;
+  int previous = WAVECODEC_FIRST;
+  int twoBack = WAVECODEC_FIRST;
+  int sum = 4;
+  int sumCount = 1;
+  
+  for (int i = 0; i < count; i++) {
+    int s = (first + i >= roiStart && first + i < roiEnd) ? 0 : shift;
+    int k = 0;
+    while ((sumCount << k) < sum) k++;
+    
+    // Unary quotient then remainder, or escape then raw value
+    int quotient = 0;
+    while (quotient < WAVECODEC_LIMIT) {
+      if (bitIndex >= end * 8) return null;
+      int bit = (frame[bitIndex >> 3] >> (7 - (bitIndex & 7))) & 1;
+      bitIndex++;
+      if (bit == 0) break;
+      quotient++;
+    }
+    int bits = (quotient == WAVECODEC_LIMIT) ? WAVECODEC_RAW_BITS : k;
+    if (bitIndex + bits > end * 8) return null;
+    int mapped = 0;
+    for (int j = 0; j < bits; j++) {
+      mapped = (mapped << 1) | ((frame[bitIndex >> 3] >> (7 - (bitIndex & 7))) & 1);
+      bitIndex++;
+    }
+    if (quotient < WAVECODEC_LIMIT) mapped |= quotient << k;
+    
+    // Undo mapping and prediction from sample two back, coarse samples go back in middle of their range
+    int difference = ((mapped & 1) != 0) ? -((mapped + 1) >> 1) : mapped >> 1;
+    int value = (twoBack >> s) + difference;
+    twoBack = previous;
+    previous = (s > 0) ? (value << s) | (1 << (s - 1)) : value;
+    samples[i] = previous;
+    
+    sum += mapped;
+    sumCount++;
+    if (sumCount >= WAVECODEC_RESET) {
+      sum >>= 1;
+      sumCount >>= 1;
+    }
+  }
+  
+  return samples;
+}
+
+int[] cobsDecode(byte[] input, int length) {
+  int[] output = new int[length];
+  int inIndex = 0;
+  int outIndex = 0;
+  
+  while (inIndex < length) {
+    int code = input[inIndex++] & 0xFF;
+    if (code == 0 || inIndex + code - 1 > length) return null;
+    
+    for (int i = 1; i < code; i++) output[outIndex++] = input[inIndex++] & 0xFF;
+    
+    // Every block but a full length one or the last stands for a zero
+    if (code != 0xFF && inIndex < length) output[outIndex++] = 0;
+  }
+  
+  return subset(output, 0, outIndex);
+}
+
+int crc16(int[] data, int length) {
+  // CRC-16/CCITT, same as frame_crc16 on the FPGA
+  int crc = 0xFFFF;
+  for (int i = 0; i < length; i++) {
+    crc = ((crc >> 8) | (crc << 8)) & 0xFFFF;
+    crc ^= data[i];
+    crc ^= (crc & 0xFF) >> 4;
+    crc = (crc ^ (crc << 12)) & 0xFFFF;
+    crc = (crc ^ ((crc & 0xFF) << 5)) & 0xFFFF;
+  }
+  return crc;
+}
+
+// Sample pairs as fed from decoded frames
 void processSample(int[] input, boolean log) {
   if (input != null) {
     // Check input against start / end